@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2011 Fredi Machado <https://github.com/Fredi>
+ * IRCClient is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * http://www.gnu.org/licenses/lgpl.html 
+ */
+
+#include "TwitchHype.h"
+
+#include "IRCArena.h"
+
+IRCArena::IRCArena(size_t blockSize) : _blockSize(blockSize), _current(0), _offset(0)
+{
+}
+
+IRCArena::~IRCArena()
+{
+    for (size_t i = 0; i < _blocks.size(); ++i)
+        FMemory::Free(_blocks[i].data);
+}
+
+void* IRCArena::Allocate(size_t size, size_t alignment)
+{
+    for (; _current < _blocks.size(); ++_current, _offset = 0)
+    {
+        Block& block = _blocks[_current];
+        size_t start = (_offset + alignment - 1) & ~(alignment - 1);
+        if (start + size <= block.size)
+        {
+            _offset = start + size;
+            _stats.used += size;
+            _stats.peak = FMath::Max(_stats.peak, _stats.used);
+            return block.data + start;
+        }
+    }
+
+    // Out of room in every block, a request bigger than a block gets one to itself
+    Block block;
+    block.size = FMath::Max(_blockSize, size);
+    block.data = (char*)FMemory::Malloc(block.size, FMath::Max<size_t>(alignment, 16));
+    _blocks.push_back(block);
+    ++_stats.blocks;
+
+    _current = _blocks.size() - 1;
+    _offset = size;
+    _stats.used += size;
+    _stats.peak = FMath::Max(_stats.peak, _stats.used);
+    return block.data;
+}
+
+IRCStringView IRCArena::Copy(IRCStringView text)
+{
+    char* data = (char*)Allocate(text.size(), 1);
+    memcpy(data, text.data(), text.size());
+    return IRCStringView(data, text.size());
+}
+
+void IRCArena::Reset()
+{
+    _current = 0;
+    _offset = 0;
+    _stats.used = 0;
+    ++_stats.resets;
+}
@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2011 Fredi Machado <https://github.com/Fredi>
+ * IRCClient is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * http://www.gnu.org/licenses/lgpl.html 
+ */
+
+#ifndef _IRCARENA_H
+#define _IRCARENA_H
+
+#include <new>
+#include <vector>
+#include "IRCStringView.h"
+
+struct IRCArenaStats
+{
+    IRCArenaStats() : blocks(0), used(0), peak(0), resets(0) {};
+
+    // Heap allocations the arena has made, this stops moving once it's big enough for a busy frame
+    unsigned long long blocks;
+
+    // Bytes handed out since the last reset, and the most any frame has needed
+    size_t used;
+    size_t peak;
+
+    unsigned long long resets;
+};
+
+// Bump allocator for scratch that only has to last until the end of the frame. Blocks are
+// kept across resets, so after the first busy frame nothing here touches the heap.
+// Nothing allocated here is ever destroyed, only put trivially destructible things in it.
+class IRCArena
+{
+public:
+    explicit IRCArena(size_t blockSize = 16 * 1024);
+    ~IRCArena();
+
+    void* Allocate(size_t size, size_t alignment = 16);
+
+    template <typename T>
+    T* New() { return new (Allocate(sizeof(T))) T(); };
+
+    // A copy of text that lives until the next Reset
+    IRCStringView Copy(IRCStringView text);
+
+    // Everything allocated since the last reset is gone, call once per frame
+    void Reset();
+
+    IRCArenaStats const& Stats() const { return _stats; };
+
+private:
+    struct Block
+    {
+        char* data;
+        size_t size;
+    };
+
+    // Copying would free the blocks twice
+    IRCArena(IRCArena const&);
+    IRCArena& operator=(IRCArena const&);
+
+    std::vector<Block> _blocks;
+    size_t _blockSize;
+
+    // Block being allocated from and how far into it
+    size_t _current;
+    size_t _offset;
+
+    IRCArenaStats _stats;
+};
+
+#endif
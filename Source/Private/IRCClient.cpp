@@ -20,6 +20,7 @@
 #include "IRCSocket.h"
 #include "IRCClient.h"
 #include "IRCHandler.h"
+#include "IRCScan.h"
 
 std::vector<std::string> split(std::string const& text, char sep)
 {
@@ -34,153 +35,914 @@ std::vector<std::string> split(std::string const& text, char sep)
     return tokens;
 }
 
+IRCClient::~IRCClient()
+{
+    StopNetworkThread();
+
+    for (size_t i = 0; i < _writers.size(); ++i)
+        delete _writers[i];
+}
+
 bool IRCClient::InitSocket()
 {
+    for (size_t i = 0; i < _writers.size(); ++i)
+        _writers[i]->InitSocket();
+
     return _socket.Init();
 }
 
+static char const* ircStateNames[NUM_IRC_STATES] =
+{
+    "disconnected",
+    "connecting",
+    "registering",
+    "joining",
+    "ready",
+    "waiting to reconnect",
+};
+
 bool IRCClient::Connect(char* host, int port)
 {
-    return _socket.Connect(host, port);
+    _host = host;
+    _port = port;
+    _sessions = 0;
+    _reconnectAttempts = 0;
+
+    // Writers keep their own state machines, a writer that can't connect only costs its share of the chat
+    for (size_t i = 0; i < _writers.size(); ++i)
+        _writers[i]->Connect(host, port);
+    BuildRing();
+
+    return StartConnect(FPlatformTime::Seconds());
 }
 
 void IRCClient::Disconnect()
 {
+    for (size_t i = 0; i < _writers.size(); ++i)
+        _writers[i]->Disconnect();
+
+    CloseSocket();
+    SetState(IRC_STATE_DISCONNECTED, FPlatformTime::Seconds());
+}
+
+char const* IRCClient::StateName() const
+{
+    return ircStateNames[_state];
+}
+
+void IRCClient::SetState(IRCConnectionState state, double now)
+{
+    _state = state;
+    _stateTime = now;
+}
+
+bool IRCClient::StartConnect(double now)
+{
+    if (!_socket.Connect(_host.c_str(), _port, _connectTimeout))
+    {
+        ScheduleReconnect(now);
+        return false;
+    }
+
+    SetState(IRC_STATE_CONNECTING, now);
+    return true;
+}
+
+void IRCClient::CloseSocket()
+{
+    StopNetworkThread();
     _socket.Disconnect();
+
+    // Whatever protocol upkeep was pending belongs to the old session
+    _sendQueue.Clear(IRC_PRIORITY_CONTROL);
+}
+
+void IRCClient::Drop()
+{
+    // Join the thread first so the socket's output buffer and the outbound ring hold still
+    if (_networkThread)
+        _networkThread->Shutdown();
+
+    std::vector<IRCUnsentLine> unsent;
+    _socket.TakeUnsentLines(unsent);
+    if (_networkThread)
+        _networkThread->TakeOutbound(unsent);
+
+    CloseSocket();
+
+    // Chat that was already on its way goes out first thing on the next session, in the
+    // same order. Protocol lines are left behind, the next session makes its own.
+    double now = FPlatformTime::Seconds();
+    for (std::vector<IRCUnsentLine>::reverse_iterator itr = unsent.rbegin(); itr != unsent.rend(); ++itr)
+        if (itr->line.compare(0, 8, "PRIVMSG ") == 0)
+            QueueFor(itr->line).Requeue(itr->line, (IRCSendPriority)itr->priority, now);
+
+    ScheduleReconnect(now);
+}
+
+void IRCClient::ScheduleReconnect(double now)
+{
+    // The first retry after a session that stayed up is immediate, repeated failures
+    // back off exponentially. Equal jitter keeps at least half of each delay so a
+    // flapping server still gets room, while the other half spreads retries out.
+    double delay = 0;
+    if (_reconnectAttempts > 0)
+    {
+        delay = FMath::Min(_reconnectDelayMax, _reconnectDelayMin * (double)(1 << FMath::Min(_reconnectAttempts - 1, 16)));
+        delay *= 0.5 + 0.5 * FMath::FRand();
+    }
+
+    ++_reconnectAttempts;
+    _reconnectTime = now + delay;
+    SetState(IRC_STATE_BACKOFF, now);
+
+    UE_LOG(LogUTTwitchHype, Warning, TEXT("Reconnecting to the server in %.1fs."), delay);
+}
+
+void IRCClient::Register(double now)
+{
+    // Asked for first, so the replies to registration already carry tags
+    _capabilities.clear();
+    if (!_capabilityRequest.empty())
+        SendIRC("CAP REQ :" + _capabilityRequest, IRC_PRIORITY_CONTROL);
+
+    if (!_pass.empty())
+        SendIRC("PASS " + _pass, IRC_PRIORITY_CONTROL);
+    SendIRC("NICK " + _nick, IRC_PRIORITY_CONTROL);
+
+    _keepalive.Reset(now);
+    SetState(IRC_STATE_REGISTERING, now);
+}
+
+void IRCClient::JoinChannels(double now)
+{
+    for (size_t i = 0; i < _channels.size(); ++i)
+        SendIRC("JOIN " + _channels[i], IRC_PRIORITY_CONTROL);
+
+    _pendingJoins = _channels.size();
+    SetState(IRC_STATE_JOINING, now);
+
+    if (_pendingJoins == 0)
+    {
+        ++_sessions;
+        SetState(IRC_STATE_READY, now);
+    }
+}
+
+void IRCClient::Tick()
+{
+    for (size_t i = 0; i < _writers.size(); ++i)
+        _writers[i]->Tick();
+
+    // Everything built last tick has been queued or sent by now
+    _frameArena.Reset();
+
+    double now = FPlatformTime::Seconds();
+
+    switch (_state)
+    {
+    case IRC_STATE_CONNECTING:
+        _socket.CheckConnected();
+        if (_socket.Connecting())
+            break;
+
+        if (!_socket.Connected())
+        {
+            ScheduleReconnect(now);
+            break;
+        }
+
+        Register(now);
+        break;
+
+    case IRC_STATE_BACKOFF:
+        if (now >= _reconnectTime)
+            StartConnect(now);
+        break;
+
+    case IRC_STATE_REGISTERING:
+    case IRC_STATE_JOINING:
+        // A server that accepts the connection and then never answers counts as a failed connect
+        if (now - _stateTime > _connectTimeout)
+        {
+            UE_LOG(LogUTTwitchHype, Warning, TEXT("Server never finished %s."), ANSI_TO_TCHAR(StateName()));
+            Drop();
+            break;
+        }
+
+        ReceiveData();
+        break;
+
+    case IRC_STATE_READY:
+        // Stayed up long enough to count as healthy, the next drop reconnects right away
+        if (_reconnectAttempts > 0 && now - _stateTime >= _reconnectDelayMax)
+            _reconnectAttempts = 0;
+
+        ReceiveData();
+        if (_state == IRC_STATE_READY)
+            CheckKeepalive(now);
+        break;
+
+    default:
+        break;
+    }
+
+    // Lines already read are still worth handling while the connection is being rebuilt
+    ProcessInbound();
+
+    Rebalance(now);
+}
+
+void IRCClient::CheckKeepalive(double now)
+{
+    // A half-open connection never errors, it just goes quiet
+    if (_keepalive.Dead(now))
+    {
+        UE_LOG(LogUTTwitchHype, Warning, TEXT("Nothing from the server in %.0fs, the connection is dead."), _keepalive.Timeout());
+        _keepalive.RecordDead();
+        Drop();
+        return;
+    }
+
+    std::string ping;
+    if (_keepalive.PingDue(now, ping))
+        SendIRC(ping, IRC_PRIORITY_CONTROL);
+}
+
+// Twitch allows 20 commands per 30 seconds, 100 for mods, anything over that
+// gets the bot muted so everything goes through the token bucket in _sendQueue
+bool IRCClient::SendIRC(IRCStringView data, IRCSendPriority priority, IRCStringView shardKey)
+{
+    // Protocol lines belong to the connection they're sent on
+    if (_writers.empty() || priority == IRC_PRIORITY_CONTROL)
+        return QueueFor(data).Push(data, priority, FPlatformTime::Seconds());
+
+    return Route(data, priority, shardKey, FPlatformTime::Seconds());
+}
+
+IRCClient& IRCClient::AddWriter(std::string nick, std::string pass)
+{
+    IRCClient* writer = new IRCClient();
+    writer->Login(nick, pass);
+    _writers.push_back(writer);
+    return *writer;
+}
+
+void IRCClient::BuildRing()
+{
+    _ring.Clear();
+    if (_writers.empty())
+        return;
+
+    _ring.Add(0, IRCStringView(_nick.data(), _nick.size()));
+    for (size_t i = 0; i < _writers.size(); ++i)
+        _ring.Add(i + 1, IRCStringView(_writers[i]->Nick().data(), _writers[i]->Nick().size()));
+}
+
+bool IRCClient::Route(IRCStringView line, IRCSendPriority priority, IRCStringView shardKey, double now)
+{
+    static char const command[] = "PRIVMSG ";
+    static size_t const commandLength = sizeof(command) - 1;
+
+    size_t targetEnd = line.find(' ', commandLength);
+    if (_ring.empty() || line.substr(0, commandLength) != command || targetEnd == IRCStringView::npos)
+        return QueueFor(line).Push(line, priority, now);
+
+    // Keyed on the target and who the line is about, so one viewer's replies all
+    // go out on the same account and stay in order
+    _shardKey.assign(line.data() + commandLength, targetEnd - commandLength);
+    _shardKey += ' ';
+    _shardKey.append(shardKey.data(), shardKey.size());
+    _ring.Preference(IRCStringView(_shardKey.data(), _shardKey.size()), _preference);
+
+    // The owner unless it can't send right now, then whoever is next round the ring.
+    // When nobody can, the line waits with its owner.
+    size_t node = _preference[0];
+    for (size_t i = 0; i < _preference.size(); ++i)
+    {
+        if (Connection(_preference[i]).Usable(now))
+        {
+            node = _preference[i];
+            break;
+        }
+    }
+
+    if (node != _preference[0])
+        ++_failovers;
+
+    IRCClient& connection = Connection(node);
+    return connection.QueueFor(line).Push(line, priority, now);
+}
+
+void IRCClient::TakeChat(IRCSendPriority priority, std::vector<std::string>& lines)
+{
+    _sendQueue.TakeChat(priority, lines);
+    for (size_t i = 0; i < _channelQueues.size(); ++i)
+        _channelQueues[i].queue.TakeChat(priority, lines);
+}
+
+void IRCClient::Rebalance(double now)
+{
+    if (_ring.empty())
+        return;
+
+    bool anyUsable = false;
+    for (size_t node = 0; node <= _writers.size(); ++node)
+        anyUsable = anyUsable || Connection(node).Usable(now);
+
+    // Nowhere better to put it
+    if (!anyUsable)
+        return;
+
+    for (size_t node = 0; node <= _writers.size(); ++node)
+    {
+        IRCClient& connection = Connection(node);
+        if (connection.Usable(now))
+            continue;
+
+        for (int priority = IRC_PRIORITY_ANNOUNCEMENT; priority < NUM_IRC_PRIORITIES; ++priority)
+        {
+            _movedLines.clear();
+            connection.TakeChat((IRCSendPriority)priority, _movedLines);
+            _failovers += _movedLines.size();
+
+            // The viewer a line was for isn't known any more, it's keyed on its target alone
+            for (size_t i = 0; i < _movedLines.size(); ++i)
+                Route(_movedLines[i], (IRCSendPriority)priority, IRCStringView(), now);
+        }
+    }
+}
+
+void IRCClient::Throttle(double now)
+{
+    _throttledUntil = now + _throttleTime;
+    ++_throttles;
+
+    UE_LOG(LogUTTwitchHype, Warning, TEXT("%s is being rate limited by the server, resting it for %.0fs."), ANSI_TO_TCHAR(_nick.c_str()), _throttleTime);
+}
+
+IRCSendQueue& IRCClient::QueueFor(IRCStringView line)
+{
+    static char const command[] = "PRIVMSG ";
+    static size_t const commandLength = sizeof(command) - 1;
+
+    if (_channelQueues.empty() || line.substr(0, commandLength) != command)
+        return _sendQueue;
+
+    size_t targetEnd = line.find(' ', commandLength);
+    if (targetEnd == IRCStringView::npos)
+        return _sendQueue;
+
+    IRCStringView target = line.substr(commandLength, targetEnd - commandLength);
+    for (size_t i = 0; i < _channelQueues.size(); ++i)
+        if (target == _channelQueues[i].channel)
+            return _channelQueues[i].queue;
+
+    return _sendQueue;
+}
+
+void IRCClient::ConfigureChannelQueues(int limit, double window, int burst, size_t maxDepth)
+{
+    _channelQueueLimit = limit;
+    _channelQueueWindow = window;
+    _channelQueueBurst = burst;
+    _channelQueueMaxDepth = maxDepth;
+
+    for (size_t i = 0; i < _channelQueues.size(); ++i)
+        _channelQueues[i].queue.Configure(limit, window, burst, maxDepth);
+}
+
+IRCSendQueue* IRCClient::ChannelQueue(std::string const& channel)
+{
+    for (size_t i = 0; i < _channelQueues.size(); ++i)
+        if (_channelQueues[i].channel == channel)
+            return &_channelQueues[i].queue;
+
+    return NULL;
+}
+
+bool IRCClient::PopSendLine(std::string& line, double now, IRCSendPriority lowest, IRCSendQueue*& queue, IRCSendPriority& priority)
+{
+    // Protocol lines and anything not bound for a channel, this bucket is also the account-wide one
+    if (_sendQueue.Pop(line, now, lowest, NULL, &priority))
+    {
+        queue = &_sendQueue;
+        return true;
+    }
+
+    // Then the channels take turns, so one busy channel can't starve the others
+    size_t count = _channelQueues.size();
+    for (size_t i = 0; i < count; ++i)
+    {
+        size_t index = (_nextChannelQueue + i) % count;
+        if (_channelQueues[index].queue.Pop(line, now, lowest, &_sendQueue.Bucket(), &priority))
+        {
+            queue = &_channelQueues[index].queue;
+            _nextChannelQueue = (index + 1) % count;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void IRCClient::FlushSendQueue()
+{
+    for (size_t i = 0; i < _writers.size(); ++i)
+        _writers[i]->FlushSendQueue();
+
+    if (_state < IRC_STATE_REGISTERING || _state > IRC_STATE_READY)
+        return;
+
+    double now = FPlatformTime::Seconds();
+
+    // Until every channel is joined only protocol lines go out, chat would just be rejected
+    IRCSendPriority lowest = _state == IRC_STATE_READY ? IRC_PRIORITY_CONFIRMATION : IRC_PRIORITY_CONTROL;
+
+    if (_useNetworkThread && !StartNetworkThread())
+        return;
+
+    std::string& line = _sendLine;
+    IRCSendQueue* queue;
+    IRCSendPriority priority;
+
+    // A line that doesn't fit goes back to the front of its class and waits for the next
+    // tick, its token is spent but the lines behind it keep theirs
+    if (_networkThread)
+    {
+        while (PopSendLine(line, now, lowest, queue, priority))
+        {
+            if (!_networkThread->PushOutbound(IRCStringView(line.data(), line.size()), priority))
+            {
+                queue->Requeue(line, priority, now);
+                break;
+            }
+        }
+        return;
+    }
+
+    // Whatever a short write left behind goes first, and while the socket is backed
+    // up new lines stay in the rate limited queue rather than piling up behind it
+    bool ok = _socket.FlushSendBuffer();
+    if (ok && !_socket.HasPendingSend())
+    {
+        while (PopSendLine(line, now, lowest, queue, priority))
+        {
+            if (!_socket.QueueLine(IRCStringView(line.data(), line.size()), priority))
+            {
+                queue->Requeue(line, priority, now);
+                break;
+            }
+        }
+
+        ok = _socket.FlushSendBuffer();
+    }
+
+    if (!ok)
+    {
+        UE_LOG(LogUTTwitchHype, Warning, TEXT("Failed to send to server."));
+        Drop();
+    }
 }
 
-// Need to modify this to handle rate limiting and batching up text that needs to get sent
-// 20 commands per 30 seconds
-// 100 commands per 30 seconds for mods
-bool IRCClient::SendIRC(std::string data)
+bool IRCClient::StartNetworkThread()
 {
-    data.append("\n");
-    return _socket.SendData(data.c_str());
+    if (_networkThread)
+        return true;
+
+    if (!_socket.Connected() || _socket.Connecting())
+        return false;
+
+    _networkThread = new IRCNetworkThread(_socket);
+    if (!_networkThread->Start())
+    {
+		UE_LOG(LogUTTwitchHype, Warning, TEXT("Could not start the network thread, staying on the game thread."));
+        delete _networkThread;
+        _networkThread = NULL;
+        _useNetworkThread = false;
+        return false;
+    }
+
+    return true;
 }
 
-bool IRCClient::Login(std::string nick, std::string pass)
+void IRCClient::StopNetworkThread()
+{
+    // Joins the thread, the socket is ours again after this
+    delete _networkThread;
+    _networkThread = NULL;
+}
+
+void IRCClient::Login(std::string nick, std::string pass)
 {
     _nick = nick;
+    _pass = pass;
+}
+
+bool IRCClient::HasCapability(IRCStringView capability) const
+{
+    IRCStringView acknowledged(_capabilities.data(), _capabilities.size());
 
-	if (SendIRC("PASS " + pass))
-        if (SendIRC("NICK " + nick))
-                return true;
+    size_t start = 0;
+    while (start < acknowledged.size())
+    {
+        size_t end = acknowledged.find(' ', start);
+        if (end == IRCStringView::npos)
+            end = acknowledged.size();
+
+        if (acknowledged.substr(start, end - start) == capability)
+            return true;
+
+        start = end + 1;
+    }
 
     return false;
 }
 
+void IRCClient::Join(std::string channel)
+{
+    if (std::find(_channels.begin(), _channels.end(), channel) != _channels.end())
+        return;
+
+    _channels.push_back(channel);
+
+    // Every channel gets its own reply queue once they've been configured
+    if (_channelQueueLimit > 0)
+    {
+        _channelQueues.push_back(IRCChannelSendQueue());
+        _channelQueues.back().channel = channel;
+        _channelQueues.back().queue.Configure(_channelQueueLimit, _channelQueueWindow, _channelQueueBurst, _channelQueueMaxDepth);
+    }
+
+    // Otherwise it's picked up with the rest once registered
+    if (_state == IRC_STATE_JOINING || _state == IRC_STATE_READY)
+    {
+        SendIRC("JOIN " + channel, IRC_PRIORITY_CONTROL);
+        ++_pendingJoins;
+        SetState(IRC_STATE_JOINING, FPlatformTime::Seconds());
+    }
+}
+
 void IRCClient::ReceiveData()
 {
-    std::string buffer = _socket.ReceiveData();
+    IRCStringView line;
+
+    if (_useNetworkThread)
+    {
+        if (!StartNetworkThread())
+            return;
+
+        // Checked up front so everything that arrived before the close still gets handled
+        bool closed = _networkThread->Closed();
+
+        // Parse can disconnect, which takes the thread and its rings with it
+        for (int count = 0; _networkThread && (closed || count < _maxLinesPerTick) && _networkThread->PeekInbound(line); ++count)
+        {
+            Parse(line);
+            if (_networkThread)
+                _networkThread->PopInbound();
+        }
+
+        if (closed && _networkThread)
+            Drop();
+
+        return;
+    }
+
+    bool open = _socket.ReceiveData();
+
+    // Parse whatever made it in before a close, it usually carries the ERROR explaining why.
+    // The masks NextLine split the buffer with find the line's spaces too.
+    for (int count = 0; (!open || count < _maxLinesPerTick) && _socket.NextLine(line); ++count)
+    {
+        IRCScanCursor scan = _socket.LineScan(line);
+        Parse(line, scan);
+    }
+
+    // Unless a line already dropped the connection or hung up
+    if (!open && _socket.Connected())
+        Drop();
+}
+
+void IRCCommandPrefix::Parse(IRCStringView data)
+{
+    prefix = data;
+    nick = user = host = IRCStringView();
+
+    // servername, or nick[!user]@host
+    size_t at = data.find('@');
+    size_t bang = data.find('!');
+    if (at == IRCStringView::npos && bang == IRCStringView::npos)
+        return;
+
+    if (at != IRCStringView::npos)
+        host = data.substr(at + 1);
+    else
+        at = data.size();
+
+    if (bang != IRCStringView::npos && bang < at)
+    {
+        nick = data.substr(0, bang);
+        user = data.substr(bang + 1, at - bang - 1);
+    }
+    else
+        nick = data.substr(0, at);
+}
+
+void IRCTags::Parse(IRCStringView data)
+{
+    _count = 0;
 
-    std::string line;
-    std::istringstream iss(buffer);
-    while(getline(iss, line))
+    // key[=value] pairs split on ';', a key without '=' has an empty value
+    size_t start = 0;
+    while (start < data.size() && _count < IRC_MAX_TAGS)
     {
-        if (line.find("\r") != std::string::npos)
-            line = line.substr(0, line.size() - 1);
-        Parse(line);
+        size_t end = data.find(';', start);
+        if (end == IRCStringView::npos)
+            end = data.size();
+
+        IRCStringView tag = data.substr(start, end - start);
+        if (!tag.empty())
+        {
+            size_t equals = tag.find('=');
+            _tags[_count].key = tag.substr(0, equals);
+            _tags[_count].value = equals == IRCStringView::npos ? IRCStringView() : tag.substr(equals + 1);
+            ++_count;
+        }
+
+        start = end + 1;
     }
 }
 
-void IRCClient::Parse(std::string data)
+IRCStringView IRCTags::Get(IRCStringView key) const
+{
+    for (size_t i = 0; i < _count; ++i)
+        if (_tags[i].key == key)
+            return _tags[i].value;
+
+    return IRCStringView();
+}
+
+static unsigned long long ParseDecimal(IRCStringView text)
 {
-    std::string original(data);
-    IRCCommandPrefix cmdPrefix;
+    unsigned long long value = 0;
+    for (size_t i = 0; i < text.size(); ++i)
+    {
+        if (text[i] < '0' || text[i] > '9')
+            return 0;
+        value = value * 10 + (text[i] - '0');
+    }
+
+    return value;
+}
+
+unsigned long long IRCMessage::UserId() const
+{
+    return ParseDecimal(tags.Get("user-id"));
+}
+
+unsigned long long IRCMessage::SentTime() const
+{
+    return ParseDecimal(tags.Get("tmi-sent-ts"));
+}
+
+bool IRCMessage::HasBadge(IRCStringView badge) const
+{
+    IRCStringView badges = Badges();
+
+    size_t start = 0;
+    while (start < badges.size())
+    {
+        size_t end = badges.find(',', start);
+        if (end == IRCStringView::npos)
+            end = badges.size();
+
+        // Compare the name, not the version after the '/'
+        IRCStringView entry = badges.substr(start, end - start);
+        if (entry.substr(0, entry.find('/')) == badge)
+            return true;
+
+        start = end + 1;
+    }
+
+    return false;
+}
+
+bool IRCMessage::Parse(IRCStringView line)
+{
+    IRCScanCursor scan(line.data(), line.size());
+    return Parse(line, scan);
+}
+
+bool IRCMessage::Parse(IRCStringView line, IRCScanCursor& scan)
+{
+    char const* data = line.data();
+    size_t end = line.size();
+    size_t pos = 0;
+
+    tags.clear();
+    prefix = IRCCommandPrefix();
+    parameters = IRCParameters();
+
+    // Every space in the line comes out of the same block masks, ':' and '@' are only checked where a token starts
+
+    // IRCv3 tags come before everything else
+    if (pos < end && data[pos] == '@')
+    {
+        size_t tagsEnd = scan.NextSpace(pos);
+        if (tagsEnd == end)
+            return false;
+
+        tags.Parse(IRCStringView(data + pos + 1, tagsEnd - pos - 1));
+        pos = scan.SkipSpaces(tagsEnd);
+    }
 
     // if command has prefix
-    if (data.substr(0, 1) == ":")
+    if (pos < end && data[pos] == ':')
     {
-        cmdPrefix.Parse(data);
-        data = data.substr(data.find(" ") + 1);
+        size_t prefixEnd = scan.NextSpace(pos);
+        if (prefixEnd == end)
+            return false;
+
+        prefix.Parse(IRCStringView(data + pos + 1, prefixEnd - pos - 1));
+        pos = prefixEnd;
     }
 
-    std::string command = data.substr(0, data.find(" "));
-    std::transform(command.begin(), command.end(), command.begin(), towupper);
-    if (data.find(" ") != std::string::npos)
-        data = data.substr(data.find(" ") + 1);
-    else
-        data = "";
+    pos = scan.SkipSpaces(pos);
+    size_t commandEnd = scan.NextSpace(pos);
+
+    command = IRCStringView(data + pos, commandEnd - pos);
+    if (command.empty())
+        return false;
 
-    std::vector<std::string> parameters;
+    commandId = GetCommandId(command);
 
-    if (data != "")
+    pos = commandEnd;
+    while (pos < end)
     {
-        if (data.substr(0, 1) == ":")
-            parameters.push_back(data.substr(1));
-        else
+        pos = scan.SkipSpaces(pos);
+        if (pos == end)
+            break;
+
+        // Trailing parameter, or the last one we have room for, takes the rest of the line
+        if (data[pos] == ':' || parameters.size() == IRC_MAX_PARAMS - 1)
         {
-            size_t pos1 = 0, pos2;
-            while ((pos2 = data.find(" ", pos1)) != std::string::npos)
-            {
-                parameters.push_back(data.substr(pos1, pos2 - pos1));
-                pos1 = pos2 + 1;
-                if (data.substr(pos1, 1) == ":")
-                {
-                    parameters.push_back(data.substr(pos1 + 1));
-                    break;
-                }
-            }
-            if (parameters.empty())
-                parameters.push_back(data);
+            if (data[pos] == ':')
+                ++pos;
+            parameters.push_back(IRCStringView(data + pos, end - pos));
+            break;
         }
+
+        size_t paramEnd = scan.NextSpace(pos);
+        parameters.push_back(IRCStringView(data + pos, paramEnd - pos));
+        pos = paramEnd;
     }
 
-    if (command == "ERROR")
+    return true;
+}
+
+void IRCClient::Parse(IRCStringView line)
+{
+    IRCScanCursor scan(line.data(), line.size());
+    Parse(line, scan);
+}
+
+void IRCClient::Parse(IRCStringView line, IRCScanCursor& scan)
+{
+    IRCMessage ircMessage;
+    if (!ircMessage.Parse(line, scan))
+        return;
+
+    IRCCommandId command = ircMessage.commandId;
+
+    double now = FPlatformTime::Seconds();
+    _keepalive.OnTraffic(now);
+
+    if (command == IRC_CMD_ERROR || command == IRC_CMD_RECONNECT)
     {
-		UE_LOG(LogUTTwitchHype, Warning, TEXT("%s"), ANSI_TO_TCHAR(original.c_str()));
-        Disconnect();
+		UE_LOG(LogUTTwitchHype, Warning, TEXT("%s"), ANSI_TO_TCHAR(line.str().c_str()));
+        Drop();
         return;
     }
 
-    if (command == "PING")
+    if (command == IRC_CMD_PONG && _keepalive.OnPong(ircMessage.parameters.back(), now))
+        return;
+
+    // RPL_WELCOME, registration went through
+    if (command == IRC_NUMERIC(1) && _state == IRC_STATE_REGISTERING)
+        JoinChannels(now);
+
+    // The server echoes our own JOIN back once we're in
+    if (command == IRC_CMD_JOIN && _state == IRC_STATE_JOINING && _pendingJoins > 0 && ircMessage.prefix.nick.equals_nocase(_nick.c_str()))
+    {
+        if (--_pendingJoins == 0)
+        {
+            ++_sessions;
+            SetState(IRC_STATE_READY, now);
+        }
+    }
+
+    if (command == IRC_CMD_PING)
 	{
 		UE_LOG(LogUTTwitchHype, Display, TEXT("Ping? Pong!"));
-        SendIRC("PONG :" + parameters.at(0));
+        SendIRC("PONG :" + ircMessage.parameters.at(0).str(), IRC_PRIORITY_CONTROL);
+        return;
+    }
+
+    if (command == IRC_CMD_UNKNOWN)
+    {
+        if (_debug)
+        {
+            UE_LOG(LogUTTwitchHype, Log, TEXT("%s"), ANSI_TO_TCHAR(line.str().c_str()));
+        }
+        return;
+    }
+
+    // Chat waits its turn in the inbound queue, everything else is handled as it arrives
+    if ((command == IRC_CMD_PRIVMSG || command == IRC_CMD_WHISPER) && _inboundQueue.Enabled())
+    {
+        IRCStringView user = ircMessage.tags.Get("user-id");
+        if (user.empty())
+            user = ircMessage.prefix.nick;
+
+        _inboundQueue.Push(line, user, ircMessage.parameters.back(), now);
         return;
     }
 
-    IRCMessage ircMessage(command, cmdPrefix, parameters);
+    Dispatch(ircMessage, line);
+}
+
+void IRCClient::Dispatch(IRCMessage const& ircMessage, IRCStringView line)
+{
+    IRCCommandId command = ircMessage.commandId;
 
     // Default handler
-    int commandIndex = GetCommandHandler(command);
-    if (commandIndex < NUM_IRC_CMDS)
+    if (ircDispatchTable[command])
     {
-        IRCCommandHandler& cmdHandler = ircCommandTable[commandIndex];
-        (this->*cmdHandler.handler)(ircMessage);
+        (this->*ircDispatchTable[command])(ircMessage);
     }
 	else if (_debug)
 	{
-		UE_LOG(LogUTTwitchHype, Log, TEXT("%s"), ANSI_TO_TCHAR(original.c_str()));
+		UE_LOG(LogUTTwitchHype, Log, TEXT("%s"), ANSI_TO_TCHAR(line.str().c_str()));
 
 	}
 
-    // Try to call hook (if any matches)
-    CallHook(command, ircMessage);
+    // Then everything hooked on the command
+    CallHooks(command, ircMessage);
 }
 
-void IRCClient::HookIRCCommand(std::string command, void(*function)(IRCMessage /*message*/, FTwitchHype* /*client*/), FTwitchHype* twitchhype)
+void IRCClient::ProcessInbound()
 {
-    IRCCommandHook hook;
+    if (!_inboundQueue.Enabled() || _inboundQueue.Depth() == 0)
+        return;
+
+    double now = FPlatformTime::Seconds();
+    double deadline = now + _inboundQueue.Budget();
+
+    // At least one line a tick, so a budget smaller than a single hook still gets through the queue
+    do
+    {
+        if (!_inboundQueue.Pop(_inboundLine, now))
+            return;
 
-    hook.command = command;
-    hook.function = function;
-	hook.twitchhype = twitchhype;
+        IRCStringView line(_inboundLine.data(), _inboundLine.size());
+        IRCMessage ircMessage;
+        if (ircMessage.Parse(line))
+            Dispatch(ircMessage, line);
 
-    _hooks.push_back(hook);
+        now = FPlatformTime::Seconds();
+    } while (now < deadline);
+
+    if (_inboundQueue.Depth() > 0)
+        _inboundQueue.RecordOverBudget();
 }
 
-void IRCClient::CallHook(std::string command, IRCMessage message)
+unsigned int IRCClient::AddHook(IRCCommandId command, IRCCommandHook const& hook)
 {
-    if (_hooks.empty())
-        return;
+    _hooks[command].push_back(hook);
+    _hooks[command].back()._handle = ++_nextHookHandle;
+    return _nextHookHandle;
+}
 
-    for (std::list<IRCCommandHook>::const_iterator itr = _hooks.begin(); itr != _hooks.end(); ++itr)
+void IRCClient::UnhookIRCCommand(unsigned int handle)
+{
+    for (int command = 0; command < NUM_IRC_CMDS; ++command)
     {
-        if (itr->command == command)
+        std::vector<IRCCommandHook>& hooks = _hooks[command];
+        for (size_t i = 0; i < hooks.size(); ++i)
         {
-            (*(itr->function))(message, itr->twitchhype);
-            break;
+            if (hooks[i].Handle() == handle)
+            {
+                hooks.erase(hooks.begin() + i);
+                return;
+            }
         }
     }
 }
+
+void IRCClient::CallHooks(IRCCommandId command, IRCMessage const& message)
+{
+    std::vector<IRCCommandHook>& hooks = _hooks[command];
+    for (size_t i = 0; i < hooks.size(); ++i)
+        hooks[i](message);
+}
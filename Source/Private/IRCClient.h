@@ -18,109 +18,449 @@
 
 #include "TwitchHype.h"
 
+#include <new>
 #include <string>
 #include <vector>
-#include <list>
 #include "IRCSocket.h"
+#include "IRCStringView.h"
+#include "IRCCommand.h"
+#include "IRCSendQueue.h"
+#include "IRCKeepalive.h"
+#include "IRCInboundQueue.h"
+#include "IRCHashRing.h"
+#include "IRCNetworkThread.h"
+#include "IRCArena.h"
 
 class IRCClient;
 
 extern std::vector<std::string> split(std::string const&, char);
 
+// RFC 2812: 14 middle parameters plus the trailing one
+#define IRC_MAX_PARAMS 15
+
 struct IRCCommandPrefix
 {
-    void Parse(std::string data)
-    {
-        if (data == "")
-            return;
+    // data is the prefix without its leading ':'
+    void Parse(IRCStringView data);
 
-        prefix = data.substr(1, data.find(" ") - 1);
-        std::vector<std::string> tokens;
+    IRCStringView prefix;
+    IRCStringView nick;
+    IRCStringView user;
+    IRCStringView host;
+};
 
-        if (prefix.find("@") != std::string::npos)
-        {
-            tokens = split(prefix, '@');
-            nick = tokens.at(0);
-            host = tokens.at(1);
-        }
-        if (nick != "" && nick.find("!") != std::string::npos)
-        {
-            tokens = split(nick, '!');
-            nick = tokens.at(0);
-            user = tokens.at(1);
-        }
+// Fixed capacity parameter list, reads past the end yield an empty view
+struct IRCParameters
+{
+    IRCParameters() : _count(0) {};
+
+    size_t size() const { return _count; };
+    bool empty() const { return _count == 0; };
+
+    IRCStringView const& at(size_t index) const { return index < _count ? _params[index] : _none; };
+    IRCStringView const& back() const { return at(_count - 1); };
+
+    IRCStringView const* begin() const { return _params; };
+    IRCStringView const* end() const { return _params + _count; };
+
+    void push_back(IRCStringView const& param)
+    {
+        if (_count < IRC_MAX_PARAMS)
+            _params[_count++] = param;
     };
 
-    std::string prefix;
-    std::string nick;
-    std::string user;
-    std::string host;
+private:
+    IRCStringView _params[IRC_MAX_PARAMS];
+    size_t _count;
+    IRCStringView _none;
+};
+
+// Twitch sends around 20 tags on a PRIVMSG, anything past this is ignored
+#define IRC_MAX_TAGS 32
+
+struct IRCTag
+{
+    IRCStringView key;
+    IRCStringView value;
+};
+
+// IRCv3 message tags. Values are left escaped (\s for a space and so on), none of the
+// ones the bot reads ever contain anything that needs it.
+struct IRCTags
+{
+    IRCTags() : _count(0) {};
+
+    // data is the tag block without its leading '@'
+    void Parse(IRCStringView data);
+    void clear() { _count = 0; };
+
+    size_t size() const { return _count; };
+    bool empty() const { return _count == 0; };
+
+    IRCTag const* begin() const { return _tags; };
+    IRCTag const* end() const { return _tags + _count; };
+
+    // Empty if the tag isn't there or has no value
+    IRCStringView Get(IRCStringView key) const;
+
+private:
+    IRCTag _tags[IRC_MAX_TAGS];
+    size_t _count;
 };
 
+// Every field is a view into the line it was parsed from, nothing is allocated
 struct IRCMessage
 {
-    IRCMessage();
-    IRCMessage(std::string cmd, IRCCommandPrefix p, std::vector<std::string> params) :
-        command(cmd), prefix(p), parameters(params) {};
+    IRCMessage() : commandId(IRC_CMD_UNKNOWN) {};
 
-    std::string command;
+    // Single pass over a line without its CR/LF, returns false if there is no command
+    bool Parse(IRCStringView line);
+    // With the delimiters already found, scan is over line
+    bool Parse(IRCStringView line, IRCScanCursor& scan);
+
+    // Twitch's tags, 0 or empty when the server didn't send them (no twitch.tv/tags capability)
+    unsigned long long UserId() const;
+    // Milliseconds since the epoch when Twitch received the message
+    unsigned long long SentTime() const;
+    // Comma separated name/version pairs, "broadcaster/1,subscriber/12"
+    IRCStringView Badges() const { return tags.Get("badges"); };
+    bool HasBadge(IRCStringView badge) const;
+
+    IRCTags tags;
+    IRCStringView command;
+    IRCCommandId commandId;
     IRCCommandPrefix prefix;
-    std::vector<std::string> parameters;
+    IRCParameters parameters;
 };
 
-struct IRCCommandHook
+// Where the client is on the way from nothing to sitting in every channel.
+// Each step is taken on the server's acknowledgement, never on a timer.
+enum IRCConnectionState
 {
-	IRCCommandHook() : function(NULL), twitchhype(NULL) {};
+    IRC_STATE_DISCONNECTED,     // not connected and not trying to be
+    IRC_STATE_CONNECTING,       // resolving and racing connects
+    IRC_STATE_REGISTERING,      // PASS/NICK sent, waiting for 001
+    IRC_STATE_JOINING,          // JOINs sent, waiting for the server to echo them back
+    IRC_STATE_READY,
+    IRC_STATE_BACKOFF,          // lost the connection, waiting to try again
 
-    std::string command;
-	void(*function)(IRCMessage /*message*/, struct FTwitchHype* /*client*/);
-	struct FTwitchHype* twitchhype;
+    NUM_IRC_STATES
+};
+
+// Replies bound for one channel, rate limited on their own as well as by the account
+struct IRCChannelSendQueue
+{
+    std::string channel;
+    IRCSendQueue queue;
+};
+
+// Something to call when a command arrives, a lambda or any other functor kept inline so
+// neither adding nor calling one allocates. The message is only good for the duration of
+// the call, it's a set of views into the line being handled.
+class IRCCommandHook
+{
+public:
+    template <typename F>
+    static IRCCommandHook Make(F const& functor)
+    {
+        static_assert(sizeof(F) <= sizeof(Storage), "Hook captures too much to be stored inline, capture a pointer to it instead");
+
+        IRCCommandHook hook;
+        new (hook._storage.bytes) F(functor);
+        hook._invoke = &Invoke<F>;
+        hook._manage = &Manage<F>;
+        return hook;
+    };
+
+    IRCCommandHook(IRCCommandHook const& other) : _invoke(other._invoke), _manage(other._manage), _handle(other._handle)
+    {
+        if (_manage)
+            _manage(_storage.bytes, other._storage.bytes);
+    };
+
+    IRCCommandHook& operator=(IRCCommandHook const& other)
+    {
+        if (this != &other)
+        {
+            this->~IRCCommandHook();
+            new (this) IRCCommandHook(other);
+        }
+        return *this;
+    };
+
+    ~IRCCommandHook()
+    {
+        if (_manage)
+            _manage(_storage.bytes, NULL);
+    };
+
+    void operator()(IRCMessage const& message) { _invoke(_storage.bytes, message); };
+
+    unsigned int Handle() const { return _handle; };
+
+private:
+    friend class IRCClient;
+
+    IRCCommandHook() : _invoke(NULL), _manage(NULL), _handle(0) {};
+
+    template <typename F>
+    static void Invoke(void* storage, IRCMessage const& message) { (*(F*)storage)(message); };
+
+    // Copies src into dst, or destroys dst when there's no src
+    template <typename F>
+    static void Manage(void* dst, void const* src)
+    {
+        if (src)
+            new (dst) F(*(F const*)src);
+        else
+            ((F*)dst)->~F();
+    };
+
+    // Room for an object pointer and a member function pointer of any shape, or a few captures
+    union Storage
+    {
+        char bytes[6 * sizeof(void*)];
+        void* pointer;
+        long long integer;
+        double real;
+    };
+
+    Storage _storage;
+    void(*_invoke)(void* /*storage*/, IRCMessage const& /*message*/);
+    void(*_manage)(void* /*dst*/, void const* /*src*/);
+    unsigned int _handle;
+};
+
+// A member function bound to its object, what HookIRCCommand(command, object, method) stores
+template <typename T>
+struct IRCMemberHook
+{
+    T* object;
+    void (T::*method)(IRCMessage const& /*message*/);
+
+    void operator()(IRCMessage const& message) const { (object->*method)(message); };
 };
 
 class IRCClient
 {
 public:
-    IRCClient() : _debug(false) {};
+    IRCClient() : _networkThread(NULL), _useNetworkThread(false), _maxLinesPerTick(200), _connectTimeout(10.0),
+        _state(IRC_STATE_DISCONNECTED), _stateTime(0), _port(0), _pendingJoins(0), _sessions(0),
+        _reconnectAttempts(0), _reconnectTime(0), _reconnectDelayMin(1.0), _reconnectDelayMax(60.0),
+        _channelQueueLimit(0), _channelQueueWindow(0), _channelQueueBurst(0), _channelQueueMaxDepth(0), _nextChannelQueue(0),
+        _throttledUntil(0), _throttleTime(30.0), _throttles(0), _failovers(0), _nextHookHandle(0), _debug(false) {};
+    ~IRCClient();
 
     bool InitSocket();
+
+    // Keeps the connection up from here on, reconnecting with backoff whenever it drops
     bool Connect(char* /*host*/, int /*port*/);
+    void SetConnectTimeout(double timeout) { _connectTimeout = timeout; };
+    void SetSocketOptions(bool noDelay, int sendBufferSize) { _socket.SetOptions(noDelay, sendBufferSize); };
+    void SetReconnectDelay(double minDelay, double maxDelay) { _reconnectDelayMin = minDelay; _reconnectDelayMax = maxDelay; };
+    void SetKeepalive(double interval, double timeout) { _keepalive.Configure(interval, timeout); };
+
+    // Hangs up and stops reconnecting
     void Disconnect();
 	bool Connected() { return _socket.Connected(); };
 	bool Connecting() { return _socket.Connecting(); };
 
-	void CheckConnected() { _socket.CheckConnected(); };
+    IRCConnectionState State() const { return _state; };
+    char const* StateName() const;
+
+    // Times the client made it all the way to IRC_STATE_READY since Connect
+    unsigned int Sessions() const { return _sessions; };
+
+    // Drives the connection state machine and handles what the server sent, call once per tick
+    void Tick();
+
+    // Queues a line, it goes out once the rate limiter allows it. With writers, chat goes to
+    // the connection that owns its target and shard key, usually the viewer it's for.
+    bool SendIRC(IRCStringView /*data*/, IRCSendPriority /*priority*/ = IRC_PRIORITY_REPLY, IRCStringView /*shardKey*/ = IRCStringView());
+
+    // Scratch memory that lives until the start of the next Tick, for building lines that are
+    // copied into a send queue anyway. Its blocks are kept, so a steady tick allocates nothing.
+    IRCArena& FrameArena() { return _frameArena; };
+    IRCArenaStats const& FrameArenaStats() const { return _frameArena.Stats(); };
+
+    // Writes as many queued lines as the rate limit allows, call once per tick
+    void FlushSendQueue();
+
+    // Protocol lines and chat for targets without a queue of their own. Its bucket is the
+    // account-wide limit every channel queue has to get a token from too.
+    IRCSendQueue& SendQueue() { return _sendQueue; };
+
+    // Channels joined after this get a reply queue each, PRIVMSGs to them wait there
+    void ConfigureChannelQueues(int limit, double window, int burst, size_t maxDepth);
+    IRCSendQueue* ChannelQueue(std::string const& /*channel*/);
+
+    IRCKeepalive const& Keepalive() const { return _keepalive; };
+    IRCInboundQueue& InboundQueue() { return _inboundQueue; };
+
+    // Credentials go out on every connect, so call this before Connect
+    void Login(std::string /*nick*/, std::string /*pass*/);
+    std::string const& Nick() const { return _nick; };
+
+    // Another account that only sends, each one has a rate limit of its own. It connects,
+    // ticks and flushes along with this client and needs configuring like it. Add them before Connect.
+    IRCClient& AddWriter(std::string /*nick*/, std::string /*pass*/);
+    size_t Writers() const { return _writers.size(); };
+    IRCClient& Writer(size_t index) { return *_writers[index]; };
 
-    bool SendIRC(std::string /*data*/);
+    // How long Twitch's rate limit notice takes the connection out of the rotation
+    void SetThrottleTime(double seconds) { _throttleTime = seconds; };
+    bool Throttled(double now) const { return now < _throttledUntil; };
+    unsigned int Throttles() const { return _throttles; };
+    // Chat lines that went to another connection because their own was down or throttled
+    unsigned long long Failovers() const { return _failovers; };
 
-    bool Login(std::string /*nick*/, std::string /*user*/);
+    // Space separated IRCv3 capabilities asked for on every connect, before registering
+    void RequestCapabilities(std::string capabilities) { _capabilityRequest = capabilities; };
+    // Only what the server acknowledged this session
+    bool HasCapability(IRCStringView /*capability*/) const;
+    std::string const& Capabilities() const { return _capabilities; };
 
+    // Joined once registered, and joined again after every reconnect
+    void Join(std::string /*channel*/);
+
+    // Handles at most the configured number of lines per call, the rest wait for the next tick
     void ReceiveData();
 
-	void HookIRCCommand(std::string /*command*/, void(*function)(IRCMessage /*message*/, FTwitchHype*), FTwitchHype*);
+    // With the network thread the socket is read and written off the game thread once connected
+    void SetNetworkThread(bool enabled, int maxLinesPerTick) { _useNetworkThread = enabled; _maxLinesPerTick = maxLinesPerTick; };
+
+    // Every hook on a command is called, in the order they were added, after the client's own
+    // handler. Returns a handle for UnhookIRCCommand. Hooks can't be added or removed from inside one.
+    template <typename F>
+    unsigned int HookIRCCommand(IRCCommandId command, F const& functor)
+    {
+        return AddHook(command, IRCCommandHook::Make(functor));
+    };
+
+    template <typename T>
+    unsigned int HookIRCCommand(IRCCommandId command, T* object, void (T::*method)(IRCMessage const& /*message*/))
+    {
+        IRCMemberHook<T> hook = { object, method };
+        return AddHook(command, IRCCommandHook::Make(hook));
+    };
 
-    void Parse(std::string /*data*/);
+    void UnhookIRCCommand(unsigned int /*handle*/);
 
-    void HandleCTCP(IRCMessage /*message*/);
+    void Parse(IRCStringView /*line*/);
+    void Parse(IRCStringView /*line*/, IRCScanCursor& /*scan*/);
+
+    void HandleCTCP(IRCMessage const& /*message*/);
 
     // Default internal handlers
-    void HandlePrivMsg(IRCMessage /*message*/);
-    void HandleNotice(IRCMessage /*message*/);
-    void HandleChannelJoinPart(IRCMessage /*message*/);
-    void HandleUserNickChange(IRCMessage /*message*/);
-    void HandleUserQuit(IRCMessage /*message*/);
-    void HandleChannelNamesList(IRCMessage /*message*/);
-    void HandleNicknameInUse(IRCMessage /*message*/);
-    void HandleServerMessage(IRCMessage /*message*/);
+    void HandlePrivMsg(IRCMessage const& /*message*/);
+    void HandleNotice(IRCMessage const& /*message*/);
+    void HandleChannelJoinPart(IRCMessage const& /*message*/);
+    void HandleUserNickChange(IRCMessage const& /*message*/);
+    void HandleUserQuit(IRCMessage const& /*message*/);
+    void HandleChannelNamesList(IRCMessage const& /*message*/);
+    void HandleNicknameInUse(IRCMessage const& /*message*/);
+    void HandleServerMessage(IRCMessage const& /*message*/);
+    void HandleCapability(IRCMessage const& /*message*/);
 
     void Debug(bool debug) { _debug = debug; };
 
 private:
-    void HandleCommand(IRCMessage /*message*/);
-    void CallHook(std::string /*command*/, IRCMessage /*message*/);
+    void HandleCommand(IRCMessage const& /*message*/);
+
+    // The channel's queue for a PRIVMSG to a channel that has one, _sendQueue for everything else
+    IRCSendQueue& QueueFor(IRCStringView /*line*/);
+    // Says which queue and class the line came from, so it can be put back
+    bool PopSendLine(std::string& /*line*/, double now, IRCSendPriority lowest, IRCSendQueue*& queue, IRCSendPriority& priority);
+
+    // Node 0 on the ring is this client, writer i is node i + 1
+    IRCClient& Connection(size_t node) { return node == 0 ? *this : *_writers[node - 1]; };
+    bool Usable(double now) const { return _state == IRC_STATE_READY && !Throttled(now); };
+    void BuildRing();
+    bool Route(IRCStringView /*line*/, IRCSendPriority priority, IRCStringView shardKey, double now);
+    // Moves chat off connections that can't send it onto ones that can
+    void Rebalance(double now);
+    void TakeChat(IRCSendPriority priority, std::vector<std::string>& /*lines*/);
+    void Throttle(double now);
+    void Dispatch(IRCMessage const& /*message*/, IRCStringView /*line*/);
+
+    // Hands queued chat to hooks until the inbound queue's budget for this tick runs out
+    void ProcessInbound();
+    void CallHooks(IRCCommandId /*command*/, IRCMessage const& /*message*/);
+    unsigned int AddHook(IRCCommandId /*command*/, IRCCommandHook const& /*hook*/);
+
+    void SetState(IRCConnectionState state, double now);
+    bool StartConnect(double now);
+    void Register(double now);
+    void JoinChannels(double now);
+    void CloseSocket();
+
+    // The connection went away without being asked to, replays what didn't make it out and schedules a reconnect
+    void Drop();
+    void ScheduleReconnect(double now);
+    void CheckKeepalive(double now);
+
+    bool StartNetworkThread();
+    void StopNetworkThread();
 
     IRCSocket _socket;
 
-    std::list<IRCCommandHook> _hooks;
+    IRCNetworkThread* _networkThread;
+    bool _useNetworkThread;
+    int _maxLinesPerTick;
+
+    double _connectTimeout;
+
+    IRCConnectionState _state;
+    double _stateTime;
+
+    std::string _host;
+    int _port;
+    std::string _pass;
+    std::string _capabilityRequest;
+    std::string _capabilities;
+    std::vector<std::string> _channels;
+    size_t _pendingJoins;
+    unsigned int _sessions;
+
+    int _reconnectAttempts;
+    double _reconnectTime;
+    double _reconnectDelayMin;
+    double _reconnectDelayMax;
+
+    IRCSendQueue _sendQueue;
+    // Holds the line being written, its buffer is traded with the queue slots it comes from
+    std::string _sendLine;
+
+    std::vector<IRCChannelSendQueue> _channelQueues;
+    int _channelQueueLimit;
+    double _channelQueueWindow;
+    int _channelQueueBurst;
+    size_t _channelQueueMaxDepth;
+    size_t _nextChannelQueue;
+
+    // Send-only connections, chat is spread over them and this one by consistent hashing
+    std::vector<IRCClient*> _writers;
+    IRCHashRing _ring;
+    std::vector<size_t> _preference;
+    std::string _shardKey;
+    std::vector<std::string> _movedLines;
+
+    double _throttledUntil;
+    double _throttleTime;
+    unsigned int _throttles;
+    unsigned long long _failovers;
+
+    IRCKeepalive _keepalive;
+
+    IRCInboundQueue _inboundQueue;
+    // Holds the line being dispatched, its buffer is reused from one line to the next
+    std::string _inboundLine;
+
+    IRCArena _frameArena;
+
+    // Indexed by IRCCommandId
+    std::vector<IRCCommandHook> _hooks[NUM_IRC_CMDS];
+    unsigned int _nextHookHandle;
 
     std::string _nick;
 
@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2011 Fredi Machado <https://github.com/Fredi>
+ * IRCClient is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * http://www.gnu.org/licenses/lgpl.html
+ */
+
+#ifndef _IRCCOMMAND_H
+#define _IRCCOMMAND_H
+
+#include "IRCStringView.h"
+
+// Every command is resolved to one of these once per line, everything
+// after that (default handlers, hooks) is a straight array index.
+enum IRCCommandId
+{
+    IRC_CMD_UNKNOWN = -1,
+
+    IRC_CMD_PRIVMSG = 0,
+    IRC_CMD_NOTICE,
+    IRC_CMD_JOIN,
+    IRC_CMD_PART,
+    IRC_CMD_NICK,
+    IRC_CMD_QUIT,
+    IRC_CMD_PING,
+    IRC_CMD_PONG,
+    IRC_CMD_ERROR,
+    IRC_CMD_MODE,
+    IRC_CMD_CAP,
+    IRC_CMD_USERNOTICE,
+    IRC_CMD_USERSTATE,
+    IRC_CMD_GLOBALUSERSTATE,
+    IRC_CMD_ROOMSTATE,
+    IRC_CMD_CLEARCHAT,
+    IRC_CMD_CLEARMSG,
+    IRC_CMD_HOSTTARGET,
+    IRC_CMD_RECONNECT,
+    IRC_CMD_WHISPER,
+
+    NUM_IRC_NAMED_CMDS,
+
+    // Three digit replies map to IRC_CMD_NUMERIC + their value
+    IRC_CMD_NUMERIC = NUM_IRC_NAMED_CMDS,
+
+    NUM_IRC_CMDS = IRC_CMD_NUMERIC + 1000
+};
+
+#define IRC_NUMERIC(code) ((IRCCommandId)(IRC_CMD_NUMERIC + (code)))
+
+// Indexed by IRCCommandId, filled in IRCHandler.cpp
+extern IRCStringView ircCommandNames[NUM_IRC_NAMED_CMDS];
+
+// Perfect hash slots for the named commands, checked for collisions when they are built
+#define IRC_COMMAND_SLOTS 64
+extern unsigned char ircCommandSlots[IRC_COMMAND_SLOTS];
+
+// Only valid for commands of two characters or more. Letters are folded to upper case.
+inline unsigned int HashCommandName(IRCStringView command)
+{
+    return ((unsigned int)command.size()
+        + ((unsigned char)command[1] & 0xDF) * 4
+        + ((unsigned char)command[command.size() - 1] & 0xDF) * 2) & (IRC_COMMAND_SLOTS - 1);
+}
+
+inline IRCCommandId GetCommandId(IRCStringView command)
+{
+    size_t size = command.size();
+
+    if (size == 3 && isdigit((unsigned char)command[0]) && isdigit((unsigned char)command[1]) && isdigit((unsigned char)command[2]))
+        return IRC_NUMERIC((command[0] - '0') * 100 + (command[1] - '0') * 10 + (command[2] - '0'));
+
+    if (size < 2)
+        return IRC_CMD_UNKNOWN;
+
+    // One table read and a single compare to confirm it's not a stranger that hashed into the slot
+    unsigned char slot = ircCommandSlots[HashCommandName(command)];
+    if (slot < NUM_IRC_NAMED_CMDS && command.equals_nocase(ircCommandNames[slot]))
+        return (IRCCommandId)slot;
+
+    return IRC_CMD_UNKNOWN;
+}
+
+#endif
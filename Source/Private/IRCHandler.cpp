@@ -17,66 +17,114 @@
 
 #include "IRCHandler.h"
 
-IRCCommandHandler ircCommandTable[NUM_IRC_CMDS] =
+IRCStringView ircCommandNames[NUM_IRC_NAMED_CMDS] =
 {
-    { "PRIVMSG",            &IRCClient::HandlePrivMsg                   },
-    { "NOTICE",             &IRCClient::HandleNotice                    },
-    { "JOIN",               &IRCClient::HandleChannelJoinPart           },
-    { "PART",               &IRCClient::HandleChannelJoinPart           },
-    { "NICK",               &IRCClient::HandleUserNickChange            },
-    { "QUIT",               &IRCClient::HandleUserQuit                  },
-    { "353",                &IRCClient::HandleChannelNamesList          },
-    { "433",                &IRCClient::HandleNicknameInUse             },
-    { "001",                &IRCClient::HandleServerMessage             },
-    { "002",                &IRCClient::HandleServerMessage             },
-    { "003",                &IRCClient::HandleServerMessage             },
-    { "004",                &IRCClient::HandleServerMessage             },
-    { "005",                &IRCClient::HandleServerMessage             },
-    { "250",                &IRCClient::HandleServerMessage             },
-    { "251",                &IRCClient::HandleServerMessage             },
-    { "252",                &IRCClient::HandleServerMessage             },
-    { "253",                &IRCClient::HandleServerMessage             },
-    { "254",                &IRCClient::HandleServerMessage             },
-    { "255",                &IRCClient::HandleServerMessage             },
-    { "265",                &IRCClient::HandleServerMessage             },
-    { "266",                &IRCClient::HandleServerMessage             },
-    { "366",                &IRCClient::HandleServerMessage             },
-    { "372",                &IRCClient::HandleServerMessage             },
-    { "375",                &IRCClient::HandleServerMessage             },
-    { "376",                &IRCClient::HandleServerMessage             },
-    { "439",                &IRCClient::HandleServerMessage             },
+    "PRIVMSG",
+    "NOTICE",
+    "JOIN",
+    "PART",
+    "NICK",
+    "QUIT",
+    "PING",
+    "PONG",
+    "ERROR",
+    "MODE",
+    "CAP",
+    "USERNOTICE",
+    "USERSTATE",
+    "GLOBALUSERSTATE",
+    "ROOMSTATE",
+    "CLEARCHAT",
+    "CLEARMSG",
+    "HOSTTARGET",
+    "RECONNECT",
+    "WHISPER",
 };
 
-void IRCClient::HandleCTCP(IRCMessage message)
+unsigned char ircCommandSlots[IRC_COMMAND_SLOTS];
+
+IRCCommandHandler ircCommandTable[NUM_IRC_HANDLERS] =
 {
-    std::string to = message.parameters.at(0);
-    std::string text = message.parameters.at(message.parameters.size() - 1);
+    { IRC_CMD_PRIVMSG,            &IRCClient::HandlePrivMsg                   },
+    { IRC_CMD_NOTICE,             &IRCClient::HandleNotice                    },
+    { IRC_CMD_JOIN,               &IRCClient::HandleChannelJoinPart           },
+    { IRC_CMD_PART,               &IRCClient::HandleChannelJoinPart           },
+    { IRC_CMD_NICK,               &IRCClient::HandleUserNickChange            },
+    { IRC_CMD_QUIT,               &IRCClient::HandleUserQuit                  },
+    { IRC_CMD_CAP,                &IRCClient::HandleCapability                },
+    { IRC_NUMERIC(353),           &IRCClient::HandleChannelNamesList          },
+    { IRC_NUMERIC(433),           &IRCClient::HandleNicknameInUse             },
+    { IRC_NUMERIC(1),             &IRCClient::HandleServerMessage             },
+    { IRC_NUMERIC(2),             &IRCClient::HandleServerMessage             },
+    { IRC_NUMERIC(3),             &IRCClient::HandleServerMessage             },
+    { IRC_NUMERIC(4),             &IRCClient::HandleServerMessage             },
+    { IRC_NUMERIC(5),             &IRCClient::HandleServerMessage             },
+    { IRC_NUMERIC(250),           &IRCClient::HandleServerMessage             },
+    { IRC_NUMERIC(251),           &IRCClient::HandleServerMessage             },
+    { IRC_NUMERIC(252),           &IRCClient::HandleServerMessage             },
+    { IRC_NUMERIC(253),           &IRCClient::HandleServerMessage             },
+    { IRC_NUMERIC(254),           &IRCClient::HandleServerMessage             },
+    { IRC_NUMERIC(255),           &IRCClient::HandleServerMessage             },
+    { IRC_NUMERIC(265),           &IRCClient::HandleServerMessage             },
+    { IRC_NUMERIC(266),           &IRCClient::HandleServerMessage             },
+    { IRC_NUMERIC(366),           &IRCClient::HandleServerMessage             },
+    { IRC_NUMERIC(372),           &IRCClient::HandleServerMessage             },
+    { IRC_NUMERIC(375),           &IRCClient::HandleServerMessage             },
+    { IRC_NUMERIC(376),           &IRCClient::HandleServerMessage             },
+    { IRC_NUMERIC(439),           &IRCClient::HandleServerMessage             },
+};
+
+void (IRCClient::*ircDispatchTable[NUM_IRC_CMDS])(IRCMessage const& /*message*/);
+
+// Builds the hash slots and the flat dispatch table once, when the module is loaded
+static struct IRCCommandTableBuilder
+{
+    IRCCommandTableBuilder()
+    {
+        memset(ircCommandSlots, 0xFF, sizeof(ircCommandSlots));
+        for (int i = 0; i < NUM_IRC_NAMED_CMDS; ++i)
+        {
+            unsigned int slot = HashCommandName(ircCommandNames[i]);
+            // Adding a command that collides means the multipliers in HashCommandName need retuning
+            check(ircCommandSlots[slot] == 0xFF);
+            ircCommandSlots[slot] = (unsigned char)i;
+        }
+
+        for (int i = 0; i < NUM_IRC_HANDLERS; ++i)
+            ircDispatchTable[ircCommandTable[i].command] = ircCommandTable[i].handler;
+    }
+} ircCommandTableBuilder;
+
+void IRCClient::HandleCTCP(IRCMessage const& message)
+{
+    IRCStringView to = message.parameters.at(0);
+    IRCStringView text = message.parameters.back();
 
     // Remove '\001' from start/end of the string
     text = text.substr(1, text.size() - 2);
 	
-	UE_LOG(LogUTTwitchHype, Log, TEXT("[%s requested CTCP %s]"), ANSI_TO_TCHAR(message.prefix.nick.c_str()), ANSI_TO_TCHAR(text.c_str()));
+	UE_LOG(LogUTTwitchHype, Log, TEXT("[%s requested CTCP %s]"), ANSI_TO_TCHAR(message.prefix.nick.str().c_str()), ANSI_TO_TCHAR(text.str().c_str()));
 
-    if (to == _nick)
+    if (to == _nick.c_str())
     {
         if (text == "VERSION") // Respond to CTCP VERSION
         {
             //SendIRC("NOTICE " + message.prefix.nick + " :\001VERSION Open source IRC client by Fredi Machado - https://github.com/Fredi/IRCClient \001");
-			SendIRC("NOTICE " + message.prefix.nick + " :\001VERSION UT Twitch Hype \001");
+			SendIRC("NOTICE " + message.prefix.nick.str() + " :\001VERSION UT Twitch Hype \001");
             return;
         }
 
         // CTCP not implemented
-        SendIRC("NOTICE " + message.prefix.nick + " :\001ERRMSG " + text + " :Not implemented\001");
+        SendIRC("NOTICE " + message.prefix.nick.str() + " :\001ERRMSG " + text.str() + " :Not implemented\001");
     }
 }
 
-void IRCClient::HandlePrivMsg(IRCMessage message)
+void IRCClient::HandlePrivMsg(IRCMessage const& message)
 {
-    std::string text = message.parameters.at(message.parameters.size() - 1);
+    IRCStringView text = message.parameters.back();
 
     // Handle Client-To-Client Protocol
-    if (text[0] == '\001')
+    if (!text.empty() && text[0] == '\001')
     {
         HandleCTCP(message);
         return;
@@ -84,79 +132,102 @@ void IRCClient::HandlePrivMsg(IRCMessage message)
 
 	if (_debug)
 	{
-		std::string to = message.parameters.at(0);
-		if (to[0] == '#')
+		IRCStringView to = message.parameters.at(0);
+		if (!to.empty() && to[0] == '#')
 		{
-			UE_LOG(LogUTTwitchHype, Log, TEXT("From %s @ %s: %s"), ANSI_TO_TCHAR(message.prefix.nick.c_str()), ANSI_TO_TCHAR(to.c_str()), ANSI_TO_TCHAR(text.c_str()));
+			UE_LOG(LogUTTwitchHype, Log, TEXT("From %s @ %s: %s"), ANSI_TO_TCHAR(message.prefix.nick.str().c_str()), ANSI_TO_TCHAR(to.str().c_str()), ANSI_TO_TCHAR(text.str().c_str()));
 		}
 		else
 		{
-			UE_LOG(LogUTTwitchHype, Log, TEXT("From %s: %s"), ANSI_TO_TCHAR(message.prefix.nick.c_str()), ANSI_TO_TCHAR(text.c_str()));
+			UE_LOG(LogUTTwitchHype, Log, TEXT("From %s: %s"), ANSI_TO_TCHAR(message.prefix.nick.str().c_str()), ANSI_TO_TCHAR(text.str().c_str()));
 		}
 	}
 }
 
-void IRCClient::HandleNotice(IRCMessage message)
+void IRCClient::HandleNotice(IRCMessage const& message)
 {
-    std::string from = message.prefix.nick != "" ? message.prefix.nick : message.prefix.prefix;
-    std::string text = message.parameters.at(message.parameters.size() - 1);
+    IRCStringView from = !message.prefix.nick.empty() ? message.prefix.nick : message.prefix.prefix;
+    IRCStringView text = message.parameters.back();
+
+    // The account went over its limit and is muted for a while, chat it would have sent goes
+    // to the others. Only tagged notices say why, so writers want twitch.tv/tags too.
+    if (message.tags.Get("msg-id") == "msg_ratelimit")
+        Throttle(FPlatformTime::Seconds());
 
-    if (text[0] == '\001')
+    if (!text.empty() && text[0] == '\001')
     {
         text = text.substr(1, text.size() - 2);
-        if (text.find(" ") == std::string::npos)
+        if (text.find(' ') == IRCStringView::npos)
 		{
-			UE_LOG(LogUTTwitchHype, Log, TEXT("[Invalid %s reply from %s]"), ANSI_TO_TCHAR(text.c_str()), ANSI_TO_TCHAR(from.c_str()));
+			UE_LOG(LogUTTwitchHype, Log, TEXT("[Invalid %s reply from %s]"), ANSI_TO_TCHAR(text.str().c_str()), ANSI_TO_TCHAR(from.str().c_str()));
             return;
         }
-        std::string ctcp = text.substr(0, text.find(" "));
+        IRCStringView ctcp = text.substr(0, text.find(' '));
 
-		UE_LOG(LogUTTwitchHype, Log, TEXT("[%s %s reply]: %s"), ANSI_TO_TCHAR(from.c_str()), ANSI_TO_TCHAR(ctcp.c_str()), ANSI_TO_TCHAR(text.substr(text.find(" ") + 1).c_str()));
+		UE_LOG(LogUTTwitchHype, Log, TEXT("[%s %s reply]: %s"), ANSI_TO_TCHAR(from.str().c_str()), ANSI_TO_TCHAR(ctcp.str().c_str()), ANSI_TO_TCHAR(text.substr(text.find(' ') + 1).str().c_str()));
     }
 	else
 	{
-		UE_LOG(LogUTTwitchHype, Log, TEXT("-%s- %s"), ANSI_TO_TCHAR(from.c_str()), ANSI_TO_TCHAR(text.c_str()));
+		UE_LOG(LogUTTwitchHype, Log, TEXT("-%s- %s"), ANSI_TO_TCHAR(from.str().c_str()), ANSI_TO_TCHAR(text.str().c_str()));
 	}
 }
 
-void IRCClient::HandleChannelJoinPart(IRCMessage message)
+void IRCClient::HandleChannelJoinPart(IRCMessage const& message)
 {
-    std::string channel = message.parameters.at(0);
-    std::string action = message.command == "JOIN" ? "joins" : "leaves";
-    std::cout << message.prefix.nick << " " << action << " " << channel << std::endl;
+    IRCStringView channel = message.parameters.at(0);
+    std::string action = message.commandId == IRC_CMD_JOIN ? "joins" : "leaves";
+    std::cout << message.prefix.nick.str() << " " << action << " " << channel.str() << std::endl;
 }
 
-void IRCClient::HandleUserNickChange(IRCMessage message)
+void IRCClient::HandleUserNickChange(IRCMessage const& message)
 {
-    std::string newNick = message.parameters.at(0);
-    std::cout << message.prefix.nick << " changed his nick to " << newNick << std::endl;
+    IRCStringView newNick = message.parameters.at(0);
+    std::cout << message.prefix.nick.str() << " changed his nick to " << newNick.str() << std::endl;
 }
 
-void IRCClient::HandleUserQuit(IRCMessage message)
+void IRCClient::HandleUserQuit(IRCMessage const& message)
 {
-    std::string text = message.parameters.at(0);
-    std::cout << message.prefix.nick << " quits (" << text << ")" << std::endl;
+    IRCStringView text = message.parameters.at(0);
+    std::cout << message.prefix.nick.str() << " quits (" << text.str() << ")" << std::endl;
 }
 
-void IRCClient::HandleChannelNamesList(IRCMessage message)
+void IRCClient::HandleChannelNamesList(IRCMessage const& message)
 {
-    std::string channel = message.parameters.at(2);
-    std::string nicks = message.parameters.at(3);
+    IRCStringView channel = message.parameters.at(2);
+    IRCStringView nicks = message.parameters.at(3);
 
-	UE_LOG(LogUTTwitchHype, Log, TEXT("People on %s: %s"), ANSI_TO_TCHAR(channel.c_str()), ANSI_TO_TCHAR(nicks.c_str()));
+	UE_LOG(LogUTTwitchHype, Log, TEXT("People on %s: %s"), ANSI_TO_TCHAR(channel.str().c_str()), ANSI_TO_TCHAR(nicks.str().c_str()));
 }
 
-void IRCClient::HandleNicknameInUse(IRCMessage message)
+void IRCClient::HandleNicknameInUse(IRCMessage const& message)
 {
-	UE_LOG(LogUTTwitchHype, Log, TEXT("%s %s"), ANSI_TO_TCHAR(message.parameters.at(1).c_str()), ANSI_TO_TCHAR(message.parameters.at(2).c_str()));
+	UE_LOG(LogUTTwitchHype, Log, TEXT("%s %s"), ANSI_TO_TCHAR(message.parameters.at(1).str().c_str()), ANSI_TO_TCHAR(message.parameters.at(2).str().c_str()));
 }
 
-void IRCClient::HandleServerMessage(IRCMessage message)
+void IRCClient::HandleServerMessage(IRCMessage const& message)
 {
-	std::vector<std::string>::const_iterator itr = message.parameters.begin();
+	IRCStringView const* itr = message.parameters.begin();
 	++itr; // skip the first parameter (our nick)
-	for (; itr != message.parameters.end(); ++itr)
+	for (; itr < message.parameters.end(); ++itr)
 	{
-		UE_LOG(LogUTTwitchHype, Log, TEXT("%s "), ANSI_TO_TCHAR((*itr).c_str()));
+		UE_LOG(LogUTTwitchHype, Log, TEXT("%s "), ANSI_TO_TCHAR(itr->str().c_str()));
 	}
 }
+
+void IRCClient::HandleCapability(IRCMessage const& message)
+{
+    // CAP <nick> ACK|NAK :<capabilities>
+    IRCStringView subcommand = message.parameters.at(1);
+    IRCStringView capabilities = message.parameters.back();
+
+    if (subcommand == "ACK")
+    {
+        if (!_capabilities.empty())
+            _capabilities += ' ';
+        _capabilities.append(capabilities.data(), capabilities.size());
+    }
+    else if (subcommand == "NAK")
+    {
+		UE_LOG(LogUTTwitchHype, Warning, TEXT("Server refused capabilities %s"), ANSI_TO_TCHAR(capabilities.str().c_str()));
+    }
+}
@@ -18,25 +18,17 @@
 
 #include "IRCClient.h"
 
-#define NUM_IRC_CMDS 26
+#define NUM_IRC_HANDLERS 27
 
 struct IRCCommandHandler
 {
-    std::string command;
-    void (IRCClient::*handler)(IRCMessage /*message*/);
+    IRCCommandId command;
+    void (IRCClient::*handler)(IRCMessage const& /*message*/);
 };
 
-extern IRCCommandHandler ircCommandTable[NUM_IRC_CMDS];
+extern IRCCommandHandler ircCommandTable[NUM_IRC_HANDLERS];
 
-inline int const GetCommandHandler(std::string command)
-{
-    for (int i = 0; i < NUM_IRC_CMDS; ++i)
-    {
-        if (ircCommandTable[i].command == command)
-            return i;
-    }
-
-    return NUM_IRC_CMDS;
-}
+// ircCommandTable flattened so it can be indexed by IRCCommandId, NULL where there's no default handler
+extern void (IRCClient::*ircDispatchTable[NUM_IRC_CMDS])(IRCMessage const& /*message*/);
 
 #endif
@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2011 Fredi Machado <https://github.com/Fredi>
+ * IRCClient is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * http://www.gnu.org/licenses/lgpl.html
+ */
+
+#include "TwitchHype.h"
+
+#include <algorithm>
+#include <cstdio>
+#include "IRCHashRing.h"
+
+void IRCHashRing::Add(size_t node, IRCStringView name)
+{
+    char label[64];
+    for (int i = 0; i < IRC_RING_POINTS; ++i)
+    {
+        int length = snprintf(label, sizeof(label), "%.*s#%d", (int)FMath::Min(name.size(), (size_t)48), name.data(), i);
+
+        Point point;
+        point.hash = Hash(IRCStringView(label, length));
+        point.node = node;
+        _points.insert(std::upper_bound(_points.begin(), _points.end(), point), point);
+    }
+}
+
+void IRCHashRing::Preference(IRCStringView key, std::vector<size_t>& nodes) const
+{
+    nodes.clear();
+    if (_points.empty())
+        return;
+
+    Point start;
+    start.hash = Hash(key);
+    start.node = 0;
+    size_t first = std::lower_bound(_points.begin(), _points.end(), start) - _points.begin();
+
+    for (size_t i = 0; i < _points.size(); ++i)
+    {
+        size_t node = _points[(first + i) % _points.size()].node;
+        if (std::find(nodes.begin(), nodes.end(), node) == nodes.end())
+            nodes.push_back(node);
+    }
+}
+
+unsigned int IRCHashRing::Hash(IRCStringView key)
+{
+    // FNV-1a, then a murmur3 finalizer since keys that only differ in their last
+    // character would otherwise end up next to each other on the ring
+    unsigned int hash = 2166136261u;
+    for (size_t i = 0; i < key.size(); ++i)
+    {
+        hash ^= (unsigned char)key[i];
+        hash *= 16777619u;
+    }
+
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6bu;
+    hash ^= hash >> 13;
+    hash *= 0xc2b2ae35u;
+    hash ^= hash >> 16;
+    return hash;
+}
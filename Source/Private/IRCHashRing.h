@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2011 Fredi Machado <https://github.com/Fredi>
+ * IRCClient is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * http://www.gnu.org/licenses/lgpl.html
+ */
+
+#ifndef _IRCHASHRING_H
+#define _IRCHASHRING_H
+
+#include <vector>
+#include "IRCStringView.h"
+
+// Points each node gets on the ring, enough that keys split evenly between a handful of nodes
+#define IRC_RING_POINTS 64
+
+// Consistent hash ring. A key belongs to the first node point at or after its own hash,
+// so adding or removing a node only moves the keys that land on that node's points.
+class IRCHashRing
+{
+public:
+    // `name` has to stay the same from run to run, it decides where the node's points go
+    void Add(size_t node, IRCStringView name);
+    void Clear() { _points.clear(); };
+    bool empty() const { return _points.empty(); };
+
+    // Every node once, in the order met walking the ring from the key. The first one owns
+    // the key, the rest are where it goes when the ones before it can't take it.
+    void Preference(IRCStringView key, std::vector<size_t>& nodes) const;
+
+    static unsigned int Hash(IRCStringView key);
+
+private:
+    struct Point
+    {
+        unsigned int hash;
+        size_t node;
+
+        bool operator<(Point const& other) const { return hash < other.hash; };
+    };
+
+    // Sorted by hash
+    std::vector<Point> _points;
+};
+
+#endif
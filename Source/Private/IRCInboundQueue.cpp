@@ -0,0 +1,211 @@
+/*
+ * Copyright (C) 2011 Fredi Machado <https://github.com/Fredi>
+ * IRCClient is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * http://www.gnu.org/licenses/lgpl.html
+ */
+
+#include "TwitchHype.h"
+
+#include "IRCInboundQueue.h"
+
+// FNV-1a over who said it and what they said
+static unsigned long long CommandKey(IRCStringView user, IRCStringView text)
+{
+    unsigned long long hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < user.size(); ++i)
+        hash = (hash ^ (unsigned char)user[i]) * 1099511628211ULL;
+
+    hash = (hash ^ ' ') * 1099511628211ULL;
+
+    for (size_t i = 0; i < text.size(); ++i)
+        hash = (hash ^ (unsigned char)text[i]) * 1099511628211ULL;
+
+    // 0 is an empty slot in IRCKeySet
+    return hash ? hash : 1;
+}
+
+void IRCKeySet::Reserve(size_t count)
+{
+    // At most half full keeps the probe runs short
+    size_t capacity = 8;
+    while (capacity < count * 2)
+        capacity *= 2;
+
+    if (capacity <= _keys.size())
+        return;
+
+    std::vector<unsigned long long> old(capacity, 0);
+    old.swap(_keys);
+    _count = 0;
+
+    for (size_t i = 0; i < old.size(); ++i)
+        if (old[i] != 0)
+            Insert(old[i]);
+}
+
+bool IRCKeySet::Contains(unsigned long long key) const
+{
+    if (_keys.empty())
+        return false;
+
+    for (size_t i = Home(key);; i = (i + 1) & (_keys.size() - 1))
+    {
+        if (_keys[i] == key)
+            return true;
+        if (_keys[i] == 0)
+            return false;
+    }
+}
+
+void IRCKeySet::Insert(unsigned long long key)
+{
+    if ((_count + 1) * 2 > _keys.size())
+        Reserve(_count + 1);
+
+    size_t i = Home(key);
+    while (_keys[i] != 0)
+    {
+        if (_keys[i] == key)
+            return;
+        i = (i + 1) & (_keys.size() - 1);
+    }
+
+    _keys[i] = key;
+    ++_count;
+}
+
+void IRCKeySet::Erase(unsigned long long key)
+{
+    if (_keys.empty())
+        return;
+
+    size_t mask = _keys.size() - 1;
+    size_t i = Home(key);
+    while (_keys[i] != key)
+    {
+        if (_keys[i] == 0)
+            return;
+        i = (i + 1) & mask;
+    }
+
+    // Pull later keys of the run back into the hole so lookups never stop short of them
+    for (size_t j = (i + 1) & mask; _keys[j] != 0; j = (j + 1) & mask)
+    {
+        size_t home = Home(_keys[j]);
+        // Leave it if its home lies cyclically in (i, j]
+        if (i <= j ? (i < home && home <= j) : (i < home || home <= j))
+            continue;
+
+        _keys[i] = _keys[j];
+        i = j;
+    }
+
+    _keys[i] = 0;
+    --_count;
+}
+
+IRCInboundQueue::IRCInboundQueue() : _maxDepth(0), _budget(0), _commandPrefix('!')
+{
+}
+
+void IRCInboundQueue::Configure(size_t maxDepth, double budget, char commandPrefix)
+{
+    _maxDepth = maxDepth;
+    _budget = budget;
+    _commandPrefix = commandPrefix;
+    _pendingCommands.Reserve(maxDepth);
+}
+
+bool IRCInboundQueue::Push(IRCStringView line, IRCStringView user, IRCStringView text, double now)
+{
+    if (!IsCommand(text))
+    {
+        // Nothing the bot acts on, so it's the first thing to go once the queue is half full
+        if (Depth() >= _maxDepth / 2)
+        {
+            ++_stats.shedChat;
+            return false;
+        }
+
+        Append(_chat, line, 0, now);
+        return true;
+    }
+
+    unsigned long long key = CommandKey(user, text);
+    if (_pendingCommands.Contains(key))
+    {
+        ++_stats.collapsed;
+        return false;
+    }
+
+    if (Depth() >= _maxDepth)
+    {
+        if (!_chat.empty())
+        {
+            _chat.pop_front();
+            ++_stats.shedChat;
+        }
+        else
+        {
+            // The oldest command is the most likely to be stale by the time it would run
+            _pendingCommands.Erase(_commands.front().key);
+            _commands.pop_front();
+            ++_stats.shedCommands;
+        }
+    }
+
+    Append(_commands, line, key, now);
+    _pendingCommands.Insert(key);
+
+    return true;
+}
+
+void IRCInboundQueue::Append(IRCSlotRing<QueuedLine>& queue, IRCStringView line, unsigned long long key, double now)
+{
+    QueuedLine& queued = queue.push_back();
+    queued.line.assign(line.data(), line.size());
+    queued.queuedTime = now;
+    queued.key = key;
+
+    ++_stats.queued;
+    _stats.maxDepth = FMath::Max(_stats.maxDepth, Depth());
+}
+
+bool IRCInboundQueue::Pop(std::string& line, double now)
+{
+    IRCSlotRing<QueuedLine>* queue;
+    if (_commands.empty())
+        queue = &_chat;
+    else if (_chat.empty())
+        queue = &_commands;
+    else
+        queue = _commands.front().queuedTime <= _chat.front().queuedTime ? &_commands : &_chat;
+
+    if (queue->empty())
+        return false;
+
+    QueuedLine& queued = queue->front();
+
+    double wait = now - queued.queuedTime;
+    _stats.averageWait = _stats.processed == 0 ? wait : _stats.averageWait * 0.9 + wait * 0.1;
+    _stats.maxWait = FMath::Max(_stats.maxWait, wait);
+    ++_stats.processed;
+
+    if (queue == &_commands)
+        _pendingCommands.Erase(queued.key);
+
+    // The caller's old buffer takes the line's place, the slot keeps it for the next line
+    line.swap(queued.line);
+    queue->pop_front();
+
+    return true;
+}
@@ -0,0 +1,132 @@
+/*
+ * Copyright (C) 2011 Fredi Machado <https://github.com/Fredi>
+ * IRCClient is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * http://www.gnu.org/licenses/lgpl.html
+ */
+
+#ifndef _IRCINBOUNDQUEUE_H
+#define _IRCINBOUNDQUEUE_H
+
+#include <string>
+#include <utility>
+#include <vector>
+#include "IRCStringView.h"
+#include "IRCSlotRing.h"
+
+struct IRCInboundQueueStats
+{
+    IRCInboundQueueStats() : queued(0), processed(0), shedChat(0), shedCommands(0), collapsed(0), maxDepth(0), averageWait(0), maxWait(0), overBudgetTicks(0) {};
+
+    unsigned long long queued;
+    unsigned long long processed;
+
+    // Plain chat dropped to make room, commands dropped once there was no chat left to drop,
+    // and commands that were already waiting word for word from the same user
+    unsigned long long shedChat;
+    unsigned long long shedCommands;
+    unsigned long long collapsed;
+
+    size_t maxDepth;
+
+    // Seconds between a line arriving and its hooks running
+    double averageWait;
+    double maxWait;
+
+    // Ticks that ran out of budget with lines still waiting
+    unsigned long long overBudgetTicks;
+};
+
+// Open addressing set of non-zero keys. Sized once for the most keys it will hold, so
+// adding and removing them never allocates after that.
+class IRCKeySet
+{
+public:
+    IRCKeySet() : _count(0) {};
+
+    void Reserve(size_t count);
+
+    bool Contains(unsigned long long key) const;
+    void Insert(unsigned long long key);
+    void Erase(unsigned long long key);
+
+private:
+    size_t Home(unsigned long long key) const { return (size_t)(key ^ (key >> 32)) & (_keys.size() - 1); };
+
+    // 0 marks an empty slot
+    std::vector<unsigned long long> _keys;
+    size_t _count;
+};
+
+// Chat lines wait here between being read and being handed to hooks, so a flood costs
+// at most the per-tick budget no matter how many lines arrive at once. Commands get the
+// whole queue, plain chat only gets the first half of it and is the first to go.
+class IRCInboundQueue
+{
+public:
+    IRCInboundQueue();
+
+    // A max depth of 0 turns the queue off, lines are handled the moment they're read
+    void Configure(size_t maxDepth, double budget, char commandPrefix = '!');
+
+    bool Enabled() const { return _maxDepth > 0; };
+    double Budget() const { return _budget; };
+
+    // Chat text starting with the prefix is a command
+    bool IsCommand(IRCStringView text) const { return !text.empty() && text[0] == _commandPrefix; };
+
+    // user identifies the sender, text is what they said. Returns false if the line was shed.
+    bool Push(IRCStringView line, IRCStringView user, IRCStringView text, double now);
+
+    // Oldest waiting line, commands and chat in arrival order
+    bool Pop(std::string& line, double now);
+
+    void RecordOverBudget() { ++_stats.overBudgetTicks; };
+
+    size_t Depth() const { return _commands.size() + _chat.size(); };
+    size_t CommandDepth() const { return _commands.size(); };
+
+    IRCInboundQueueStats const& Stats() const { return _stats; };
+
+private:
+    struct QueuedLine
+    {
+        QueuedLine() : queuedTime(0), key(0) {};
+
+        void swap(QueuedLine& other)
+        {
+            line.swap(other.line);
+            std::swap(queuedTime, other.queuedTime);
+            std::swap(key, other.key);
+        };
+
+        std::string line;
+        double queuedTime;
+        unsigned long long key;
+    };
+
+    void Append(IRCSlotRing<QueuedLine>& queue, IRCStringView line, unsigned long long key, double now);
+
+    // Popped slots keep their buffers, so a steady stream of lines doesn't allocate
+    IRCSlotRing<QueuedLine> _commands;
+    IRCSlotRing<QueuedLine> _chat;
+
+    // Keys of the commands waiting in _commands, to spot repeats without a scan
+    IRCKeySet _pendingCommands;
+
+    size_t _maxDepth;
+    double _budget;
+    char _commandPrefix;
+
+    IRCInboundQueueStats _stats;
+};
+
+#endif
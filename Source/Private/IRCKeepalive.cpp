@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) 2011 Fredi Machado <https://github.com/Fredi>
+ * IRCClient is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * http://www.gnu.org/licenses/lgpl.html
+ */
+
+#include "TwitchHype.h"
+
+#include <cstdio>
+#include "IRCKeepalive.h"
+
+// Marks our PINGs, anything else that comes back in a PONG isn't ours to time
+static char const IRCPingTokenPrefix[] = "TH";
+static size_t const IRCPingTokenPrefixLength = sizeof(IRCPingTokenPrefix) - 1;
+
+IRCKeepalive::IRCKeepalive() : _interval(30.0), _timeout(60.0), _lastPing(0), _lastTraffic(0)
+{
+}
+
+void IRCKeepalive::Configure(double interval, double timeout)
+{
+    _interval = interval;
+    _timeout = timeout;
+}
+
+void IRCKeepalive::Reset(double now)
+{
+    _lastPing = now;
+    _lastTraffic = now;
+}
+
+bool IRCKeepalive::PingDue(double now, std::string& line)
+{
+    if (_interval <= 0 || now - _lastPing < _interval)
+        return false;
+
+    _lastPing = now;
+    ++_stats.pingsSent;
+
+    // Microseconds are plenty, and a plain integer survives the server echoing it back
+    char buffer[64];
+    snprintf(buffer, sizeof(buffer), "PING :%s%llu", IRCPingTokenPrefix, (unsigned long long)(now * 1000000.0));
+    line = buffer;
+
+    return true;
+}
+
+bool IRCKeepalive::OnPong(IRCStringView token, double now)
+{
+    if (token.size() <= IRCPingTokenPrefixLength || token.substr(0, IRCPingTokenPrefixLength) != IRCPingTokenPrefix)
+        return false;
+
+    unsigned long long sent = 0;
+    for (size_t i = IRCPingTokenPrefixLength; i < token.size(); ++i)
+    {
+        if (token[i] < '0' || token[i] > '9')
+            return false;
+        sent = sent * 10 + (token[i] - '0');
+    }
+
+    double rtt = now - sent / 1000000.0;
+    if (rtt < 0)
+        return false;
+
+    ++_stats.pongsReceived;
+    RecordRtt(rtt);
+
+    return true;
+}
+
+void IRCKeepalive::RecordRtt(double rtt)
+{
+    _stats.lastRtt = rtt;
+    _stats.minRtt = _stats.pongsReceived == 1 ? rtt : FMath::Min(_stats.minRtt, rtt);
+    _stats.maxRtt = FMath::Max(_stats.maxRtt, rtt);
+    _stats.averageRtt = _stats.pongsReceived == 1 ? rtt : _stats.averageRtt * 0.9 + rtt * 0.1;
+
+    int bucket = 0;
+    while (bucket < IRC_RTT_BUCKETS - 1 && rtt >= BucketLimit(bucket))
+        ++bucket;
+
+    ++_stats.histogram[bucket];
+}
+
+double IRCKeepalive::BucketLimit(int bucket)
+{
+    // 1ms, 2ms, 4ms...
+    return (double)(1 << bucket) / 1000.0;
+}
+
+double IRCKeepalive::Percentile(double fraction) const
+{
+    if (_stats.pongsReceived == 0)
+        return 0;
+
+    unsigned long long wanted = FMath::Max(1ULL, (unsigned long long)(fraction * _stats.pongsReceived + 0.5));
+    unsigned long long seen = 0;
+    for (int bucket = 0; bucket < IRC_RTT_BUCKETS - 1; ++bucket)
+    {
+        seen += _stats.histogram[bucket];
+        if (seen >= wanted)
+            return BucketLimit(bucket);
+    }
+
+    return _stats.maxRtt;
+}
@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) 2011 Fredi Machado <https://github.com/Fredi>
+ * IRCClient is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * http://www.gnu.org/licenses/lgpl.html
+ */
+
+#ifndef _IRCKEEPALIVE_H
+#define _IRCKEEPALIVE_H
+
+#include <string>
+#include "IRCStringView.h"
+
+// Round trips are bucketed by powers of two milliseconds: under 1ms, under 2ms,
+// under 4ms and so on, the last bucket takes everything from ~16s up
+#define IRC_RTT_BUCKETS 16
+
+struct IRCKeepaliveStats
+{
+    IRCKeepaliveStats() : pingsSent(0), pongsReceived(0), deadConnections(0), lastRtt(0), minRtt(0), maxRtt(0), averageRtt(0)
+    {
+        for (int i = 0; i < IRC_RTT_BUCKETS; ++i)
+            histogram[i] = 0;
+    };
+
+    unsigned long long pingsSent;
+    unsigned long long pongsReceived;
+
+    // Connections given up on because nothing arrived in time
+    unsigned long long deadConnections;
+
+    // Seconds from our PING being queued to its PONG being parsed, so a slow frame shows up in it
+    double lastRtt;
+    double minRtt;
+    double maxRtt;
+    double averageRtt;
+
+    unsigned long long histogram[IRC_RTT_BUCKETS];
+};
+
+// Pings the server on its own schedule instead of waiting for the server's PINGs, which
+// Twitch only sends every few minutes. The send time rides along in the PING's token,
+// so the matching PONG carries everything needed to work out the round trip.
+class IRCKeepalive
+{
+public:
+    IRCKeepalive();
+
+    // An interval of 0 turns our own PINGs off, a timeout of 0 never declares the connection dead
+    void Configure(double interval, double timeout);
+
+    // Starts over for a new session
+    void Reset(double now);
+
+    // Anything at all from the server counts as a sign of life
+    void OnTraffic(double now) { _lastTraffic = now; };
+
+    // Fills in a PING line if one is due
+    bool PingDue(double now, std::string& line);
+
+    // Returns false if the PONG wasn't an answer to one of our PINGs
+    bool OnPong(IRCStringView token, double now);
+
+    bool Dead(double now) const { return _timeout > 0 && now - _lastTraffic > _timeout; };
+    void RecordDead() { ++_stats.deadConnections; };
+
+    double Timeout() const { return _timeout; };
+
+    // Upper bound, in seconds, of the histogram bucket holding the given fraction of round trips
+    double Percentile(double fraction) const;
+
+    static double BucketLimit(int bucket);
+
+    IRCKeepaliveStats const& Stats() const { return _stats; };
+
+private:
+    void RecordRtt(double rtt);
+
+    double _interval;
+    double _timeout;
+
+    double _lastPing;
+    double _lastTraffic;
+
+    IRCKeepaliveStats _stats;
+};
+
+#endif
@@ -0,0 +1,106 @@
+/*
+ * Copyright (C) 2011 Fredi Machado <https://github.com/Fredi>
+ * IRCClient is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * http://www.gnu.org/licenses/lgpl.html 
+ */
+
+#include "TwitchHype.h"
+
+#include "IRCLineRing.h"
+
+// Each record is a 32 bit length and a 32 bit priority followed by the line, padded
+// to 4 bytes. A record never wraps, the producer leaves a marker in place of the length
+// and starts over at the front.
+#define RING_WRAP_MARKER 0xFFFFFFFFu
+#define RING_LENGTH_SIZE sizeof(unsigned int)
+#define RING_HEADER_SIZE (RING_LENGTH_SIZE + sizeof(int))
+#define RING_ALIGN(size) (((size) + 3) & ~(size_t)3)
+
+IRCLineRing::IRCLineRing(size_t capacity) : _head(0), _tail(0), _nextHead(0)
+{
+    size_t size = 64;
+    while (size < capacity)
+        size <<= 1;
+
+    _buffer.resize(size);
+    _mask = size - 1;
+}
+
+bool IRCLineRing::Push(IRCStringView line, int priority)
+{
+    size_t need = RING_HEADER_SIZE + RING_ALIGN(line.size());
+    size_t capacity = _buffer.size();
+
+    size_t tail = _tail.load(std::memory_order_relaxed);
+    size_t head = _head.load(std::memory_order_acquire);
+
+    size_t offset = tail & _mask;
+    size_t skip = capacity - offset < need ? capacity - offset : 0;
+
+    if (need + skip > capacity - (tail - head))
+        return false;
+
+    if (skip)
+    {
+        unsigned int marker = RING_WRAP_MARKER;
+        memcpy(&_buffer[offset], &marker, RING_LENGTH_SIZE);
+        tail += skip;
+        offset = 0;
+    }
+
+    unsigned int length = (unsigned int)line.size();
+    memcpy(&_buffer[offset], &length, RING_LENGTH_SIZE);
+    memcpy(&_buffer[offset + RING_LENGTH_SIZE], &priority, sizeof(int));
+    memcpy(&_buffer[offset + RING_HEADER_SIZE], line.data(), line.size());
+
+    _tail.store(tail + need, std::memory_order_release);
+
+    return true;
+}
+
+bool IRCLineRing::Peek(IRCStringView& line, int* priority)
+{
+    size_t head = _head.load(std::memory_order_relaxed);
+    size_t tail = _tail.load(std::memory_order_acquire);
+
+    if (head == tail)
+        return false;
+
+    size_t offset = head & _mask;
+    unsigned int length;
+    memcpy(&length, &_buffer[offset], RING_LENGTH_SIZE);
+
+    if (length == RING_WRAP_MARKER)
+    {
+        head += _buffer.size() - offset;
+        _head.store(head, std::memory_order_release);
+
+        if (head == tail)
+            return false;
+
+        offset = 0;
+        memcpy(&length, &_buffer[offset], RING_LENGTH_SIZE);
+    }
+
+    if (priority)
+        memcpy(priority, &_buffer[offset + RING_LENGTH_SIZE], sizeof(int));
+
+    line = IRCStringView(&_buffer[offset + RING_HEADER_SIZE], length);
+    _nextHead = head + RING_HEADER_SIZE + RING_ALIGN(length);
+
+    return true;
+}
+
+void IRCLineRing::Pop()
+{
+    _head.store(_nextHead, std::memory_order_release);
+}
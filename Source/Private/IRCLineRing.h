@@ -0,0 +1,55 @@
+/*
+ * Copyright (C) 2011 Fredi Machado <https://github.com/Fredi>
+ * IRCClient is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * http://www.gnu.org/licenses/lgpl.html 
+ */
+
+#ifndef _IRCLINERING_H
+#define _IRCLINERING_H
+
+#include <atomic>
+#include <vector>
+#include "IRCStringView.h"
+
+// Lock-free single producer / single consumer queue of lines. Every line is stored
+// contiguously, so the consumer can parse it in place before releasing it with Pop.
+class IRCLineRing
+{
+public:
+    // capacity is rounded up to a power of two
+    explicit IRCLineRing(size_t capacity);
+
+    // Producer side, returns false if there's no room right now.
+    // priority isn't looked at, it just travels with the line.
+    bool Push(IRCStringView line, int priority = 0);
+
+    // Consumer side, the view stays valid until Pop
+    bool Peek(IRCStringView& line, int* priority = NULL);
+    void Pop();
+
+    size_t Capacity() const { return _buffer.size(); };
+
+    bool Empty() const { return _head.load(std::memory_order_acquire) == _tail.load(std::memory_order_acquire); };
+
+private:
+    std::vector<char> _buffer;
+    size_t _mask;
+
+    // Free running byte counters, only the consumer moves _head and only the producer moves _tail
+    std::atomic<size_t> _head;
+    std::atomic<size_t> _tail;
+
+    // Where the consumer's head goes once the peeked line is popped
+    size_t _nextHead;
+};
+
+#endif
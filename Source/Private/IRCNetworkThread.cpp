@@ -0,0 +1,251 @@
+/*
+ * Copyright (C) 2011 Fredi Machado <https://github.com/Fredi>
+ * IRCClient is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * http://www.gnu.org/licenses/lgpl.html 
+ */
+
+#include "TwitchHype.h"
+
+#include "IRCSocket.h"
+#include "IRCNetworkThread.h"
+
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#endif
+
+#define INBOUND_RING_SIZE (256 * 1024)
+#define OUTBOUND_RING_SIZE (64 * 1024)
+
+// Upper bound on how long the loop sleeps, it's also how quickly Stop is noticed
+#define WAIT_TIMEOUT_MS 100
+
+IRCNetworkThread::IRCNetworkThread(IRCSocket& socket)
+    : _socket(socket), _inbound(INBOUND_RING_SIZE), _outbound(OUTBOUND_RING_SIZE), _hasPendingLine(false), _readBlocked(false), _thread(NULL), _stopping(false), _closed(false)
+{
+#ifdef __linux__
+    _epoll = epoll_create1(0);
+    _wakeFd = eventfd(0, EFD_NONBLOCK);
+
+    epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.fd = _wakeFd;
+    epoll_ctl(_epoll, EPOLL_CTL_ADD, _wakeFd, &event);
+
+    event.data.fd = _socket.Handle();
+    epoll_ctl(_epoll, EPOLL_CTL_ADD, _socket.Handle(), &event);
+#endif
+}
+
+IRCNetworkThread::~IRCNetworkThread()
+{
+    Shutdown();
+
+#ifdef __linux__
+    close(_wakeFd);
+    close(_epoll);
+#endif
+}
+
+bool IRCNetworkThread::Start()
+{
+    _thread = FRunnableThread::Create(this, TEXT("IRCNetworkThread"), 0, TPri_BelowNormal);
+    return _thread != NULL;
+}
+
+void IRCNetworkThread::Shutdown()
+{
+    if (_thread)
+    {
+        Stop();
+        _thread->WaitForCompletion();
+        delete _thread;
+        _thread = NULL;
+    }
+}
+
+void IRCNetworkThread::Stop()
+{
+    _stopping.store(true, std::memory_order_release);
+    Wake();
+}
+
+bool IRCNetworkThread::PushOutbound(IRCStringView line, int priority)
+{
+    if (!_outbound.Push(line, priority))
+        return false;
+
+    Wake();
+    return true;
+}
+
+void IRCNetworkThread::TakeOutbound(std::vector<IRCUnsentLine>& lines)
+{
+    IRCUnsentLine unsent;
+    IRCStringView line;
+    while (_outbound.Peek(line, &unsent.priority))
+    {
+        unsent.line = line.str();
+        lines.push_back(unsent);
+        _outbound.Pop();
+    }
+}
+
+uint32 IRCNetworkThread::Run()
+{
+    while (!_stopping.load(std::memory_order_acquire))
+    {
+        if (!ReceiveLines() || !SendLines())
+        {
+            _closed.store(true, std::memory_order_release);
+            break;
+        }
+
+        Wait(_socket.HasPendingSend());
+    }
+
+    return 0;
+}
+
+bool IRCNetworkThread::ReceiveLines()
+{
+    // Lines handed out by the socket stay valid until the next ReceiveData, so
+    // don't read any more until the one that didn't fit has made it across
+    if (_hasPendingLine)
+    {
+        if (!PushInbound(_pendingLine))
+            return true;
+        _hasPendingLine = false;
+    }
+
+    if (!_socket.ReceiveData())
+        return false;
+
+    IRCStringView line;
+    while (_socket.NextLine(line))
+    {
+        if (line.size() + 3 * sizeof(unsigned int) > _inbound.Capacity() / 2)
+        {
+            UE_LOG(LogUTTwitchHype, Warning, TEXT("Dropping %d byte line from server."), (int32)line.size());
+            continue;
+        }
+
+        if (!PushInbound(line))
+        {
+            _pendingLine = line;
+            _hasPendingLine = true;
+            break;
+        }
+    }
+
+    return true;
+}
+
+bool IRCNetworkThread::PushInbound(IRCStringView line)
+{
+    if (_inbound.Push(line))
+        return true;
+
+    // Ask for a wake up once there's room, then look again in case the game thread made some
+    // before it could see the request. The fences pair with the one in PopInbound
+    _readBlocked.store(true, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (!_inbound.Push(line))
+        return false;
+
+    _readBlocked.store(false, std::memory_order_relaxed);
+    return true;
+}
+
+void IRCNetworkThread::PopInbound()
+{
+    _inbound.Pop();
+
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (_readBlocked.load(std::memory_order_relaxed) && _readBlocked.exchange(false, std::memory_order_relaxed))
+        Wake();
+}
+
+bool IRCNetworkThread::SendLines()
+{
+    // Lines stay in the ring until the socket's output buffer has room for them
+    IRCStringView line;
+    int priority;
+    while (_outbound.Peek(line, &priority) && _socket.QueueLine(line, priority))
+        _outbound.Pop();
+
+    return _socket.FlushSendBuffer();
+}
+
+void IRCNetworkThread::Wait(bool wantWrite)
+{
+    // The consumer has to make room before there's any point in reading again, the unread
+    // data would only make a level-triggered wait return straight away. PopInbound wakes us
+    bool wantRead = !_hasPendingLine;
+    int timeout = WAIT_TIMEOUT_MS;
+
+#ifdef __linux__
+    epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = (wantRead ? EPOLLIN : 0) | (wantWrite ? EPOLLOUT : 0);
+    event.data.fd = _socket.Handle();
+    epoll_ctl(_epoll, EPOLL_CTL_MOD, _socket.Handle(), &event);
+
+    epoll_event events[2];
+    int ready = epoll_wait(_epoll, events, 2, timeout);
+    for (int i = 0; i < ready; ++i)
+    {
+        if (events[i].data.fd == _wakeFd)
+        {
+            uint64_t value;
+            while (read(_wakeFd, &value, sizeof(value)) > 0)
+                ;
+        }
+    }
+#else
+    // No cheap way to wake select from another thread, so outbound lines can sit
+    // for up to a few milliseconds
+    if (!wantRead && !wantWrite)
+    {
+        // select with nothing to wait on fails at once on Windows
+        FPlatformProcess::Sleep(0.005f);
+        return;
+    }
+
+    fd_set readSet;
+    fd_set writeSet;
+    FD_ZERO(&readSet);
+    FD_ZERO(&writeSet);
+    if (wantRead)
+        FD_SET(_socket.Handle(), &readSet);
+    if (wantWrite)
+        FD_SET(_socket.Handle(), &writeSet);
+
+    struct timeval tv;
+    tv.tv_sec = 0;
+    tv.tv_usec = FMath::Min(timeout, 5) * 1000;
+    select(_socket.Handle() + 1, &readSet, &writeSet, NULL, &tv);
+#endif
+}
+
+void IRCNetworkThread::Wake()
+{
+#ifdef __linux__
+    uint64_t value = 1;
+    if (write(_wakeFd, &value, sizeof(value)) < 0)
+    {
+        // Already signalled
+    }
+#endif
+}
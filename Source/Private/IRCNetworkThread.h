@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2011 Fredi Machado <https://github.com/Fredi>
+ * IRCClient is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * http://www.gnu.org/licenses/lgpl.html 
+ */
+
+#ifndef _IRCNETWORKTHREAD_H
+#define _IRCNETWORKTHREAD_H
+
+#include <atomic>
+#include <string>
+#include <vector>
+#include "IRCLineRing.h"
+
+class IRCSocket;
+struct IRCUnsentLine;
+
+// Owns a connected IRCSocket while it runs: reads lines into the inbound ring and
+// writes whatever the game thread puts in the outbound ring, so the game thread
+// never touches the socket itself.
+class IRCNetworkThread : public FRunnable
+{
+public:
+    IRCNetworkThread(IRCSocket& socket);
+    virtual ~IRCNetworkThread();
+
+    bool Start();
+
+    // Stops the loop and waits for it, the socket belongs to the caller again afterwards
+    void Shutdown();
+
+    // FRunnable
+    virtual uint32 Run() override;
+    virtual void Stop() override;
+
+    // Game thread side
+    bool PeekInbound(IRCStringView& line) { return _inbound.Peek(line); };
+    // Wakes the thread if it stopped reading because the ring was full
+    void PopInbound();
+    bool PushOutbound(IRCStringView line, int priority);
+
+    // Appends the lines the thread never got to, only once it has been shut down
+    void TakeOutbound(std::vector<IRCUnsentLine>& lines);
+
+    // The server hung up or the socket failed, everything left in the inbound ring is still good
+    bool Closed() const { return _closed.load(std::memory_order_acquire); };
+
+private:
+    bool ReceiveLines();
+    bool PushInbound(IRCStringView line);
+    bool SendLines();
+    void Wait(bool wantWrite);
+    void Wake();
+
+    IRCSocket& _socket;
+
+    IRCLineRing _inbound;
+    IRCLineRing _outbound;
+
+    // A line taken off the socket that didn't fit in the inbound ring yet
+    IRCStringView _pendingLine;
+    bool _hasPendingLine;
+    // Set while the thread waits for the game thread to make room in the inbound ring
+    std::atomic<bool> _readBlocked;
+
+    FRunnableThread* _thread;
+
+    std::atomic<bool> _stopping;
+    std::atomic<bool> _closed;
+
+#ifdef __linux__
+    int _epoll;
+    int _wakeFd;
+#endif
+};
+
+#endif
@@ -0,0 +1,112 @@
+/*
+ * Copyright (C) 2011 Fredi Machado <https://github.com/Fredi>
+ * IRCClient is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * http://www.gnu.org/licenses/lgpl.html 
+ */
+
+#include "TwitchHype.h"
+
+#include <string.h>
+#include "IRCScan.h"
+
+#if IRC_SCAN_SSE2
+#include <emmintrin.h>
+#endif
+
+void IRCScanBlockScalar(char const* data, size_t size, IRCScanMasks& masks)
+{
+    masks.newline = 0;
+    masks.space = 0;
+
+    for (size_t i = 0; i < size; ++i)
+    {
+        masks.newline |= (unsigned long long)(data[i] == '\n') << i;
+        masks.space |= (unsigned long long)(data[i] == ' ') << i;
+    }
+}
+
+#if IRC_SCAN_SSE2
+
+// Compares 16 bytes at a time, needs all IRC_SCAN_BLOCK bytes to be readable
+static void ScanFullBlock(char const* data, IRCScanMasks& masks)
+{
+    __m128i const newline = _mm_set1_epi8('\n');
+    __m128i const space = _mm_set1_epi8(' ');
+
+    masks.newline = 0;
+    masks.space = 0;
+
+    for (int i = 0; i < IRC_SCAN_BLOCK / 16; ++i)
+    {
+        __m128i bytes = _mm_loadu_si128((__m128i const*)(data + i * 16));
+        masks.newline |= (unsigned long long)(unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, newline)) << (i * 16);
+        masks.space |= (unsigned long long)(unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, space)) << (i * 16);
+    }
+}
+
+void IRCScanBlock(char const* data, size_t size, IRCScanMasks& masks)
+{
+    if (size == IRC_SCAN_BLOCK)
+    {
+        ScanFullBlock(data, masks);
+        return;
+    }
+
+    // Reading past the end could run off the page, a short block is padded with bytes that match nothing
+    char padded[IRC_SCAN_BLOCK];
+    memset(padded, 0, sizeof(padded));
+    memcpy(padded, data, size);
+    ScanFullBlock(padded, masks);
+}
+
+#else
+
+void IRCScanBlock(char const* data, size_t size, IRCScanMasks& masks)
+{
+    IRCScanBlockScalar(data, size, masks);
+}
+
+#endif
+
+void IRCScanBuffer(char const* data, size_t size, IRCScanMasks* masks)
+{
+    for (size_t offset = 0; offset < size; offset += IRC_SCAN_BLOCK)
+        IRCScanBlock(data + offset, FMath::Min<size_t>(size - offset, IRC_SCAN_BLOCK), *masks++);
+}
+
+size_t IRCScanCursor::Next(size_t pos, unsigned long long IRCScanMasks::*mask, bool invert)
+{
+    // Blocks are counted from the start of the buffer, which is _offset before the line
+    size_t end = _offset + _size;
+    for (pos += _offset; pos < end;)
+    {
+        size_t block = pos / IRC_SCAN_BLOCK;
+        IRCScanMasks const* masks = _scanned ? &_scanned[block] : &_masks;
+        if (!_scanned && block != _block)
+        {
+            size_t start = block * IRC_SCAN_BLOCK;
+            IRCScanBlock(_data + start, FMath::Min<size_t>(end - start, IRC_SCAN_BLOCK), _masks);
+            _block = block;
+        }
+
+        // Past the end of the line reads as whatever follows it, or as not a delimiter at the
+        // end of a short block, which the clamp below takes care of either way
+        unsigned long long bits = invert ? ~(masks->*mask) : masks->*mask;
+        bits &= ~0ULL << (pos % IRC_SCAN_BLOCK);
+        if (bits)
+            return FMath::Min<size_t>(block * IRC_SCAN_BLOCK + IRCLowestBit(bits), end) - _offset;
+
+        pos = (block + 1) * IRC_SCAN_BLOCK;
+    }
+
+    return _size;
+}
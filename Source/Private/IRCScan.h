@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2011 Fredi Machado <https://github.com/Fredi>
+ * IRCClient is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * http://www.gnu.org/licenses/lgpl.html 
+ */
+
+#ifndef _IRCSCAN_H
+#define _IRCSCAN_H
+
+#include <stddef.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// SSE2 is part of every x64 target, elsewhere the scalar version does the work
+#if defined(_M_X64) || defined(_M_AMD64) || defined(__SSE2__)
+#define IRC_SCAN_SSE2 1
+#else
+#define IRC_SCAN_SSE2 0
+#endif
+
+// Bytes classified at a time, one bit each in a 64-bit mask
+#define IRC_SCAN_BLOCK 64
+
+// Where the delimiters a line is split on fall in one block, bit i is byte i. ':' and '@'
+// only mean something at the start of a token, so they're checked there and not scanned for.
+struct IRCScanMasks
+{
+    unsigned long long newline;
+    unsigned long long space;
+};
+
+// size is at most IRC_SCAN_BLOCK, bits past it are clear
+void IRCScanBlock(char const* /*data*/, size_t size, IRCScanMasks& /*masks*/);
+// Byte at a time, the fallback and what the benchmark measures the SSE2 version against
+void IRCScanBlockScalar(char const* /*data*/, size_t size, IRCScanMasks& /*masks*/);
+
+// One pass over a whole buffer, masks needs room for (size + IRC_SCAN_BLOCK - 1) / IRC_SCAN_BLOCK blocks
+void IRCScanBuffer(char const* /*data*/, size_t size, IRCScanMasks* /*masks*/);
+
+// Index of the lowest set bit, bits can't be 0
+inline unsigned int IRCLowestBit(unsigned long long bits)
+{
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_AMD64))
+    unsigned long index;
+    _BitScanForward64(&index, bits);
+    return index;
+#elif defined(_MSC_VER)
+    unsigned long index;
+    if (_BitScanForward(&index, (unsigned long)bits))
+        return index;
+    _BitScanForward(&index, (unsigned long)(bits >> 32));
+    return index + 32;
+#else
+    return __builtin_ctzll(bits);
+#endif
+}
+
+// Finds delimiters in a line a block at a time. Each block is classified once however many
+// lookups land in it, and a lookup is a mask and a bit scan rather than a byte loop.
+class IRCScanCursor
+{
+public:
+    IRCScanCursor(char const* data, size_t size) : _data(data), _size(size), _offset(0), _scanned(NULL), _block((size_t)-1) {};
+    // For a line in a buffer IRCScanBuffer already went over, nothing is classified again.
+    // The line starts offset bytes into the buffer, scanned is the buffer's first block.
+    IRCScanCursor(char const* data, size_t size, IRCScanMasks const* scanned, size_t offset) :
+        _data(data), _size(size), _offset(offset), _scanned(scanned), _block((size_t)-1) {};
+
+    // All of them return size when there's nothing more to find
+    size_t NextNewline(size_t pos) { return Next(pos, &IRCScanMasks::newline, false); };
+    size_t NextSpace(size_t pos) { return Next(pos, &IRCScanMasks::space, false); };
+    // First byte at or after pos that isn't a space
+    size_t SkipSpaces(size_t pos) { return Next(pos, &IRCScanMasks::space, true); };
+
+private:
+    size_t Next(size_t pos, unsigned long long IRCScanMasks::*mask, bool invert);
+
+    char const* _data;
+    size_t _size;
+    size_t _offset;
+    IRCScanMasks const* _scanned;
+
+    // Block the masks are for, when there's no _scanned
+    size_t _block;
+    IRCScanMasks _masks;
+};
+
+#endif
@@ -0,0 +1,283 @@
+/*
+ * Copyright (C) 2011 Fredi Machado <https://github.com/Fredi>
+ * IRCClient is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * http://www.gnu.org/licenses/lgpl.html
+ */
+
+#include "TwitchHype.h"
+
+#include "IRCStringView.h"
+#include "IRCSendQueue.h"
+
+// Joins coalesced replies, chat has no line breaks
+static char const IRCReplySeparator[] = " | ";
+static size_t const IRCReplySeparatorLength = sizeof(IRCReplySeparator) - 1;
+
+// Finds the target and where the text starts in "PRIVMSG <target> :<text>"
+static bool ParsePrivMsg(std::string const& line, IRCStringView& target, size_t& textStart)
+{
+    static char const command[] = "PRIVMSG ";
+    static size_t const commandLength = sizeof(command) - 1;
+
+    if (line.compare(0, commandLength, command) != 0)
+        return false;
+
+    size_t targetEnd = line.find(" :", commandLength);
+    if (targetEnd == std::string::npos)
+        return false;
+
+    target = IRCStringView(line.data() + commandLength, targetEnd - commandLength);
+    textStart = targetEnd + 2;
+
+    return true;
+}
+
+void IRCTokenBucket::Configure(int limit, double window, int burst)
+{
+    // At least one token has to come back each window, so the burst leaves room for it
+    burst = FMath::Clamp(burst, 1, FMath::Max(limit - 1, 1));
+
+    _capacity = burst;
+    // Only a limit of 1 needs the Max, it's one line per window then
+    _refillRate = window > 0 ? FMath::Max(limit - burst, 1) / window : 1.0;
+    _tokens = FMath::Min(_tokens, _capacity);
+}
+
+void IRCTokenBucket::Refill(double now)
+{
+    if (_lastRefill < 0)
+    {
+        // Start with a full bucket
+        _tokens = _capacity;
+    }
+    else if (now > _lastRefill)
+    {
+        _tokens = FMath::Min(_capacity, _tokens + (now - _lastRefill) * _refillRate);
+    }
+
+    _lastRefill = now;
+}
+
+IRCSendQueue::IRCSendQueue() : _maxDepth(0)
+{
+    // Twitch defaults for an account that isn't a moderator
+    Configure(20, 30.0, 5, 100);
+}
+
+void IRCSendQueue::Configure(int limit, double window, int burst, size_t maxDepth)
+{
+    _bucket.Configure(limit, window, burst);
+    _maxDepth = maxDepth;
+}
+
+bool IRCSendQueue::Push(IRCStringView line, IRCSendPriority priority, double now)
+{
+    // Control lines are never dropped, they don't count towards the depth limit either
+    if (priority != IRC_PRIORITY_CONTROL && _maxDepth > 0 && Depth() - _queues[IRC_PRIORITY_CONTROL].size() >= _maxDepth)
+    {
+        // Make room by dropping the oldest of the least important lines, unless that's less important than this one
+        int victim = NUM_IRC_PRIORITIES - 1;
+        while (victim > priority && _queues[victim].empty())
+            --victim;
+
+        ++_stats.dropped;
+
+        if (_queues[victim].empty())
+            return false;
+
+        _queues[victim].pop_front();
+    }
+
+    QueuedLine& queued = _queues[priority].push_back();
+    queued.line.assign(line.data(), line.size());
+    queued.queuedTime = now;
+
+    ++_stats.enqueued;
+
+    return true;
+}
+
+void IRCSendQueue::RecordWait(double wait)
+{
+    _stats.averageWait = _stats.sent + _stats.coalesced == 0 ? wait : _stats.averageWait * 0.9 + wait * 0.1;
+    _stats.maxWait = FMath::Max(_stats.maxWait, wait);
+}
+
+bool IRCSendQueue::Pop(std::string& line, double now, IRCSendPriority lowest, IRCTokenBucket* shared, IRCSendPriority* popped)
+{
+    _bucket.Refill(now);
+    if (shared)
+        shared->Refill(now);
+
+    for (int priority = 0; priority <= lowest; ++priority)
+    {
+        IRCSlotRing<QueuedLine>& queue = _queues[priority];
+        if (queue.empty())
+            continue;
+
+        // Twitch's limit is on chat, protocol lines like a reconnect's PASS/NICK/JOIN don't wait for a token
+        bool needsToken = priority != IRC_PRIORITY_CONTROL;
+        if (needsToken && (!_bucket.Available() || (shared && !shared->Available())))
+            return false;
+
+        double queuedTime = queue.front().queuedTime;
+        RecordWait(now - queuedTime);
+        ++_stats.sent;
+
+        line.swap(queue.front().line);
+        queue.pop_front();
+
+        SplitOversized(line, priority, queuedTime);
+        Coalesce(line, priority, lowest, now);
+
+        if (needsToken)
+        {
+            _bucket.Take();
+            if (shared)
+                shared->Take();
+        }
+
+        if (popped)
+            *popped = (IRCSendPriority)priority;
+
+        return true;
+    }
+
+    return false;
+}
+
+void IRCSendQueue::SplitOversized(std::string& line, int priority, double queuedTime)
+{
+    IRCStringView target;
+    size_t textStart;
+    if (line.size() <= IRC_MAX_LINE_LENGTH || !ParsePrivMsg(line, target, textStart) || textStart >= IRC_MAX_LINE_LENGTH)
+        return;
+
+    // Never cut through a multi-byte UTF-8 sequence, the split has to land on a lead byte
+    size_t cut = IRC_MAX_LINE_LENGTH;
+    while (cut > textStart && ((unsigned char)line[cut] & 0xC0) == 0x80)
+        --cut;
+
+    // and a word boundary reads better, if there's one in the back half
+    size_t rest = cut;
+    size_t space = line.rfind(' ', cut);
+    if (space != std::string::npos && space > textStart + (cut - textStart) / 2)
+    {
+        cut = space;
+        rest = space + 1;
+    }
+
+    if (cut <= textStart)
+        return;
+
+    QueuedLine& remainder = _queues[priority].push_front();
+    remainder.line.assign(line, 0, textStart);
+    remainder.line.append(line, rest, std::string::npos);
+    remainder.queuedTime = queuedTime;
+
+    line.resize(cut);
+
+    ++_stats.split;
+}
+
+void IRCSendQueue::Requeue(std::string const& line, IRCSendPriority priority, double now)
+{
+    QueuedLine& queued = _queues[priority].push_front();
+    queued.line = line;
+    queued.queuedTime = now;
+}
+
+void IRCSendQueue::Coalesce(std::string& line, int priority, int lowest, double now)
+{
+    IRCStringView target;
+    size_t textStart;
+    if (!ParsePrivMsg(line, target, textStart))
+        return;
+
+    // Same class and anything less important that may go out, lines within a class keep their order
+    for (; priority <= lowest; ++priority)
+    {
+        IRCSlotRing<QueuedLine>& queue = _queues[priority];
+        for (size_t i = 0; i < queue.size();)
+        {
+            QueuedLine& other = queue[i];
+
+            // Same "PRIVMSG <target> :" up front means same target
+            size_t otherTextStart = textStart;
+            if (other.line.size() < textStart || other.line.compare(0, textStart, line, 0, textStart) != 0)
+            {
+                ++i;
+                continue;
+            }
+
+            if (line.size() + IRCReplySeparatorLength + other.line.size() - otherTextStart > IRC_MAX_LINE_LENGTH)
+                break;
+
+            line.append(IRCReplySeparator, IRCReplySeparatorLength);
+            line.append(other.line, otherTextStart, std::string::npos);
+
+            RecordWait(now - other.queuedTime);
+            ++_stats.coalesced;
+
+            queue.erase(i);
+        }
+    }
+}
+
+void IRCSendQueue::Clear(IRCSendPriority priority)
+{
+    _queues[priority].clear();
+}
+
+void IRCSendQueue::TakeChat(IRCSendPriority priority, std::vector<std::string>& lines)
+{
+    IRCSlotRing<QueuedLine>& queue = _queues[priority];
+    IRCStringView target;
+    size_t textStart;
+
+    // What stays is swapped down over what left, in order
+    size_t kept = 0;
+    for (size_t i = 0; i < queue.size(); ++i)
+    {
+        if (ParsePrivMsg(queue[i].line, target, textStart))
+        {
+            lines.push_back(queue[i].line);
+            continue;
+        }
+
+        if (kept != i)
+            queue[kept].swap(queue[i]);
+        ++kept;
+    }
+
+    while (queue.size() > kept)
+        queue.pop_back();
+}
+
+size_t IRCSendQueue::Depth() const
+{
+    size_t depth = 0;
+    for (int priority = 0; priority < NUM_IRC_PRIORITIES; ++priority)
+        depth += _queues[priority].size();
+
+    return depth;
+}
+
+double IRCSendQueue::OldestWait(double now) const
+{
+    double oldest = 0;
+    for (int priority = 0; priority < NUM_IRC_PRIORITIES; ++priority)
+        if (!_queues[priority].empty())
+            oldest = FMath::Max(oldest, now - _queues[priority].front().queuedTime);
+
+    return oldest;
+}
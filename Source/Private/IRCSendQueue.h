@@ -0,0 +1,146 @@
+/*
+ * Copyright (C) 2011 Fredi Machado <https://github.com/Fredi>
+ * IRCClient is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * http://www.gnu.org/licenses/lgpl.html
+ */
+
+#ifndef _IRCSENDQUEUE_H
+#define _IRCSENDQUEUE_H
+
+#include <string>
+#include <utility>
+#include <vector>
+#include "IRCStringView.h"
+#include "IRCSlotRing.h"
+
+// 512 bytes with the CR LF
+#define IRC_MAX_LINE_LENGTH 510
+
+// Lower value goes out first
+enum IRCSendPriority
+{
+    IRC_PRIORITY_CONTROL,       // PASS/NICK/JOIN/PONG, the connection dies without these
+    IRC_PRIORITY_ANNOUNCEMENT,  // match state and bet settlements
+    IRC_PRIORITY_REPLY,         // answers to a single viewer's command
+    IRC_PRIORITY_CONFIRMATION,  // bet confirmations, first to be dropped
+
+    NUM_IRC_PRIORITIES
+};
+
+struct IRCSendQueueStats
+{
+    IRCSendQueueStats() : enqueued(0), sent(0), dropped(0), coalesced(0), split(0), averageWait(0), maxWait(0) {};
+
+    unsigned long long enqueued;
+    unsigned long long sent;
+    unsigned long long dropped;
+
+    // Lines that rode along in another line's PRIVMSG, and extra lines made by splitting long ones
+    unsigned long long coalesced;
+    unsigned long long split;
+
+    // Seconds between SendIRC and the line actually going out
+    double averageWait;
+    double maxWait;
+};
+
+// Holds up to `burst` tokens, at most limit - 1, and refills at (limit - burst) / window,
+// so no sliding window of that length can ever see more than `limit` takes.
+class IRCTokenBucket
+{
+public:
+    IRCTokenBucket() : _tokens(0), _capacity(0), _refillRate(0), _lastRefill(-1) {};
+
+    void Configure(int limit, double window, int burst);
+
+    void Refill(double now);
+    bool Available() const { return _tokens >= 1.0; };
+    void Take() { _tokens -= 1.0; };
+
+private:
+    double _tokens;
+    double _capacity;
+    double _refillRate;
+    double _lastRefill;
+};
+
+// Outbound lines wait here until the token bucket lets them through.
+// Control lines skip the bucket, the limit only counts chat.
+class IRCSendQueue
+{
+public:
+    IRCSendQueue();
+
+    void Configure(int limit, double window, int burst, size_t maxDepth);
+
+    // The line is copied into a slot's buffer left over from an earlier line, so once the
+    // queue has seen a busy moment this doesn't allocate. Returns false if the line was
+    // dropped because the queue is full of more important lines.
+    bool Push(IRCStringView line, IRCSendPriority priority, double now);
+
+    // Hands out the most important waiting line if there's a token for it, by swapping
+    // buffers with line, so the caller should hang on to line between calls. A PRIVMSG
+    // also picks up every other waiting PRIVMSG to the same target that still fits.
+    // Classes less important than `lowest` are left waiting. With a shared bucket, chat
+    // needs a token from it as well as from this queue's own. The line's class goes in
+    // popped, for a Requeue if it can't be sent after all.
+    bool Pop(std::string& line, double now, IRCSendPriority lowest = IRC_PRIORITY_CONFIRMATION, IRCTokenBucket* shared = NULL, IRCSendPriority* popped = NULL);
+
+    // Puts a line that was handed out but never made it to the server back at the front of its class
+    void Requeue(std::string const& line, IRCSendPriority priority, double now);
+
+    void Clear(IRCSendPriority priority);
+
+    // Moves every PRIVMSG of a class out, oldest first, so they can be queued somewhere else.
+    // Other lines belong to this connection and keep their place.
+    void TakeChat(IRCSendPriority priority, std::vector<std::string>& lines);
+
+    size_t Depth() const;
+    size_t Depth(IRCSendPriority priority) const { return _queues[priority].size(); };
+
+    // How long the line at the front of the longest waiting class has been queued
+    double OldestWait(double now) const;
+
+    IRCSendQueueStats const& Stats() const { return _stats; };
+
+    IRCTokenBucket& Bucket() { return _bucket; };
+
+private:
+    void RecordWait(double wait);
+
+    void SplitOversized(std::string& line, int priority, double queuedTime);
+    void Coalesce(std::string& line, int priority, int lowest, double now);
+
+    struct QueuedLine
+    {
+        QueuedLine() : queuedTime(0) {};
+
+        void swap(QueuedLine& other)
+        {
+            line.swap(other.line);
+            std::swap(queuedTime, other.queuedTime);
+        };
+
+        std::string line;
+        double queuedTime;
+    };
+
+    IRCSlotRing<QueuedLine> _queues[NUM_IRC_PRIORITIES];
+
+    IRCTokenBucket _bucket;
+
+    size_t _maxDepth;
+
+    IRCSendQueueStats _stats;
+};
+
+#endif
@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2011 Fredi Machado <https://github.com/Fredi>
+ * IRCClient is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * http://www.gnu.org/licenses/lgpl.html 
+ */
+
+#ifndef _IRCSLOTRING_H
+#define _IRCSLOTRING_H
+
+#include <vector>
+
+// Double ended queue over a power of two array of slots. Popping a slot doesn't destroy
+// it, whatever it owns (a string's buffer) is still there for the next push to reuse, so
+// a steady stream of lines allocates nothing once the ring has grown to fit it.
+// T needs a swap member, slots are only ever moved around by swapping.
+template <typename T>
+class IRCSlotRing
+{
+public:
+    IRCSlotRing() : _head(0), _count(0) {};
+
+    size_t size() const { return _count; };
+    bool empty() const { return _count == 0; };
+
+    T& operator[](size_t index) { return _slots[(_head + index) & (_slots.size() - 1)]; };
+    T const& operator[](size_t index) const { return _slots[(_head + index) & (_slots.size() - 1)]; };
+
+    T& front() { return (*this)[0]; };
+    T const& front() const { return (*this)[0]; };
+    T& back() { return (*this)[_count - 1]; };
+
+    // Both hand back the new slot as the last user left it, fill in every field
+    T& push_back()
+    {
+        Grow();
+        ++_count;
+        return back();
+    };
+
+    T& push_front()
+    {
+        Grow();
+        _head = (_head - 1) & (_slots.size() - 1);
+        ++_count;
+        return front();
+    };
+
+    void pop_front()
+    {
+        _head = (_head + 1) & (_slots.size() - 1);
+        --_count;
+    };
+
+    void pop_back() { --_count; };
+
+    // Later slots shift down one, the erased slot ends up just past the back
+    void erase(size_t index)
+    {
+        for (size_t i = index; i + 1 < _count; ++i)
+            (*this)[i].swap((*this)[i + 1]);
+        --_count;
+    };
+
+    void clear() { _count = 0; };
+
+private:
+    void Grow()
+    {
+        if (_count < _slots.size())
+            return;
+
+        std::vector<T> slots(_slots.empty() ? 8 : _slots.size() * 2);
+        for (size_t i = 0; i < _count; ++i)
+            slots[i].swap((*this)[i]);
+
+        _slots.swap(slots);
+        _head = 0;
+    };
+
+    std::vector<T> _slots;
+    size_t _head;
+    size_t _count;
+};
+
+#endif
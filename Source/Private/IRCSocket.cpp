@@ -16,10 +16,80 @@
 #include "TwitchHype.h"
 
 #include <cstring>
+#include <cstdio>
+#include <atomic>
 #include <fcntl.h>
 #include "IRCSocket.h"
 
-#define MAXDATASIZE 4096
+#define RECVBUFFERSIZE 4096
+#define MAXRECVBUFFERSIZE (1024 * 1024)
+
+// Output buffer limit, past that QueueLine pushes back
+#define MAXSENDBUFFERSIZE (64 * 1024)
+
+// Lines per gathered write, each one takes two buffers (text and CR LF)
+#define MAXSENDLINES 32
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+static char const CRLF[] = "\r\n";
+
+#ifdef _WIN32
+typedef WSABUF SendBuffer;
+
+static void SetSendBuffer(SendBuffer& buffer, char const* data, size_t length)
+{
+    buffer.buf = (CHAR*)data;
+    buffer.len = (ULONG)length;
+}
+#else
+typedef iovec SendBuffer;
+
+static void SetSendBuffer(SendBuffer& buffer, char const* data, size_t length)
+{
+    buffer.iov_base = (void*)data;
+    buffer.iov_len = length;
+}
+#endif
+
+// How long an attempt gets before the next address is raced against it
+#define CONNECTATTEMPTDELAY 0.25
+
+// getaddrinfo blocks for as long as it likes and can't be interrupted, so it runs on a
+// thread of its own. Deleting one waits for that thread to finish.
+class IRCResolver : public FRunnable
+{
+public:
+    IRCResolver(std::string const& host, std::string const& service) : done(false), error(0), _host(host), _service(service), _thread(NULL) {};
+    virtual ~IRCResolver();
+
+    bool Start();
+
+    // FRunnable
+    virtual uint32 Run() override;
+
+    // Everything below is the thread's until done is set
+    std::atomic<bool> done;
+    int error;
+    std::vector<sockaddr_storage> addresses;
+    std::vector<int> addressLengths;
+
+private:
+    std::string _host;
+    std::string _service;
+    FRunnableThread* _thread;
+};
+
+static bool WouldBlock()
+{
+#ifdef _WIN32
+    return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+    return errno == EAGAIN || errno == EWOULDBLOCK;
+#endif
+}
 
 bool IRCSocket::Init()
 {
@@ -32,91 +102,223 @@ bool IRCSocket::Init()
     }
     #endif
 
-    if ((_socket = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP)) == INVALID_SOCKET)
-	{
-		UE_LOG(LogUTTwitchHype, Warning, TEXT("Socket error."));
-        #ifdef _WIN32
-        WSACleanup();
-        #endif
-        return false;
-    }
+    ResetReceiveBuffer();
 
-    int on = 1;
-    if (setsockopt(_socket, SOL_SOCKET, SO_REUSEADDR, (char const*)&on, sizeof(on)) == -1)
-	{
-		UE_LOG(LogUTTwitchHype, Warning, TEXT("Invalid socket."));
-        #ifdef _WIN32
-        WSACleanup();
-        #endif
-        return false;
-    }
+    return true;
+}
+
+int IRCSocket::OpenSocket(int family)
+{
+    int s = socket(family, SOCK_STREAM, IPPROTO_TCP);
+    if (s == INVALID_SOCKET)
+        return INVALID_SOCKET;
 
     #ifdef _WIN32
     u_long mode = 1;
-    ioctlsocket(_socket, FIONBIO, &mode);
+    ioctlsocket(s, FIONBIO, &mode);
     #else
-    fcntl(_socket, F_SETFL, O_NONBLOCK);
-    fcntl(_socket, F_SETFL, O_ASYNC);
+    fcntl(s, F_SETFL, fcntl(s, F_GETFL, 0) | O_NONBLOCK);
     #endif
 
-    return true;
+    // Chat lines are tiny and latency matters more than packet count
+    int noDelay = _noDelay ? 1 : 0;
+    setsockopt(s, IPPROTO_TCP, TCP_NODELAY, (char const*)&noDelay, sizeof(noDelay));
+
+    if (_sendBufferSize > 0)
+        setsockopt(s, SOL_SOCKET, SO_SNDBUF, (char const*)&_sendBufferSize, sizeof(_sendBufferSize));
+
+    return s;
 }
 
-bool IRCSocket::Connect(char const* host, int port)
+IRCResolver::~IRCResolver()
 {
-    hostent* he;
-	he = gethostbyname(host);
-    if (!he)
-	{
-		UE_LOG(LogUTTwitchHype, Warning, TEXT("Could not resolve host: %s"), ANSI_TO_TCHAR(host));
-        #ifdef _WIN32
-        WSACleanup();
-        #endif
+    if (_thread)
+    {
+        _thread->WaitForCompletion();
+        delete _thread;
+    }
+}
+
+bool IRCResolver::Start()
+{
+    _thread = FRunnableThread::Create(this, TEXT("IRCResolver"), 0, TPri_BelowNormal);
+    return _thread != NULL;
+}
+
+uint32 IRCResolver::Run()
+{
+    addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_protocol = IPPROTO_TCP;
+
+    addrinfo* results = NULL;
+    error = getaddrinfo(_host.c_str(), _service.c_str(), &hints, &results);
+
+    if (error == 0)
+    {
+        // getaddrinfo already sorted by preference, interleave the families
+        // starting with whichever it liked best (RFC 8305 section 4)
+        std::vector<addrinfo*> preferred;
+        std::vector<addrinfo*> other;
+        for (addrinfo* result = results; result; result = result->ai_next)
+        {
+            if (result->ai_family != AF_INET && result->ai_family != AF_INET6)
+                continue;
+            (result->ai_family == results->ai_family ? preferred : other).push_back(result);
+        }
+
+        for (size_t i = 0; i < preferred.size() || i < other.size(); ++i)
+        {
+            addrinfo* pair[2] = { i < preferred.size() ? preferred[i] : NULL, i < other.size() ? other[i] : NULL };
+            for (int j = 0; j < 2; ++j)
+            {
+                if (!pair[j])
+                    continue;
+
+                sockaddr_storage address;
+                memset(&address, 0, sizeof(address));
+                memcpy(&address, pair[j]->ai_addr, pair[j]->ai_addrlen);
+                addresses.push_back(address);
+                addressLengths.push_back((int)pair[j]->ai_addrlen);
+            }
+        }
+
+        freeaddrinfo(results);
+    }
+
+    done.store(true, std::memory_order_release);
+    return 0;
+}
+
+IRCSocket::~IRCSocket()
+{
+    Disconnect();
+
+    // Waits for resolves still running, none of them outlives the socket
+    for (size_t i = 0; i < _abandoned.size(); ++i)
+        delete _abandoned[i];
+}
+
+void IRCSocket::AbandonResolve()
+{
+    if (!_resolve)
+        return;
+
+    // Kept until it finishes rather than waited for here, the game thread would block on it
+    if (_resolve->done.load(std::memory_order_acquire))
+        delete _resolve;
+    else
+        _abandoned.push_back(_resolve);
+    _resolve = NULL;
+}
+
+void IRCSocket::ReapResolves()
+{
+    for (size_t i = 0; i < _abandoned.size();)
+    {
+        if (_abandoned[i]->done.load(std::memory_order_acquire))
+        {
+            delete _abandoned[i];
+            _abandoned.erase(_abandoned.begin() + i);
+        }
+        else
+            ++i;
+    }
+}
+
+bool IRCSocket::Connect(char const* host, int port, double timeout)
+{
+    if (_connected || _connecting)
+        return false;
+
+    double now = FPlatformTime::Seconds();
+
+    _host = host;
+    _connectDeadline = now + timeout;
+    _lastAttemptTime = 0;
+    _addresses.clear();
+    _addressLengths.clear();
+    _nextAddress = 0;
+    _socket = INVALID_SOCKET;
+
+    char service[16];
+    snprintf(service, sizeof(service), "%d", port);
+
+    ReapResolves();
+
+    _resolve = new IRCResolver(_host, service);
+    if (!_resolve->Start())
+    {
+		UE_LOG(LogUTTwitchHype, Warning, TEXT("Could not start a thread to resolve host: %s"), ANSI_TO_TCHAR(_host.c_str()));
+        delete _resolve;
+        _resolve = NULL;
         return false;
     }
 
-    sockaddr_in addr;
+    _connecting = true;
+    _connected = true;
 
-    addr.sin_family = AF_INET;
-    addr.sin_port = htons(port);
-    addr.sin_addr = *((const in_addr*)he->h_addr);
-    memset(&(addr.sin_zero), '\0', 8);
+    return true;
+}
 
+void IRCSocket::StartConnectAttempt(double now)
+{
+    while (_nextAddress < _addresses.size())
+    {
+        sockaddr_storage const& address = _addresses[_nextAddress];
+        int addressLength = _addressLengths[_nextAddress];
+        ++_nextAddress;
 
-    if (connect(_socket, (sockaddr*)&addr, sizeof(addr)) == SOCKET_ERROR)
-	{
-#ifdef _WIN32
-		int error = WSAGetLastError();
-#else
-		int error = errno;
-#endif
+        int s = OpenSocket(address.ss_family);
+        if (s == INVALID_SOCKET)
+            continue;
 
+        if (connect(s, (sockaddr const*)&address, addressLength) == SOCKET_ERROR)
+        {
 #ifdef _WIN32
-		if (error == WSAEWOULDBLOCK)
+            int error = WSAGetLastError();
+            if (error != WSAEWOULDBLOCK)
 #else
-		if (error == EINPROGRESS)
-#endif
-		{
-			_connecting = true;
-		}
-		else
-		{
-			UE_LOG(LogUTTwitchHype, Warning, TEXT("Could not connect to: %s"), ANSI_TO_TCHAR(host));
-#ifdef _WIN32
+            int error = errno;
+            if (error != EINPROGRESS)
 #endif
-			closesocket(_socket);
-			return false;
-		}
+            {
+                closesocket(s);
+                continue;
+            }
+        }
+
+        // Even an immediate success is picked up by the next CheckConnected
+        _attempts.push_back(s);
+        _lastAttemptTime = now;
+        return;
     }
+}
 
-    _connected = true;
+void IRCSocket::CloseConnectAttempts()
+{
+    for (size_t i = 0; i < _attempts.size(); ++i)
+        closesocket(_attempts[i]);
+    _attempts.clear();
+}
 
-    return true;
+void IRCSocket::FailConnect()
+{
+    CloseConnectAttempts();
+    AbandonResolve();
+    _connecting = false;
+    _connected = false;
 }
 
 void IRCSocket::Disconnect()
 {
-    if (_connected)
+    if (_connecting)
+    {
+        FailConnect();
+    }
+    else if (_connected)
     {
         #ifdef _WIN32
         shutdown(_socket, 2);
@@ -124,60 +326,385 @@ void IRCSocket::Disconnect()
         closesocket(_socket);
         _connected = false;
     }
-	_connecting = false;
+
+    _socket = INVALID_SOCKET;
+
+    ResetReceiveBuffer();
+    ResetSendBuffer();
 }
 
-bool IRCSocket::SendData(char const* data)
+void IRCSocket::ResetSendBuffer()
 {
-    if (_connected)
-        if (send(_socket, data, strlen(data), 0) == -1)
+    _sendBuffer.clear();
+    _sendLines.clear();
+    _sendIndex = 0;
+    _sendProgress = 0;
+}
+
+void IRCSocket::TakeUnsentLines(std::vector<IRCUnsentLine>& lines) const
+{
+    for (size_t i = _sendIndex; i < _sendLines.size(); ++i)
+    {
+        IRCUnsentLine unsent;
+        unsent.line.assign(_sendBuffer.data() + _sendLines[i].offset, _sendLines[i].length);
+        unsent.priority = _sendLines[i].priority;
+        lines.push_back(unsent);
+    }
+}
+
+void IRCSocket::CompactSendBuffer()
+{
+    if (_sendIndex == 0)
+        return;
+
+    if (_sendIndex == _sendLines.size())
+    {
+        // Keeps the capacity, steady state never allocates
+        ResetSendBuffer();
+        return;
+    }
+
+    size_t first = _sendLines[_sendIndex].offset;
+    _sendBuffer.erase(_sendBuffer.begin(), _sendBuffer.begin() + first);
+    _sendLines.erase(_sendLines.begin(), _sendLines.begin() + _sendIndex);
+    for (size_t i = 0; i < _sendLines.size(); ++i)
+        _sendLines[i].offset -= first;
+    _sendIndex = 0;
+}
+
+bool IRCSocket::QueueLine(IRCStringView line, int priority)
+{
+    CompactSendBuffer();
+
+    if (_sendBuffer.size() + line.size() > MAXSENDBUFFERSIZE)
+        return false;
+
+    SendLine sendLine;
+    sendLine.offset = _sendBuffer.size();
+    sendLine.length = line.size();
+    sendLine.priority = priority;
+    _sendBuffer.insert(_sendBuffer.end(), line.begin(), line.end());
+    _sendLines.push_back(sendLine);
+
+    return true;
+}
+
+bool IRCSocket::FlushSendBuffer()
+{
+    if (!_connected || _connecting)
+        return true;
+
+    while (HasPendingSend())
+    {
+        // Gather the text and the shared CR LF of as many lines as fit, skipping what
+        // a short write already got out
+        SendBuffer buffers[MAXSENDLINES * 2];
+        int count = 0;
+        for (size_t i = _sendIndex; i < _sendLines.size() && count < MAXSENDLINES * 2; ++i)
+        {
+            SendLine const& line = _sendLines[i];
+            size_t skip = i == _sendIndex ? _sendProgress : 0;
+
+            if (skip < line.length)
+                SetSendBuffer(buffers[count++], &_sendBuffer[line.offset + skip], line.length - skip);
+
+            size_t crlfSkip = skip > line.length ? skip - line.length : 0;
+            SetSendBuffer(buffers[count++], CRLF + crlfSkip, 2 - crlfSkip);
+        }
+
+        #ifdef _WIN32
+        DWORD sent = 0;
+        int result = WSASend(_socket, buffers, count, &sent, 0, NULL, NULL) == 0 ? (int)sent : SOCKET_ERROR;
+        #else
+        msghdr message;
+        memset(&message, 0, sizeof(message));
+        message.msg_iov = buffers;
+        message.msg_iovlen = count;
+        int result = (int)sendmsg(_socket, &message, MSG_NOSIGNAL);
+        #endif
+
+        if (result == SOCKET_ERROR)
+        {
+            if (WouldBlock())
+                return true;
+
+            UE_LOG(LogUTTwitchHype, Warning, TEXT("send failed!"));
             return false;
+        }
+
+        // Advance past everything that went out, possibly stopping partway into a line
+        size_t written = result;
+        while (written > 0 && _sendIndex < _sendLines.size())
+        {
+            size_t remaining = _sendLines[_sendIndex].length + 2 - _sendProgress;
+            if (written < remaining)
+            {
+                _sendProgress += written;
+                break;
+            }
+
+            written -= remaining;
+            ++_sendIndex;
+            _sendProgress = 0;
+        }
+    }
+
+    CompactSendBuffer();
 
     return true;
 }
 
-std::string IRCSocket::ReceiveData()
+void IRCSocket::ResetReceiveBuffer()
 {
-	if (_connecting)
-	{
+    if (_recvBuffer.empty())
+        _recvBuffer.resize(RECVBUFFERSIZE);
 
-	}
-    char buffer[MAXDATASIZE];
+    _recvStart = 0;
+    _recvEnd = 0;
+    _recvScan = 0;
+    _recvMasked = 0;
+}
 
-    memset(buffer, 0, MAXDATASIZE);
+bool IRCSocket::ReserveReceiveSpace()
+{
+    if (_recvEnd < _recvBuffer.size())
+        return true;
 
-    int bytes = recv(_socket, buffer, MAXDATASIZE - 1, 0);
+    // Lines are never allowed to wrap, so rather than writing around the end of
+    // the buffer the unconsumed partial line is moved back to the front.
+    if (_recvStart > 0)
+    {
+        size_t pending = _recvEnd - _recvStart;
+        memmove(&_recvBuffer[0], &_recvBuffer[_recvStart], pending);
+        _recvScan -= _recvStart;
+        _recvStart = 0;
+        _recvEnd = pending;
+        // The blocks moved, the partial line is classified again along with what follows it
+        _recvMasked = 0;
 
-	if (bytes > 0)
-	{
-		return std::string(buffer);
-	}
+        // Only worth it if it freed a decent chunk, otherwise grow as well
+        if (_recvBuffer.size() - _recvEnd >= RECVBUFFERSIZE / 2)
+            return true;
+    }
+
+    if (_recvBuffer.size() >= MAXRECVBUFFERSIZE)
+    {
+        if (_recvEnd < _recvBuffer.size())
+            return true;
+
+        // Full of complete lines nobody has taken yet, they're left in the kernel's buffer until
+        // some are. Everything before _recvScan is known to have no terminator in it
+        if (_recvScan < _recvEnd && memchr(&_recvBuffer[_recvScan], '\n', _recvEnd - _recvScan) != NULL)
+            return false;
+
+        // A single "line" filled the whole buffer, it's garbage
+        UE_LOG(LogUTTwitchHype, Warning, TEXT("Discarding oversized line from server."));
+        ResetReceiveBuffer();
+        return true;
+    }
+
+    _recvBuffer.resize(FMath::Min<size_t>(_recvBuffer.size() * 2, MAXRECVBUFFERSIZE));
+    return true;
+}
+
+bool IRCSocket::ReceiveData()
+{
+    if (!_connected || _connecting)
+        return true;
+
+    // Everything handed out has been consumed, rewind for free
+    if (_recvStart == _recvEnd)
+    {
+        _recvStart = 0;
+        _recvEnd = 0;
+        _recvScan = 0;
+        _recvMasked = 0;
+    }
 
-    return "";
+    // Running out of room isn't an error, what's left is read once lines have been taken
+    while (ReserveReceiveSpace())
+    {
+        int bytes = recv(_socket, &_recvBuffer[_recvEnd], (int)(_recvBuffer.size() - _recvEnd), 0);
+
+        if (bytes > 0)
+        {
+            _recvEnd += bytes;
+        }
+        else if (bytes == 0)
+        {
+            UE_LOG(LogUTTwitchHype, Warning, TEXT("Connection closed by server."));
+            return false;
+        }
+        else if (WouldBlock())
+        {
+            break;
+        }
+        else
+        {
+            UE_LOG(LogUTTwitchHype, Warning, TEXT("recv failed!"));
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool IRCSocket::NextLine(IRCStringView& line)
+{
+    if (_recvScan >= _recvEnd)
+        return false;
+
+    char const* begin = &_recvBuffer[0];
+
+    // Picks up at the start of the block the last pass stopped in, that one may have grown
+    if (_recvMasked < _recvEnd)
+    {
+        size_t first = _recvMasked / IRC_SCAN_BLOCK;
+        _recvMasks.resize((_recvBuffer.size() + IRC_SCAN_BLOCK - 1) / IRC_SCAN_BLOCK);
+        IRCScanBuffer(begin + first * IRC_SCAN_BLOCK, _recvEnd - first * IRC_SCAN_BLOCK, &_recvMasks[first]);
+        _recvMasked = _recvEnd;
+    }
+
+    size_t lineEnd = _recvEnd;
+    for (size_t pos = _recvScan; pos < _recvEnd;)
+    {
+        size_t block = pos / IRC_SCAN_BLOCK;
+        unsigned long long newlines = _recvMasks[block].newline & (~0ULL << (pos % IRC_SCAN_BLOCK));
+        if (newlines)
+        {
+            lineEnd = block * IRC_SCAN_BLOCK + IRCLowestBit(newlines);
+            break;
+        }
+        pos = (block + 1) * IRC_SCAN_BLOCK;
+    }
+
+    if (lineEnd == _recvEnd)
+    {
+        // Partial line, wait for the rest of it to arrive
+        _recvScan = _recvEnd;
+        return false;
+    }
+
+    size_t length = lineEnd - _recvStart;
+    if (length > 0 && begin[lineEnd - 1] == '\r')
+        --length;
+
+    line = IRCStringView(begin + _recvStart, length);
+
+    _recvStart = lineEnd + 1;
+    _recvScan = _recvStart;
+
+    return true;
 }
 
 void IRCSocket::CheckConnected()
 {
-	if (_connecting)
-	{
-		fd_set myset;
-		struct timeval tv;      
+	if (!_connecting)
+        return;
+
+    double now = FPlatformTime::Seconds();
+
+    ReapResolves();
+
+    if (_resolve)
+    {
+        if (!_resolve->done.load(std::memory_order_acquire))
+        {
+            if (now > _connectDeadline)
+            {
+                UE_LOG(LogUTTwitchHype, Warning, TEXT("Timed out resolving host: %s"), ANSI_TO_TCHAR(_host.c_str()));
+                FailConnect();
+            }
+            return;
+        }
+
+        if (_resolve->error != 0 || _resolve->addresses.empty())
+        {
+            UE_LOG(LogUTTwitchHype, Warning, TEXT("Could not resolve host: %s"), ANSI_TO_TCHAR(_host.c_str()));
+            FailConnect();
+            return;
+        }
+
+        _addresses.swap(_resolve->addresses);
+        _addressLengths.swap(_resolve->addressLengths);
+        delete _resolve;
+        _resolve = NULL;
+
+        StartConnectAttempt(now);
+    }
+
+    if (!_attempts.empty())
+    {
+        // Zero timeout, this only asks whether any attempt has finished.
+        // Windows reports a refused connect through the except set.
+        fd_set writeSet;
+        fd_set exceptSet;
+        FD_ZERO(&writeSet);
+        FD_ZERO(&exceptSet);
+
+        int maxSocket = 0;
+        for (size_t i = 0; i < _attempts.size(); ++i)
+        {
+            FD_SET(_attempts[i], &writeSet);
+            FD_SET(_attempts[i], &exceptSet);
+            maxSocket = FMath::Max(maxSocket, _attempts[i]);
+        }
+
+		struct timeval tv;
 		tv.tv_sec = 0;
-		tv.tv_usec = 500; 
-		FD_ZERO(&myset);
-		FD_SET(_socket, &myset);
-		int retval = select(_socket + 1, NULL, &myset, NULL, &tv);
-		if (retval > 0)
-		{
-			_connecting = false;
-		}
-		else if (retval == SOCKET_ERROR)
+		tv.tv_usec = 0;
+		int retval = select(maxSocket + 1, NULL, &writeSet, &exceptSet, &tv);
+		if (retval == SOCKET_ERROR)
 		{
-			// print the error here
 			UE_LOG(LogUTTwitchHype, Warning, TEXT("select failed!"));
-
-			_connecting = false;
-			_connected = false;
+            FailConnect();
+            return;
 		}
-	}
-}
\ No newline at end of file
+
+        for (size_t i = 0; retval > 0 && i < _attempts.size();)
+        {
+            int s = _attempts[i];
+            if (!FD_ISSET(s, &writeSet) && !FD_ISSET(s, &exceptSet))
+            {
+                ++i;
+                continue;
+            }
+
+            int error = 0;
+            socklen_t length = sizeof(error);
+            if (getsockopt(s, SOL_SOCKET, SO_ERROR, (char*)&error, &length) == 0 && error == 0)
+            {
+                // First one through wins, the rest are dropped
+                _attempts.erase(_attempts.begin() + i);
+                CloseConnectAttempts();
+
+                _socket = s;
+                _connecting = false;
+                ResetReceiveBuffer();
+                ResetSendBuffer();
+                return;
+            }
+
+            closesocket(s);
+            _attempts.erase(_attempts.begin() + i);
+
+            // Nothing left to wait for on that one, try the next address right away
+            _lastAttemptTime = 0;
+        }
+    }
+
+    // Race the next address if the current ones are taking too long (RFC 8305 connection attempt delay)
+    if (_nextAddress < _addresses.size() && (_attempts.empty() || now - _lastAttemptTime >= CONNECTATTEMPTDELAY))
+        StartConnectAttempt(now);
+
+    if (_attempts.empty())
+    {
+        UE_LOG(LogUTTwitchHype, Warning, TEXT("Could not connect to: %s"), ANSI_TO_TCHAR(_host.c_str()));
+        FailConnect();
+    }
+    else if (now > _connectDeadline)
+    {
+        UE_LOG(LogUTTwitchHype, Warning, TEXT("Timed out connecting to: %s"), ANSI_TO_TCHAR(_host.c_str()));
+        FailConnect();
+    }
+}
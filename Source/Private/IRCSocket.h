@@ -18,46 +18,153 @@
 
 #include <iostream>
 #include <sstream>
+#include <string>
+#include <vector>
+#include "IRCStringView.h"
+#include "IRCScan.h"
 
 #ifdef _WIN32
 #include "AllowWindowsPlatformTypes.h"
 #include <winsock2.h>
+#include <ws2tcpip.h>
 #else
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <netdb.h>
+#include <unistd.h>
 #define closesocket(s) close(s)
-#define close(s)
 #define SOCKET_ERROR -1
 #define INVALID_SOCKET -1
 #endif
 
+class IRCResolver;
+
+// A line handed back from an output buffer it never left, with the priority it was queued with
+struct IRCUnsentLine
+{
+    std::string line;
+    int priority;
+};
+
 class IRCSocket
 {
 public:
-	IRCSocket() : _connected(false), _connecting(false)
+	IRCSocket() : _socket(INVALID_SOCKET), _connected(false), _connecting(false), _noDelay(true), _sendBufferSize(0), _recvStart(0), _recvEnd(0), _recvScan(0), _recvMasked(0), _sendIndex(0), _sendProgress(0), _resolve(NULL), _nextAddress(0), _connectDeadline(0), _lastAttemptTime(0)
 	{
 
 	}
+    ~IRCSocket();
 
     bool Init();
 
-    bool Connect(char const* host, int port);
+    // Applied to every socket opened by Connect, a send buffer size of 0 leaves the OS default
+    void SetOptions(bool noDelay, int sendBufferSize) { _noDelay = noDelay; _sendBufferSize = sendBufferSize; };
+
+    // Resolves host off the game thread and then races a connect to each address it
+    // got back, IPv6 and IPv4 interleaved. CheckConnected drives it from there on.
+    bool Connect(char const* host, int port, double timeout);
     void Disconnect();
 
 	bool Connected() { return _connected; };
 	bool Connecting() { return _connecting; };
+
+    // Never blocks, just looks at how the resolve and the connect attempts are doing
 	void CheckConnected();
 
-    bool SendData(char const* data);
-    std::string ReceiveData();
+    int Handle() const { return _socket; };
+
+    // Copies a line into the output buffer, the CR LF is added on the way out.
+    // Returns false if the output buffer is full, nothing is written until FlushSendBuffer.
+    // priority is only kept for TakeUnsentLines.
+    bool QueueLine(IRCStringView line, int priority = 0);
+
+    // Writes as much of the output buffer as the socket takes without blocking, picking
+    // up where a short write left off. Returns false if the socket failed.
+    bool FlushSendBuffer();
+
+    bool HasPendingSend() const { return _sendIndex < _sendLines.size(); };
+
+    // Appends every line still waiting in the output buffer, a partly written one included
+    void TakeUnsentLines(std::vector<IRCUnsentLine>& lines) const;
+
+    // Drains the socket into the receive buffer until it would block.
+    // Returns false if the server closed the connection or the socket failed.
+    bool ReceiveData();
+
+    // Hands out the next complete line (without its CR/LF) from the receive buffer.
+    // The view stays valid until the next call to ReceiveData or Disconnect.
+    bool NextLine(IRCStringView& line);
+
+    // Finds delimiters in a line NextLine handed out with the masks it was split with
+    IRCScanCursor LineScan(IRCStringView line) const
+    {
+        return IRCScanCursor(line.data(), line.size(), &_recvMasks[0], line.data() - &_recvBuffer[0]);
+    };
 
 private:
+    void ResetReceiveBuffer();
+    bool ReserveReceiveSpace();
+
+    void ResetSendBuffer();
+    void CompactSendBuffer();
+
+    int OpenSocket(int family);
+    void StartConnectAttempt(double now);
+    void CloseConnectAttempts();
+    void FailConnect();
+    void AbandonResolve();
+    // Deletes abandoned resolves that have finished since
+    void ReapResolves();
+
     int _socket;
 
 	bool _connected;
 	bool _connecting;
+
+    bool _noDelay;
+    int _sendBufferSize;
+
+    // Receive ring: bytes in [_recvStart, _recvEnd) are unconsumed, and everything
+    // before _recvScan is known not to contain a line terminator.
+    std::vector<char> _recvBuffer;
+    size_t _recvStart;
+    size_t _recvEnd;
+    size_t _recvScan;
+
+    // Newline and space masks for every block of _recvBuffer before _recvMasked, filled
+    // in one pass over whatever arrived since the last NextLine
+    std::vector<IRCScanMasks> _recvMasks;
+    size_t _recvMasked;
+
+    // Output buffer: queued lines live back to back in _sendBuffer and go out through
+    // one gathered write. _sendProgress counts the bytes of line _sendIndex (CR LF included)
+    // already written.
+    struct SendLine
+    {
+        size_t offset;
+        size_t length;
+        int priority;
+    };
+    std::vector<char> _sendBuffer;
+    std::vector<SendLine> _sendLines;
+    size_t _sendIndex;
+    size_t _sendProgress;
+
+    // The resolve for the connect in progress, and ones a connect gave up on that are still running
+    IRCResolver* _resolve;
+    std::vector<IRCResolver*> _abandoned;
+    std::string _host;
+
+    // Resolved addresses in the order they get tried, and the sockets still racing
+    std::vector<sockaddr_storage> _addresses;
+    std::vector<int> _addressLengths;
+    size_t _nextAddress;
+    std::vector<int> _attempts;
+
+    double _connectDeadline;
+    double _lastAttemptTime;
 };
 
 #endif
@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2011 Fredi Machado <https://github.com/Fredi>
+ * IRCClient is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * http://www.gnu.org/licenses/lgpl.html
+ */
+
+#ifndef _IRCSTRINGVIEW_H
+#define _IRCSTRINGVIEW_H
+
+#include <cctype>
+#include <cstring>
+#include <string>
+
+// Non-owning view over bytes held by one of the socket buffers.
+// A view is only valid until the buffer it points into is written to again.
+class IRCStringView
+{
+public:
+    static const size_t npos = (size_t)-1;
+
+    IRCStringView() : _data(""), _size(0) {};
+    IRCStringView(char const* data, size_t size) : _data(data), _size(size) {};
+    IRCStringView(char const* str) : _data(str), _size(strlen(str)) {};
+    IRCStringView(std::string const& str) : _data(str.data()), _size(str.size()) {};
+
+    char const* data() const { return _data; };
+    size_t size() const { return _size; };
+    bool empty() const { return _size == 0; };
+
+    char const* begin() const { return _data; };
+    char const* end() const { return _data + _size; };
+
+    char operator[](size_t pos) const { return _data[pos]; };
+
+    size_t find(char c, size_t pos = 0) const
+    {
+        if (pos >= _size)
+            return npos;
+
+        char const* found = (char const*)memchr(_data + pos, c, _size - pos);
+        return found ? (size_t)(found - _data) : npos;
+    };
+
+    IRCStringView substr(size_t pos, size_t count = npos) const
+    {
+        if (pos > _size)
+            pos = _size;
+        if (count > _size - pos)
+            count = _size - pos;
+        return IRCStringView(_data + pos, count);
+    };
+
+    bool operator==(IRCStringView const& other) const
+    {
+        return _size == other._size && memcmp(_data, other._data, _size) == 0;
+    };
+    bool operator!=(IRCStringView const& other) const { return !(*this == other); };
+
+    // ASCII only, which is all IRC commands are made of
+    bool equals_nocase(IRCStringView const& other) const
+    {
+        if (_size != other._size)
+            return false;
+
+        for (size_t i = 0; i < _size; ++i)
+            if (toupper((unsigned char)_data[i]) != toupper((unsigned char)other._data[i]))
+                return false;
+
+        return true;
+    };
+
+    std::string str() const { return std::string(_data, _size); };
+
+private:
+    char const* _data;
+    size_t _size;
+};
+
+#endif
@@ -6,6 +6,7 @@
 #include "UTGameState.h"
 #include "Core.h"
 #include "UTArmor.h"
+#include "TwitchHypeBenchmark.h"
 
 DEFINE_LOG_CATEGORY(LogUTTwitchHype);
 
@@ -26,24 +27,109 @@ ATwitchHype::ATwitchHype(const FObjectInitializer& ObjectInitializer)
 	HatCost = 2000;
 	FeignDeathCost = 2000;
 	TauntCost = 2000;
+	DefaultCommandCooldown = 5;
+	ChatRateLimit = 20;
+	ChatRateBurst = 5;
+	ChatQueueMaxDepth = 100;
+	ChannelChatRateLimit = 0;
+	ConnectTimeout = 10;
+	bUseNetworkThread = false;
+	MaxLinesPerTick = 200;
+	bTcpNoDelay = true;
+	SendBufferSize = 0;
+	ReconnectDelayMin = 1;
+	ReconnectDelayMax = 60;
+	KeepaliveInterval = 30;
+	KeepaliveTimeout = 75;
+	ThrottleTime = 30;
+	InboundQueueMaxDepth = 1000;
+	InboundBudgetMicroseconds = 2000;
+	PersistInterval = 5.0f;
+	PersistBatchSize = 256;
+
+	// Commits become an append to the log without a sync, the sync waits for the checkpoint between matches
+	StorageProfile.bWriteAheadLog = true;
+	StorageProfile.Synchronous = 1;
+	StorageProfile.MmapSizeMB = 64;
+	StorageProfile.CacheSizeKB = 8192;
+	StorageProfile.bTempStoreMemory = true;
+	StorageProfile.CheckpointPages = 10000;
 }
 
-void OnPrivMsg(IRCMessage message, struct FTwitchHype* TwitchHype)
+// Stands in for the Twitch user id when there isn't one, the top bit keeps it clear of real ids
+static uint64 UserKeyFromName(IRCStringView Name)
 {
-	TwitchHype->OnPrivMsg(message);
+	// Twitch login names are ASCII, so lowercasing bytes is enough
+	uint64 Hash = 14695981039346656037ULL;
+	for (size_t i = 0; i < Name.size(); i++)
+	{
+		char C = Name[i];
+		Hash ^= (uint8)(C >= 'A' && C <= 'Z' ? C - 'A' + 'a' : C);
+		Hash *= 1099511628211ULL;
+	}
+	return Hash | (1ULL << 63);
+}
+
+static bool IsUserKeyFromName(uint64 UserId)
+{
+	return (UserId & (1ULL << 63)) != 0;
+}
+
+// Settings every connection gets, the reader and each writer alike
+static void ConfigureConnection(IRCClient& Connection, const ATwitchHype* Settings)
+{
+	Connection.SendQueue().Configure(Settings->ChatRateLimit, 30.0, Settings->ChatRateBurst, Settings->ChatQueueMaxDepth);
+	int32 ChannelChatRateLimit = Settings->ChannelChatRateLimit > 0 ? Settings->ChannelChatRateLimit : Settings->ChatRateLimit;
+	Connection.ConfigureChannelQueues(ChannelChatRateLimit, 30.0, Settings->ChatRateBurst, Settings->ChatQueueMaxDepth);
+	Connection.SetNetworkThread(Settings->bUseNetworkThread, Settings->MaxLinesPerTick);
+	Connection.SetConnectTimeout(Settings->ConnectTimeout);
+	Connection.SetSocketOptions(Settings->bTcpNoDelay, Settings->SendBufferSize);
+	Connection.SetReconnectDelay(Settings->ReconnectDelayMin, Settings->ReconnectDelayMax);
+	Connection.SetKeepalive(Settings->KeepaliveInterval, Settings->KeepaliveTimeout);
+	Connection.SetThrottleTime(Settings->ThrottleTime);
+	Connection.InboundQueue().Configure(FMath::Max(Settings->InboundQueueMaxDepth, 0), Settings->InboundBudgetMicroseconds / 1000000.0);
+
+	// Tags carry the user id profiles are keyed by and why a NOTICE was sent, commands brings CLEARCHAT, USERNOTICE and RECONNECT
+	Connection.RequestCapabilities("twitch.tv/tags twitch.tv/commands");
 }
 
-FTwitchHype::FTwitchHype()
+// In ETwitchReply order, {0} to {9} are filled in when the reply is made
+static const char* ReplyFormats[] =
+{
+	"Hello friends, your friendly UT bot is back!",
+	"The match is starting, betting is now closed!",
+	"First Blood goes to {0}!",
+	"First Suicide goes to {0}!",
+	"Betting stats: {0} credits paid out, {1} credits lost",
+	"The match is over, thanks for betting!",
+	"No account exists for {0}, please use !register",
+	"{0}, please use the form {1}",
+	"{0}, it costs {1} to {2}, you only have {3}!",
+	"Account created for {0}!",
+	"Account already exists for {0}!",
+	"{0} you have {1} credits.",
+	"{0} has joined the game!",
+	"We've started {0} map!",
+	"The match was aborted, active bets are forgiven!",
+	"The match is waiting to start on {0}!",
+	"{0} betting is not open right now!",
+	"{0} you've already placed a bet!",
+	"{0} you only have {1} credits to wager!",
+	"{0} {1} is over the max bet value of {2}!",
+	"{0} I'm sorry, but {1} is not an active player in the match!",
+	"{0} you've placed {1} on {2} using {3}",
+	"{0}. {1} - {2}",
+	"{0} you've been restored to {1} credits, you've gone bankrupt {2} times",
+};
+static_assert(ARRAY_COUNT(ReplyFormats) == ETwitchReply::Count, "Every ETwitchReply needs a format");
+
+FTwitchHype::FTwitchHype(const FString& DatabasePath)
 {
-	bAuthenticated = false;
-	bJoinedChannel = false;
-	bAnnounced = false;
 	bBettingOpen = false;
-	AuthenticatedTime = 0;
-	db = nullptr;
+	Persistence = nullptr;
 	bFirstBlood = false;
 	bFirstSuicide = false;
-	LastTop10Time = 0;
+	CommandsOnCooldown = 0;
 
 	ATwitchHype* Settings = ATwitchHype::StaticClass()->GetDefaultObject<ATwitchHype>();
 	// Load these from config file
@@ -58,6 +144,7 @@ FTwitchHype::FTwitchHype()
 	InitialCredits = Settings->InitialCredits;
 	MaxBet = Settings->MaxBet;
 	bDebug = Settings->bDebug;
+	DefaultCommandCooldown = Settings->DefaultCommandCooldown;
 	ChatCost = Settings->ChatCost;
 	TauntCost = Settings->TauntCost;
 	FeignDeathCost = Settings->FeignDeathCost;
@@ -65,68 +152,335 @@ FTwitchHype::FTwitchHype()
 	RedeemerCost = Settings->RedeemerCost;
 	HatCost = Settings->HatCost;
 
-	FString DatabasePath = FPaths::GameSavedDir() / "TwitchHype.db";
-	//sqlite3_open_v2(TCHAR_TO_ANSI(*DatabasePath), &db, SQLITE_OPEN_NOMUTEX, nullptr);
-	if (sqlite3_open(TCHAR_TO_ANSI(*DatabasePath), &db))
+	TArray<FString> ChannelNames;
+	ChannelNames.Add(ChannelName);
+	ChannelNames.Append(Settings->AdditionalChannels);
+	for (const FString& Name : ChannelNames)
+	{
+		std::string Utf8Name = TCHAR_TO_UTF8(*Name);
+		if (!Utf8Name.empty() && FindChannel(Utf8Name) == nullptr)
+		{
+			FTwitchChannel Channel;
+			Channel.Name = Utf8Name;
+			Channel.Prefix = "PRIVMSG " + Utf8Name + " :";
+			Channels.Add(Channel);
+		}
+	}
+
+	for (int32 Id = 0; Id < ETwitchReply::Count; Id++)
+	{
+		Replies[Id].Compile(ReplyFormats[Id]);
+	}
+
+	ConfigureConnection(client, Settings);
+	for (int32 i = 0; i < Settings->WriterNicknames.Num(); i++)
 	{
-		UE_LOG(LogUTTwitchHype, Warning, TEXT("Could not open database"));
-		sqlite3_close(db);
-		db = nullptr;
+		if (!Settings->WriterOAuths.IsValidIndex(i))
+		{
+			UE_LOG(LogUTTwitchHype, Warning, TEXT("No OAuth for writer %s, leaving it out"), *Settings->WriterNicknames[i]);
+			continue;
+		}
+
+		IRCClient& Writer = client.AddWriter(std::string(TCHAR_TO_ANSI(*Settings->WriterNicknames[i])), std::string(TCHAR_TO_ANSI(*Settings->WriterOAuths[i])));
+		ConfigureConnection(Writer, Settings);
 	}
 
+	sqlite3 *db = DatabasePath.IsEmpty() ? nullptr : FTwitchPersistence::Open(DatabasePath, Settings->StorageProfile);
 	if (db)
 	{
-		// http://www.sqlite.org/lang_createtable.html#rowid claims this is an alias for row id
-		FString CreateCommand = TEXT("CREATE TABLE IF NOT EXISTS Users (name varchar(50) NOT NULL PRIMARY KEY, credits int, bankrupts int, jointime timestamp NOT NULL DEFAULT CURRENT_TIMESTAMP)");
-		sqlite3_exec(db, TCHAR_TO_ANSI(*CreateCommand), nullptr, nullptr, nullptr);
-		
-		FString QueryCommand = TEXT("SELECT name, credits FROM Users");
-		sqlite3_stmt *sqlStatement;
-		if (sqlite3_prepare_v2(db, TCHAR_TO_ANSI(*QueryCommand), -1, &sqlStatement, NULL) == SQLITE_OK)
+		// Prepares every statement up front, loading the profiles is the first one to run
+		Persistence = new FTwitchPersistence(db, Settings->StorageProfile, Settings->PersistInterval, Settings->PersistBatchSize);
+
+		FTwitchStatementCache& Statements = Persistence->StatementCache();
+		double LoadStart = FPlatformTime::Seconds();
+		sqlite3_stmt *sqlStatement = Statements.Get(ETwitchStatement::LoadProfiles);
+		while (sqlStatement && sqlite3_step(sqlStatement) == SQLITE_ROW)
 		{
-			while (sqlite3_step(sqlStatement) == SQLITE_ROW)
-			{
-				FUserProfile Profile;
-				FString Name = FString(ANSI_TO_TCHAR((const char*)sqlite3_column_text(sqlStatement, 0)));
-				Profile.credits = sqlite3_column_int(sqlStatement, 1);
+			FUserProfile Profile;
+			Profile.name = (const char*)sqlite3_column_text(sqlStatement, 0);
+			Profile.credits = sqlite3_column_int(sqlStatement, 1);
+			Profile.bankrupts = sqlite3_column_int(sqlStatement, 2);
+			Profile.userid = sqlite3_column_type(sqlStatement, 3) == SQLITE_NULL ? UserKeyFromName(Profile.name) : (uint64)sqlite3_column_int64(sqlStatement, 3);
 
-				InMemoryProfiles.Add(Name, Profile);
-			}
+			InMemoryProfiles.Add(Profile.userid, Profile);
+		}
+		Statements.Finish(ETwitchStatement::LoadProfiles, LoadStart);
+
+		// Everything is in memory now, from here on only the persistence worker touches the database
+		if (!Persistence->Start())
+		{
+			UE_LOG(LogUTTwitchHype, Warning, TEXT("Could not start the persistence thread, profiles will only be saved on exit"));
+		}
+	}
+
+	RegisterCommands();
+	for (const FTwitchCommandCooldown& Cooldown : Settings->CommandCooldowns)
+	{
+		if (!Commands.SetCooldown(TCHAR_TO_UTF8(*Cooldown.Command), Cooldown.Seconds))
+		{
+			UE_LOG(LogUTTwitchHype, Warning, TEXT("No %s command to set a cooldown on"), *Cooldown.Command);
 		}
-		sqlite3_finalize(sqlStatement);
+	}
+
+	client.HookIRCCommand(IRC_CMD_PRIVMSG, this, &FTwitchHype::OnPrivMsg);
+}
+
+// Command handlers, thin wrappers so every command has the same signature in the registry
+namespace TwitchCommands
+{
+	void Register(FTwitchHype& TwitchHype, FTwitchChannel& Channel, const FTwitchChatCommand& ParsedCommand, FUserProfile* Profile, IRCStringView Username)
+	{
+		TwitchHype.RegisterAccount(Channel, ParsedCommand.UserId, Username);
+	}
+
+	void Credits(FTwitchHype& TwitchHype, FTwitchChannel& Channel, const FTwitchChatCommand& ParsedCommand, FUserProfile* Profile, IRCStringView Username)
+	{
+		TwitchHype.PrintCredits(Channel, Profile, Username);
+	}
+
+	void Bet(FTwitchHype& TwitchHype, FTwitchChannel& Channel, const FTwitchChatCommand& ParsedCommand, FUserProfile* Profile, IRCStringView Username)
+	{
+		TwitchHype.ParseABet(Channel, ParsedCommand, Profile, Username, Channel.ActiveBets);
+	}
+
+	void FirstBloodBet(FTwitchHype& TwitchHype, FTwitchChannel& Channel, const FTwitchChatCommand& ParsedCommand, FUserProfile* Profile, IRCStringView Username)
+	{
+		TwitchHype.ParseABet(Channel, ParsedCommand, Profile, Username, Channel.ActiveFirstBloodBets);
+	}
+
+	void FirstSuicideBet(FTwitchHype& TwitchHype, FTwitchChannel& Channel, const FTwitchChatCommand& ParsedCommand, FUserProfile* Profile, IRCStringView Username)
+	{
+		TwitchHype.ParseABet(Channel, ParsedCommand, Profile, Username, Channel.ActiveFirstSuicideBets);
+	}
+
+	void Top10(FTwitchHype& TwitchHype, FTwitchChannel& Channel, const FTwitchChatCommand& ParsedCommand, FUserProfile* Profile, IRCStringView Username)
+	{
+		TwitchHype.PrintTop10(Channel);
+	}
+
+	void Bankrupt(FTwitchHype& TwitchHype, FTwitchChannel& Channel, const FTwitchChatCommand& ParsedCommand, FUserProfile* Profile, IRCStringView Username)
+	{
+		TwitchHype.GiveExtraMoney(Channel, Profile, Username);
+	}
+
+	void UndoBets(FTwitchHype& TwitchHype, FTwitchChannel& Channel, const FTwitchChatCommand& ParsedCommand, FUserProfile* Profile, IRCStringView Username)
+	{
+		TwitchHype.UndoBets(Channel, Profile, Username);
+	}
+
+	void Chat(FTwitchHype& TwitchHype, FTwitchChannel& Channel, const FTwitchChatCommand& ParsedCommand, FUserProfile* Profile, IRCStringView Username)
+	{
+		TwitchHype.SendChat(Channel, ParsedCommand, Profile, Username);
+	}
+
+	void Taunt(FTwitchHype& TwitchHype, FTwitchChannel& Channel, const FTwitchChatCommand& ParsedCommand, FUserProfile* Profile, IRCStringView Username)
+	{
+		TwitchHype.SendTaunt(Channel, ParsedCommand, Profile, Username);
+	}
+
+	void FeignDeath(FTwitchHype& TwitchHype, FTwitchChannel& Channel, const FTwitchChatCommand& ParsedCommand, FUserProfile* Profile, IRCStringView Username)
+	{
+		TwitchHype.SendFeignDeath(Channel, ParsedCommand, Profile, Username);
+	}
+
+	void Armor(FTwitchHype& TwitchHype, FTwitchChannel& Channel, const FTwitchChatCommand& ParsedCommand, FUserProfile* Profile, IRCStringView Username)
+	{
+		TwitchHype.SendArmor(Channel, ParsedCommand, Profile, Username);
+	}
+
+	void Redeemer(FTwitchHype& TwitchHype, FTwitchChannel& Channel, const FTwitchChatCommand& ParsedCommand, FUserProfile* Profile, IRCStringView Username)
+	{
+		TwitchHype.SendRedeemer(Channel, ParsedCommand, Profile, Username);
+	}
+
+	void Hat(FTwitchHype& TwitchHype, FTwitchChannel& Channel, const FTwitchChatCommand& ParsedCommand, FUserProfile* Profile, IRCStringView Username)
+	{
+		TwitchHype.SendHat(Channel, ParsedCommand, Profile, Username);
+	}
 
+	FTwitchCommandInfo Make(const char* Name, FTwitchCommandHandler Handler, int32 MinArgs = 0, int32 MaxArgs = 0, const char* Usage = "", int32 Cost = 0, const char* Action = "")
+	{
+		FTwitchCommandInfo Info;
+		Info.Name = Name;
+		Info.Handler = Handler;
+		Info.Cost = Cost;
+		Info.Action = Action;
+		Info.MinArgs = MinArgs;
+		Info.MaxArgs = MaxArgs;
+		Info.Usage = Usage;
+		Info.bNeedsProfile = true;
+		Info.Cooldown = -1;
+		return Info;
 	}
+}
 
-	client.HookIRCCommand("PRIVMSG", &::OnPrivMsg, this);
+void FTwitchHype::RegisterCommands()
+{
+	FTwitchCommandInfo RegisterInfo = TwitchCommands::Make("!register", &TwitchCommands::Register);
+	RegisterInfo.bNeedsProfile = false;
+	Commands.Register(RegisterInfo);
+
+	Commands.Register(TwitchCommands::Make("!credits", &TwitchCommands::Credits));
+	Commands.Register(TwitchCommands::Make("!bet", &TwitchCommands::Bet, 2, 2, "!bet <winner> <amount>"));
+	Commands.Register(TwitchCommands::Make("!firstbloodbet", &TwitchCommands::FirstBloodBet, 2, 2, "!firstbloodbet <winner> <amount>"));
+	Commands.Register(TwitchCommands::Make("!firstsuicidebet", &TwitchCommands::FirstSuicideBet, 2, 2, "!firstsuicidebet <winner> <amount>"));
+	Commands.Register(TwitchCommands::Make("!top10", &TwitchCommands::Top10));
+	Commands.Register(TwitchCommands::Make("!bankrupt", &TwitchCommands::Bankrupt));
+	Commands.Register(TwitchCommands::Make("!undobets", &TwitchCommands::UndoBets));
+	// The rest of the message is read with Rest, it isn't split up
+	Commands.Register(TwitchCommands::Make("!chat", &TwitchCommands::Chat, 0, 0, "", ChatCost, "chat"));
+	Commands.Register(TwitchCommands::Make("!taunt", &TwitchCommands::Taunt, 0, 0, "", TauntCost, "taunt"));
+	Commands.Register(TwitchCommands::Make("!feigndeath", &TwitchCommands::FeignDeath, 0, 0, "", FeignDeathCost, "feign death"));
+	Commands.Register(TwitchCommands::Make("!armor", &TwitchCommands::Armor, 1, 1, "!armor <playername>", ArmorCost, "send armor"));
+	Commands.Register(TwitchCommands::Make("!redeemer", &TwitchCommands::Redeemer, 0, 0, "", RedeemerCost, "send a redeemer"));
+	Commands.Register(TwitchCommands::Make("!hat", &TwitchCommands::Hat, 1, 1, "!hat <hatname>", HatCost, "send a hat"));
 }
 
 FTwitchHype::~FTwitchHype()
 {
-	if (db)
+	if (Persistence)
 	{
-		FlushToDB();
+		// Writes whatever is still queued before closing the database
+		QueueDirtyProfiles();
+		delete Persistence;
+		Persistence = nullptr;
+	}
+}
 
-		sqlite3_close(db);
+void FTwitchHype::MarkDirty(FUserProfile& Profile)
+{
+	if (!Profile.dirty)
+	{
+		Profile.dirty = true;
+		DirtyProfiles.Add(Profile.userid);
 	}
 }
 
+void FTwitchHype::ChangeCredits(FUserProfile& Profile, int32 Delta)
+{
+	Profile.credits += Delta;
+	MarkDirty(Profile);
+}
+
+void FTwitchHype::QueueProfileChange(ETwitchProfileChange::Type Type, const FUserProfile& Profile)
+{
+	if (Persistence == nullptr)
+	{
+		return;
+	}
+
+	if (Profile.name.size() > TWITCH_PERSIST_MAX_NAME)
+	{
+		UE_LOG(LogUTTwitchHype, Warning, TEXT("Not saving %s, the name is too long"), UTF8_TO_TCHAR(Profile.name.c_str()));
+		return;
+	}
+
+	FTwitchProfileChange Change;
+	Change.Type = Type;
+	Change.UserId = Profile.userid;
+	Change.bNameKey = IsUserKeyFromName(Profile.userid);
+	Change.Credits = Profile.credits;
+	Change.Bankrupts = Profile.bankrupts;
+	FMemory::Memcpy(Change.Name, Profile.name.data(), Profile.name.size());
+	Change.NameLength = (int32)Profile.name.size();
+	Change.QueuedTime = FPlatformTime::Seconds();
+	Persistence->Enqueue(Change);
+}
+
+void FTwitchHype::QueueDirtyProfiles()
+{
+	for (uint64 UserId : DirtyProfiles)
+	{
+		// Gone when an id claimed the account after it was marked, it's listed again under the id
+		FUserProfile* Profile = InMemoryProfiles.Find(UserId);
+		if (Profile != nullptr && Profile->dirty)
+		{
+			QueueProfileChange(ETwitchProfileChange::Update, *Profile);
+			Profile->dirty = false;
+		}
+	}
+	DirtyProfiles.Reset();
+}
+
 void FTwitchHype::FlushToDB()
 {
-	for (auto It = InMemoryProfiles.CreateConstIterator(); It; ++It)
+	if (Persistence)
+	{
+		QueueDirtyProfiles();
+		Persistence->Tick();
+		Persistence->Flush();
+	}
+}
+
+void FTwitchHype::CheckpointDatabase()
+{
+	if (Persistence)
+	{
+		QueueDirtyProfiles();
+		Persistence->Tick();
+		Persistence->Checkpoint();
+	}
+}
+
+static void RekeyBet(TMap<uint64, FActiveBet>& BetMap, uint64 From, uint64 To)
+{
+	FActiveBet Bet;
+	if (BetMap.RemoveAndCopyValue(From, Bet))
+	{
+		BetMap.Add(To, Bet);
+	}
+}
+
+FUserProfile* FTwitchHype::FindProfile(uint64 UserId, IRCStringView Username)
+{
+	FUserProfile* Profile = InMemoryProfiles.Find(UserId);
+	if (Profile != nullptr)
+	{
+		// Twitch lets people rename themselves, the id stays the same
+		if (Username != Profile->name && !IsUserKeyFromName(UserId))
+		{
+			Profile->name = Username.str();
+			QueueProfileChange(ETwitchProfileChange::Rename, *Profile);
+		}
+
+		return Profile;
+	}
+
+	if (IsUserKeyFromName(UserId))
+	{
+		return nullptr;
+	}
+
+	// Registered before user ids were tracked, the first message with an id claims the account
+	FUserProfile NameProfile;
+	if (!InMemoryProfiles.RemoveAndCopyValue(UserKeyFromName(Username), NameProfile))
+	{
+		return nullptr;
+	}
+
+	uint64 NameKey = NameProfile.userid;
+	NameProfile.userid = UserId;
+	FUserProfile& Claimed = InMemoryProfiles.Add(UserId, NameProfile);
+	// Bets placed under the name are paid out to the id
+	for (FTwitchChannel& Channel : Channels)
+	{
+		RekeyBet(Channel.ActiveBets, NameKey, UserId);
+		RekeyBet(Channel.ActiveFirstBloodBets, NameKey, UserId);
+		RekeyBet(Channel.ActiveFirstSuicideBets, NameKey, UserId);
+	}
+	QueueProfileChange(ETwitchProfileChange::ClaimId, Claimed);
+	if (Claimed.dirty)
 	{
-		// mirror memory back to the database, %Q will try to escape any injection hacks
-		const FUserProfile& Profile = It.Value();
-		char *zSQL = sqlite3_mprintf("UPDATE Users SET credits=%d,bankrupts=%d WHERE name=%Q", Profile.credits, Profile.bankrupts, TCHAR_TO_ANSI(*It.Key()));
-		sqlite3_exec(db, zSQL, 0, 0, 0);
-		sqlite3_free(zSQL);
+		DirtyProfiles.Add(UserId);
 	}
+	return &Claimed;
 }
 
 void FTwitchHype::OnWorldCreated(UWorld* World, const UWorld::InitializationValues IVS)
 {
 	KnownWorlds.Add(World);
 
-	if (bAutoConnect && !client.Connected() && !client.Connecting())
+	if (bAutoConnect && client.State() == IRC_STATE_DISCONNECTED)
 	{
 		ConnectToIRC();
 	}
@@ -137,15 +491,14 @@ void FTwitchHype::OnWorldDestroyed(UWorld* World)
 	KnownWorlds.Remove(World);
 }
 
-void FTwitchHype::ConnectToIRC()
+void FTwitchHype::ConnectToIRC(const FString& Host, int32 Port)
 {
-	if (client.Connected())
+	// Already connected, or on its way back
+	if (client.State() != IRC_STATE_DISCONNECTED)
 	{
 		return;
 	}
 
-	bAuthenticated = false;
-	bJoinedChannel = false;
 	if (bDebug)
 	{
 		client.Debug(true);
@@ -153,10 +506,17 @@ void FTwitchHype::ConnectToIRC()
 
 	if (client.InitSocket())
 	{
-		FString host = TEXT("irc.twitch.tv");
-		int32 port = 6667;
+		client.Login(std::string(TCHAR_TO_ANSI(*BotNickname)), std::string(TCHAR_TO_ANSI(*OAuth)));
+		for (const FTwitchChannel& Channel : Channels)
+		{
+			client.Join(Channel.Name);
+		}
+
+		// Held back until the channels are joined, and only said once, not after every reconnect
+		Announce(ETwitchReply::Hello);
+
 		// non-blocking connect
-		if (!client.Connect(TCHAR_TO_ANSI(*host), port))
+		if (!client.Connect(TCHAR_TO_ANSI(*Host), Port))
 		{
 		}
 	}
@@ -166,13 +526,7 @@ bool FTwitchHype::Exec(UWorld* InWorld, const TCHAR* Cmd, FOutputDevice& Ar)
 {
 	if (FParse::Command(&Cmd, TEXT("IRCDISCONNECT")))
 	{
-		if (client.Connected())
-		{
-			client.Disconnect();
-		}
-
-		bAuthenticated = false;
-		bJoinedChannel = false;
+		client.Disconnect();
 
 		return true;
 	}
@@ -199,43 +553,166 @@ bool FTwitchHype::Exec(UWorld* InWorld, const TCHAR* Cmd, FOutputDevice& Ar)
 		return true;
 	}
 
-	return false;
-}
-
-void FTwitchHype::Tick(float DeltaTime)
-{
-	if (GIsEditor)
+	if (FParse::Command(&Cmd, TEXT("IRCSTATS")))
 	{
-		return;
+		double Now = FPlatformTime::Seconds();
+		IRCSendQueue& SendQueue = client.SendQueue();
+		const IRCSendQueueStats& Stats = SendQueue.Stats();
+
+		Ar.Logf(TEXT("Connection: %s, %u sessions, capabilities: %s"), ANSI_TO_TCHAR(client.StateName()), client.Sessions(), ANSI_TO_TCHAR(client.Capabilities().c_str()));
+		if (client.Writers() > 0)
+		{
+			Ar.Logf(TEXT("Writers: %d, %llu lines failed over, reader throttled %u times%s"),
+				(int32)client.Writers(), client.Failovers(), client.Throttles(), client.Throttled(Now) ? TEXT(" (resting now)") : TEXT(""));
+			for (size_t i = 0; i < client.Writers(); ++i)
+			{
+				IRCClient& Writer = client.Writer(i);
+				const IRCSendQueueStats& WriterStats = Writer.SendQueue().Stats();
+				Ar.Logf(TEXT("  %s: %s, %d waiting, sent %llu lines, %llu dropped, throttled %u times%s"),
+					ANSI_TO_TCHAR(Writer.Nick().c_str()), ANSI_TO_TCHAR(Writer.StateName()), (int32)Writer.SendQueue().Depth(),
+					WriterStats.sent, WriterStats.dropped, Writer.Throttles(), Writer.Throttled(Now) ? TEXT(" (resting now)") : TEXT(""));
+			}
+		}
+		Ar.Logf(TEXT("Send queue: %d waiting (control %d, announcements %d, replies %d, confirmations %d), oldest %.2fs"),
+			(int32)SendQueue.Depth(),
+			(int32)SendQueue.Depth(IRC_PRIORITY_CONTROL),
+			(int32)SendQueue.Depth(IRC_PRIORITY_ANNOUNCEMENT),
+			(int32)SendQueue.Depth(IRC_PRIORITY_REPLY),
+			(int32)SendQueue.Depth(IRC_PRIORITY_CONFIRMATION),
+			SendQueue.OldestWait(Now));
+		Ar.Logf(TEXT("Sent %llu lines with %d replies still queued (%llu coalesced, %llu split), %llu dropped, wait avg %.2fs max %.2fs"),
+			Stats.sent, (int32)SendQueue.Depth(), Stats.coalesced, Stats.split, Stats.dropped, Stats.averageWait, Stats.maxWait);
+
+		for (const FTwitchChannel& Channel : Channels)
+		{
+			IRCSendQueue* ChannelQueue = client.ChannelQueue(Channel.Name);
+			if (ChannelQueue)
+			{
+				const IRCSendQueueStats& ChannelStats = ChannelQueue->Stats();
+				Ar.Logf(TEXT("  %s: %d waiting, oldest %.2fs, sent %llu lines (%llu coalesced), %llu dropped, wait avg %.2fs max %.2fs"),
+					UTF8_TO_TCHAR(Channel.Name.c_str()), (int32)ChannelQueue->Depth(), ChannelQueue->OldestWait(Now),
+					ChannelStats.sent, ChannelStats.coalesced, ChannelStats.dropped, ChannelStats.averageWait, ChannelStats.maxWait);
+			}
+		}
+
+		const IRCKeepalive& Keepalive = client.Keepalive();
+		const IRCKeepaliveStats& KeepaliveStats = Keepalive.Stats();
+		Ar.Logf(TEXT("Round trip: last %.1fms avg %.1fms min %.1fms max %.1fms, p50 < %.0fms p99 < %.0fms (%llu of %llu pings answered, %llu dead connections)"),
+			KeepaliveStats.lastRtt * 1000.0, KeepaliveStats.averageRtt * 1000.0, KeepaliveStats.minRtt * 1000.0, KeepaliveStats.maxRtt * 1000.0,
+			Keepalive.Percentile(0.5) * 1000.0, Keepalive.Percentile(0.99) * 1000.0,
+			KeepaliveStats.pongsReceived, KeepaliveStats.pingsSent, KeepaliveStats.deadConnections);
+
+		const IRCInboundQueue& InboundQueue = client.InboundQueue();
+		const IRCInboundQueueStats& InboundStats = InboundQueue.Stats();
+		Ar.Logf(TEXT("Inbound: %d waiting (%d commands, peak %d), %llu handled of %llu queued, shed %llu chat %llu commands, %llu repeats collapsed, wait avg %.3fs max %.3fs, %llu ticks over budget"),
+			(int32)InboundQueue.Depth(), (int32)InboundQueue.CommandDepth(), (int32)InboundStats.maxDepth,
+			InboundStats.processed, InboundStats.queued, InboundStats.shedChat, InboundStats.shedCommands, InboundStats.collapsed,
+			InboundStats.averageWait, InboundStats.maxWait, InboundStats.overBudgetTicks);
+		Ar.Logf(TEXT("Cooldowns: %d running, %llu commands ignored"), Cooldowns.Num(), CommandsOnCooldown);
+		const IRCArenaStats& ArenaStats = client.FrameArenaStats();
+		Ar.Logf(TEXT("Frame arena: %llu blocks allocated, %u bytes used at peak"), ArenaStats.blocks, (uint32)ArenaStats.peak);
+		if (Persistence)
+		{
+			FTwitchPersistenceStats PersistStats = Persistence->Stats();
+			Ar.Logf(TEXT("Persistence: %d changes waiting (%d held back), %llu rows in %llu transactions, %llu rows and %llu commits failed, lag last %.2fs max %.2fs, last commit took %.1fms"),
+				Persistence->Pending(), Persistence->Backlogged(), PersistStats.Rows, PersistStats.Transactions, PersistStats.FailedRows, PersistStats.FailedCommits,
+				PersistStats.LastLag, PersistStats.MaxLag, PersistStats.LastCommitDuration * 1000.0);
+			Ar.Logf(TEXT("Write-ahead log: %d pages, %llu checkpoints, last took %.1fms"),
+				PersistStats.WalPages, PersistStats.Checkpoints, PersistStats.LastCheckpointDuration * 1000.0);
+
+			const FTwitchStatementCache& Statements = Persistence->StatementCache();
+			for (int32 Id = 0; Id < ETwitchStatement::Count; Id++)
+			{
+				ETwitchStatement::Type Statement = (ETwitchStatement::Type)Id;
+				if (Statements.Runs(Statement) > 0)
+				{
+					Ar.Logf(TEXT("  %s: %llu runs, avg %.3fms max %.3fms"),
+						FTwitchStatementCache::Name(Statement), Statements.Runs(Statement), Statements.AverageTime(Statement) * 1000.0, Statements.MaxTime(Statement) * 1000.0);
+				}
+			}
+		}
+
+		return true;
 	}
 
-	if (client.Connecting())
+	if (FParse::Command(&Cmd, TEXT("IRCRTT")))
 	{
-		client.CheckConnected();
+		const IRCKeepaliveStats& KeepaliveStats = client.Keepalive().Stats();
+		for (int32 Bucket = 0; Bucket < IRC_RTT_BUCKETS; ++Bucket)
+		{
+			if (Bucket == IRC_RTT_BUCKETS - 1)
+			{
+				Ar.Logf(TEXT("   >= %6.0fms: %llu"), IRCKeepalive::BucketLimit(Bucket - 1) * 1000.0, KeepaliveStats.histogram[Bucket]);
+			}
+			else
+			{
+				Ar.Logf(TEXT("    < %6.0fms: %llu"), IRCKeepalive::BucketLimit(Bucket) * 1000.0, KeepaliveStats.histogram[Bucket]);
+			}
+		}
+
+		return true;
 	}
-	else if (client.Connected())
+
+	if (FParse::Command(&Cmd, TEXT("TWITCHHYPEBENCH")))
 	{
-		if (!bAuthenticated)
+		if (FParse::Command(&Cmd, TEXT("PARSE")))
 		{
-			client.Login(std::string(TCHAR_TO_ANSI(*BotNickname)), std::string(TCHAR_TO_ANSI(*OAuth)));
-			bAuthenticated = true;
-			AuthenticatedTime = FPlatformTime::Seconds();
+			// A raw dump of chat lines, one per line, as received from the server
+			FString CorpusPath = FParse::Token(Cmd, false);
+			if (CorpusPath.IsEmpty())
+			{
+				CorpusPath = FPaths::GameSavedDir() / TEXT("TwitchHypeCorpus.txt");
+			}
+			FTwitchHypeBenchmark::RunParse(CorpusPath, Ar);
 		}
-		else if (!bJoinedChannel && FPlatformTime::Seconds() - AuthenticatedTime > 1.0f)
+		else if (FParse::Command(&Cmd, TEXT("ALLOCS")))
 		{
-			FString JoinCommand = FString::Printf(TEXT("JOIN %s"), *ChannelName);
-			client.SendIRC(TCHAR_TO_ANSI(*JoinCommand));
-			bJoinedChannel = true;
-			bAnnounced = false;
-			JoinedTime = FPlatformTime::Seconds();
+			FString CorpusPath = FParse::Token(Cmd, false);
+			if (CorpusPath.IsEmpty())
+			{
+				CorpusPath = FPaths::GameSavedDir() / TEXT("TwitchHypeCorpus.txt");
+			}
+			FTwitchHypeBenchmark::RunAllocs(CorpusPath, Ar);
 		}
-		else if (!bAnnounced && bJoinedChannel && FPlatformTime::Seconds() - JoinedTime > 1.0f)
+		else if (FParse::Command(&Cmd, TEXT("SCAN")))
 		{
-			FString HelloMessage = FString::Printf(TEXT("PRIVMSG %s :Hello friends, your friendly UT bot is back!"), *ChannelName);
-			client.SendIRC(TCHAR_TO_ANSI(*HelloMessage));
-			bAnnounced = true;
+			FString CorpusPath = FParse::Token(Cmd, false);
+			if (CorpusPath.IsEmpty())
+			{
+				CorpusPath = FPaths::GameSavedDir() / TEXT("TwitchHypeCorpus.txt");
+			}
+			FTwitchHypeBenchmark::RunScan(CorpusPath, Ar);
 		}
-		client.ReceiveData();
+		else if (FParse::Command(&Cmd, TEXT("STORAGE")))
+		{
+			FString NumProfiles = FParse::Token(Cmd, false);
+			ATwitchHype* Settings = ATwitchHype::StaticClass()->GetDefaultObject<ATwitchHype>();
+			FTwitchHypeBenchmark::RunStorage(Settings->StorageProfile, NumProfiles.IsEmpty() ? 10000 : FCString::Atoi(*NumProfiles), Settings->PersistBatchSize, Ar);
+		}
+
+		return true;
+	}
+
+	return false;
+}
+
+void FTwitchHype::Tick(float DeltaTime)
+{
+	if (GIsEditor)
+	{
+		return;
+	}
+
+	// Connects, registers, joins and reconnects as the server answers, and handles what it sent
+	client.Tick();
+
+	Cooldowns.Advance(FPlatformTime::Seconds());
+
+	// Just a copy into the worker's queue, the database is written on its thread
+	if (Persistence)
+	{
+		QueueDirtyProfiles();
+		Persistence->Tick();
 	}
 	
 	for (auto Iter = DelayedEvents.CreateIterator(); Iter; ++Iter)
@@ -246,168 +723,132 @@ void FTwitchHype::Tick(float DeltaTime)
 			if (Iter->EventType == TEXT("BettingClosed"))
 			{
 				bBettingOpen = false;
-				FString InProgress = FString::Printf(TEXT("PRIVMSG %s :The match is starting, betting is now closed!"), *ChannelName);
-				client.SendIRC(TCHAR_TO_ANSI(*InProgress));
+				Announce(ETwitchReply::BettingClosed);
 			}
 
 			if (Iter->EventType == TEXT("FirstBlood"))
 			{
-				FString FirstBlood = FString::Printf(TEXT("PRIVMSG %s :First Blood goes to %s!"), *ChannelName, *Iter->Winner);
-				client.SendIRC(TCHAR_TO_ANSI(*FirstBlood));
+				Announce(ETwitchReply::FirstBlood, { Iter->Winner });
 
-				int32 MoneyWon = 0;
-				int32 HouseTake = 0;
-				AwardBets(Iter->Winner, MoneyWon, HouseTake, ActiveFirstBloodBets);
+				for (FTwitchChannel& Channel : Channels)
+				{
+					int32 MoneyWon = 0;
+					int32 HouseTake = 0;
+					AwardBets(Iter->Winner, MoneyWon, HouseTake, Channel.ActiveFirstBloodBets);
 
-				FString BettingStats = FString::Printf(TEXT("PRIVMSG %s :Betting stats: %d credits paid out, %d credits lost"), *ChannelName, MoneyWon, HouseTake);
-				client.SendIRC(TCHAR_TO_ANSI(*BettingStats));
+					Reply(Channel, ETwitchReply::BettingStats, { MoneyWon, HouseTake }, IRC_PRIORITY_ANNOUNCEMENT);
+				}
 			}
 
 			if (Iter->EventType == TEXT("FirstSuicide"))
 			{
-				FString FirstBlood = FString::Printf(TEXT("PRIVMSG %s :First Suicide goes to %s!"), *ChannelName, *Iter->Winner);
-				client.SendIRC(TCHAR_TO_ANSI(*FirstBlood));
+				Announce(ETwitchReply::FirstSuicide, { Iter->Winner });
 
-				int32 MoneyWon = 0;
-				int32 HouseTake = 0;
-				AwardBets(Iter->Winner, MoneyWon, HouseTake, ActiveFirstSuicideBets);
+				for (FTwitchChannel& Channel : Channels)
+				{
+					int32 MoneyWon = 0;
+					int32 HouseTake = 0;
+					AwardBets(Iter->Winner, MoneyWon, HouseTake, Channel.ActiveFirstSuicideBets);
 
-				FString BettingStats = FString::Printf(TEXT("PRIVMSG %s :Betting stats: %d credits paid out, %d credits lost"), *ChannelName, MoneyWon, HouseTake);
-				client.SendIRC(TCHAR_TO_ANSI(*BettingStats));
+					Reply(Channel, ETwitchReply::BettingStats, { MoneyWon, HouseTake }, IRC_PRIORITY_ANNOUNCEMENT);
+				}
 			}
 
 			if (Iter->EventType == TEXT("MatchEnd"))
 			{
-				FString WaitingPostMatch = FString::Printf(TEXT("PRIVMSG %s :The match is over, thanks for betting!"), *ChannelName);
-				client.SendIRC(TCHAR_TO_ANSI(*WaitingPostMatch));
+				Announce(ETwitchReply::MatchOver);
 
-				int32 MoneyWon = 0;
-				int32 HouseTake = 0;
-				AwardBets(Iter->Winner, MoneyWon, HouseTake, ActiveBets);
+				for (FTwitchChannel& Channel : Channels)
+				{
+					int32 MoneyWon = 0;
+					int32 HouseTake = 0;
+					AwardBets(Iter->Winner, MoneyWon, HouseTake, Channel.ActiveBets);
 
-				FString BettingStats = FString::Printf(TEXT("PRIVMSG %s :Betting stats: %d credits paid out, %d credits lost"), *ChannelName, MoneyWon, HouseTake);
-				client.SendIRC(TCHAR_TO_ANSI(*BettingStats));
+					Reply(Channel, ETwitchReply::BettingStats, { MoneyWon, HouseTake }, IRC_PRIORITY_ANNOUNCEMENT);
+				}
 
 				ActivePlayers.Empty();
+				CheckpointDatabase();
 			}
 
 			DelayedEvents.RemoveAt(Iter.GetIndex());
 		}
 	}
+
+	// Everything queued this tick, as far as the rate limit allows
+	client.FlushSendQueue();
 }
 
-void FTwitchHype::OnPrivMsg(IRCMessage message)
+void FTwitchHype::OnPrivMsg(const IRCMessage& message)
 {	
-	std::string text = message.parameters.at(message.parameters.size() - 1);
-	FString Command(text.c_str());
-	FString Username(message.prefix.nick.c_str());
+	IRCStringView text = message.parameters.back();
 
-	if (text == "!register")
-	{		
-		if (InMemoryProfiles.Find(Username) == nullptr)
-		{
-			FUserProfile Profile;
-			Profile.credits = InitialCredits;
-			Profile.bankrupts = 0;
-			InMemoryProfiles.Add(Username, Profile);
-			
-			// mirror memory back to the database, %Q will try to escape any injection hacks
-			char *zSQL = sqlite3_mprintf("INSERT INTO Users (name, credits, bankrupts) VALUES (%Q, %d, %d)", message.prefix.nick.c_str(), Profile.credits, 0);
-			sqlite3_exec(db, zSQL, 0, 0, 0);
-			sqlite3_free(zSQL);
-
-			FString AccountCreated = FString::Printf(TEXT("PRIVMSG %s :Account created for %s!"), *ChannelName, *Username);
-			client.SendIRC(TCHAR_TO_ANSI(*AccountCreated));
-		}
-		else
-		{
-			FString AccountCreated = FString::Printf(TEXT("PRIVMSG %s :Account already exists for %s!"), *ChannelName, *Username);
-			client.SendIRC(TCHAR_TO_ANSI(*AccountCreated));
-		}
+	// Plain chat never gets past here
+	if (text.empty() || text[0] != '!')
+	{
+		return;
+	}
 
+	FTwitchChatCommand ParsedCommand;
+	ParsedCommand.Tokenize(text, 0);
+	const FTwitchCommandInfo* Info = Commands.Find(ParsedCommand.Token(0));
+	if (Info == nullptr)
+	{
 		return;
 	}
 
-	if (text == "!credits")
+	// Replies go back where the message came from, and only that channel's bets are touched
+	FTwitchChannel* ChannelPtr = FindChannel(message.parameters.at(0));
+	if (ChannelPtr == nullptr)
 	{
-		FUserProfile* Profile = InMemoryProfiles.Find(Username);
-		if (Profile != nullptr)
-		{
-			FString AccountCredits = FString::Printf(TEXT("PRIVMSG %s :%s you have %d credits."), *ChannelName, *Username, Profile->credits);
-			client.SendIRC(TCHAR_TO_ANSI(*AccountCredits));
+		return;
+	}
+	FTwitchChannel& Channel = *ChannelPtr;
 
-		}
-		else
-		{
-			FString NoAccountCreated = FString::Printf(TEXT("PRIVMSG %s :No account exists for %s, please use !register"), *ChannelName, *Username);
-			client.SendIRC(TCHAR_TO_ANSI(*NoAccountCreated));
-		}
+	IRCStringView Username = message.prefix.nick;
+
+	// Without the twitch.tv/tags capability there's no id to go by, only the name
+	uint64 UserId = message.UserId();
+	if (UserId == 0)
+	{
+		UserId = UserKeyFromName(Username);
+	}
 
+	// Repeats inside the cooldown aren't answered at all, a reply would spend the rate limit the spam is eating into
+	double Now = FPlatformTime::Seconds();
+	if (Cooldowns.Remaining(UserId, Info->Id, Now) > 0)
+	{
+		CommandsOnCooldown++;
 		return;
 	}
 
-	TArray<FString> ParsedCommand;
-	Command.ParseIntoArrayWS(&ParsedCommand);
-	if (ParsedCommand.Num() > 0)
+	FUserProfile* Profile = FindProfile(UserId, Username);
+	if (Profile == nullptr && Info->bNeedsProfile)
 	{
-		FUserProfile* Profile = InMemoryProfiles.Find(Username);
-		if (Profile != nullptr)
-		{
-			if (ParsedCommand[0] == TEXT("!bet"))
-			{
-				ParseABet(ParsedCommand, Profile, Username, ActiveBets);
-			}
-			else if (ParsedCommand[0] == TEXT("!firstbloodbet"))
-			{
-				ParseABet(ParsedCommand, Profile, Username, ActiveFirstBloodBets);
-			}
-			else if (ParsedCommand[0] == TEXT("!firstsuicidebet"))
-			{
-				ParseABet(ParsedCommand, Profile, Username, ActiveFirstSuicideBets);
-			}
-			else if (ParsedCommand[0] == TEXT("!top10"))
-			{
-				PrintTop10();
-			}
-			else if (ParsedCommand[0] == TEXT("!bankrupt"))
-			{
-				GiveExtraMoney(Profile, Username);
-			}
-			else if (ParsedCommand[0] == TEXT("!undobets"))
-			{
-				UndoBets(Profile, Username);
-			}
-			else if (ParsedCommand[0] == TEXT("!chat"))
-			{
-				SendChat(Command, Profile, Username);
-			}
-			else if (ParsedCommand[0] == TEXT("!taunt"))
-			{
-				SendTaunt(ParsedCommand, Profile, Username);
-			}
-			else if (ParsedCommand[0] == TEXT("!feigndeath"))
-			{
-				SendFeignDeath(ParsedCommand, Profile, Username);
-			}
-			else if (ParsedCommand[0] == TEXT("!armor"))
-			{
-				SendArmor(ParsedCommand, Profile, Username);
-			}
-			else if (ParsedCommand[0] == TEXT("!redeemer"))
-			{
-				SendRedeemer(ParsedCommand, Profile, Username);
-			}
-			else if (ParsedCommand[0] == TEXT("!hat"))
-			{
-				SendHat(ParsedCommand, Profile, Username);
-			}
-		}
-		else if (ParsedCommand[0][0] == TEXT('!'))
-		{
-			FString NoAccountCreated = FString::Printf(TEXT("PRIVMSG %s :No account exists for %s, please use !register"), *ChannelName, *Username);
-			client.SendIRC(TCHAR_TO_ANSI(*NoAccountCreated));
-		}
+		ReplyTo(Channel, Username, ETwitchReply::NoAccount, { Username });
+		return;
 	}
+
+	// Only as much of the message as the command reads
+	ParsedCommand.Tokenize(text, Info->MaxArgs);
+	ParsedCommand.UserId = UserId;
+	ParsedCommand.Cost = Info->Cost;
+
+	if (ParsedCommand.Num() - 1 < Info->MinArgs)
+	{
+		ReplyTo(Channel, Username, ETwitchReply::Usage, { Username, Info->Usage });
+		return;
+	}
+
+	if (Info->Cost > 0 && Profile->credits < Info->Cost)
+	{
+		ReplyTo(Channel, Username, ETwitchReply::InsufficientCredits, { Username, Info->Cost, Info->Action, Profile->credits });
+		return;
+	}
+
+	// Only once the command goes through, a viewer fixing a mistake isn't made to wait
+	Cooldowns.Start(UserId, Info->Id, Info->Cooldown >= 0 ? Info->Cooldown : DefaultCommandCooldown, Now);
+	Info->Handler(*this, Channel, ParsedCommand, Profile, Username);
 	/*
 	//@debug
 	for (int32 i = 0; i < KnownWorlds.Num(); i++)
@@ -415,17 +856,43 @@ void FTwitchHype::OnPrivMsg(IRCMessage message)
 		AUTPlayerController* UTPC = Cast<AUTPlayerController>(GEngine->GetFirstLocalPlayerController(KnownWorlds[i]));
 		if (UTPC)
 		{
-			UTPC->ServerSay(ANSI_TO_TCHAR(text.c_str()), false);
+			UTPC->ServerSay(ANSI_TO_TCHAR(text.str().c_str()), false);
 		}
 	}*/
 }
 
+void FTwitchHype::RegisterAccount(const FTwitchChannel& Channel, uint64 UserId, IRCStringView Username)
+{
+	if (FindProfile(UserId, Username) == nullptr)
+	{
+		FUserProfile Profile;
+		Profile.userid = UserId;
+		Profile.name = Username.str();
+		Profile.credits = InitialCredits;
+		Profile.bankrupts = 0;
+		InMemoryProfiles.Add(UserId, Profile);
+		
+		// mirror memory back to the database
+		QueueProfileChange(ETwitchProfileChange::Insert, Profile);
+
+		ReplyTo(Channel, Username, ETwitchReply::AccountCreated, { Username });
+	}
+	else
+	{
+		ReplyTo(Channel, Username, ETwitchReply::AccountExists, { Username });
+	}
+}
+
+void FTwitchHype::PrintCredits(const FTwitchChannel& Channel, FUserProfile* Profile, IRCStringView Username)
+{
+	ReplyTo(Channel, Username, ETwitchReply::Credits, { Username, Profile->credits });
+}
+
 void FTwitchHype::PostPlayerInit(UWorld* World, AUTGameMode* GM, AController* C)
 {
 	if (C != nullptr && C->PlayerState != nullptr && !C->PlayerState->bOnlySpectator)
 	{
-		FString PlayerJoined = FString::Printf(TEXT("PRIVMSG %s :%s has joined the game!"), *ChannelName, *C->PlayerState->PlayerName);
-		client.SendIRC(TCHAR_TO_ANSI(*PlayerJoined));
+		Announce(ETwitchReply::PlayerJoined, { C->PlayerState->PlayerName });
 		ActivePlayers.Add(C->PlayerState->PlayerName);
 	}
 }
@@ -434,8 +901,7 @@ void FTwitchHype::NotifyMatchStateChange(UWorld* World, AUTGameMode* GM, FName N
 {
 	if (NewState == MatchState::EnteringMap)
 	{
-		FString EnteringMap = FString::Printf(TEXT("PRIVMSG %s :We've started %s map!"), *ChannelName, *World->GetMapName());
-		client.SendIRC(TCHAR_TO_ANSI(*EnteringMap));
+		Announce(ETwitchReply::EnteringMap, { World->GetMapName() });
 		ActivePlayers.Empty();
 		bBettingOpen = true;
 	}
@@ -453,6 +919,7 @@ void FTwitchHype::NotifyMatchStateChange(UWorld* World, AUTGameMode* GM, FName N
 		else
 		{
 			ForgiveBets();
+			CheckpointDatabase();
 		}
 	}
 	else if (NewState == MatchState::InProgress)
@@ -468,15 +935,14 @@ void FTwitchHype::NotifyMatchStateChange(UWorld* World, AUTGameMode* GM, FName N
 	}
 	else if (NewState == MatchState::Aborted)
 	{
-		FString Aborted = FString::Printf(TEXT("PRIVMSG %s :The match was aborted, active bets are forgiven!"), *ChannelName);
-		client.SendIRC(TCHAR_TO_ANSI(*Aborted));
+		Announce(ETwitchReply::Aborted);
 
 		ForgiveBets();
+		CheckpointDatabase();
 	}
 	else if (NewState == MatchState::WaitingToStart)
 	{
-		FString WaitingToStart = FString::Printf(TEXT("PRIVMSG %s :The match is waiting to start on %s!"), *ChannelName, *World->GetMapName());
-		client.SendIRC(TCHAR_TO_ANSI(*WaitingToStart));
+		Announce(ETwitchReply::WaitingToStart, { World->GetMapName() });
 		bBettingOpen = true;
 	}
 	// Not exposed yet due to missing UNREALTOURNAMENT_API
@@ -521,32 +987,93 @@ void FTwitchHype::ScoreKill(UWorld* World, AUTGameMode* GM, AController* Killer,
 
 void FTwitchHype::ForgiveBets()
 {
-	for (auto It = ActiveBets.CreateConstIterator(); It; ++It)
+	for (FTwitchChannel& Channel : Channels)
+	{
+		for (auto It = Channel.ActiveBets.CreateConstIterator(); It; ++It)
+		{
+			RefundBet(It.Key(), It.Value().amount);
+		}
+		Channel.ActiveBets.Empty();
+
+		for (auto It = Channel.ActiveFirstBloodBets.CreateConstIterator(); It; ++It)
+		{
+			RefundBet(It.Key(), It.Value().amount);
+		}
+		Channel.ActiveFirstBloodBets.Empty();
+
+		for (auto It = Channel.ActiveFirstSuicideBets.CreateConstIterator(); It; ++It)
+		{
+			RefundBet(It.Key(), It.Value().amount);
+		}
+		Channel.ActiveFirstSuicideBets.Empty();
+	}
+}
+
+void FTwitchHype::RefundBet(uint64 UserId, int32 Amount)
+{
+	FUserProfile* Profile = InMemoryProfiles.Find(UserId);
+	if (Profile == nullptr)
 	{
-		InMemoryProfiles[It.Key()].credits += It.Value().amount;
+		UE_LOG(LogUTTwitchHype, Warning, TEXT("No profile %llu to refund a bet to"), UserId);
+		return;
 	}
-	ActiveBets.Empty();
+	ChangeCredits(*Profile, Amount);
+}
 
-	for (auto It = ActiveFirstBloodBets.CreateConstIterator(); It; ++It)
+FTwitchChannel* FTwitchHype::FindChannel(IRCStringView Name)
+{
+	for (FTwitchChannel& Channel : Channels)
 	{
-		InMemoryProfiles[It.Key()].credits += It.Value().amount;
+		if (Name.equals_nocase(Channel.Name))
+		{
+			return &Channel;
+		}
 	}
-	ActiveFirstBloodBets.Empty();
 
-	for (auto It = ActiveFirstSuicideBets.CreateConstIterator(); It; ++It)
+	return nullptr;
+}
+
+void FTwitchHype::Announce(ETwitchReply::Type Id, FTwitchReplyArgs Args)
+{
+	for (const FTwitchChannel& Channel : Channels)
 	{
-		InMemoryProfiles[It.Key()].credits += It.Value().amount;
+		Reply(Channel, Id, Args, IRC_PRIORITY_ANNOUNCEMENT);
 	}
-	ActiveFirstSuicideBets.Empty();
 }
 
-void FTwitchHype::AwardBets(const FString& Winner, int32& MoneyWon, int32& HouseTake, TMap<FString, FActiveBet>& BetMap)
+IRCStringView FTwitchHype::ReplyLine(const FTwitchChannel& Channel, ETwitchReply::Type Id, FTwitchReplyArgs Args)
+{
+	// Scratch for this tick only, the send queue copies the line into a slot that keeps its buffer
+	size_t Capacity = Replies[Id].MaxLength(Args);
+	char* Line = (char*)client.FrameArena().Allocate(Channel.Prefix.size() + Capacity, 1);
+	FMemory::Memcpy(Line, Channel.Prefix.data(), Channel.Prefix.size());
+	size_t Length = Channel.Prefix.size() + Replies[Id].Render(Line + Channel.Prefix.size(), Capacity, Args);
+	return IRCStringView(Line, Length);
+}
+
+void FTwitchHype::Reply(const FTwitchChannel& Channel, ETwitchReply::Type Id, FTwitchReplyArgs Args, IRCSendPriority Priority)
+{
+	client.SendIRC(ReplyLine(Channel, Id, Args), Priority);
+}
+
+void FTwitchHype::ReplyTo(const FTwitchChannel& Channel, IRCStringView Username, ETwitchReply::Type Id, FTwitchReplyArgs Args, IRCSendPriority Priority)
+{
+	client.SendIRC(ReplyLine(Channel, Id, Args), Priority, Username);
+}
+
+void FTwitchHype::AwardBets(const FString& Winner, int32& MoneyWon, int32& HouseTake, TMap<uint64, FActiveBet>& BetMap)
 {
 	for (auto It = BetMap.CreateConstIterator(); It; ++It)
 	{
 		if (It.Value().winner == Winner)
 		{
-			InMemoryProfiles[It.Key()].credits += It.Value().amount * It.Value().odds;
+			FUserProfile* Profile = InMemoryProfiles.Find(It.Key());
+			if (Profile == nullptr)
+			{
+				UE_LOG(LogUTTwitchHype, Warning, TEXT("No profile %llu to pay a bet to"), It.Key());
+				continue;
+			}
+			ChangeCredits(*Profile, It.Value().amount * It.Value().odds);
 			MoneyWon += It.Value().amount;
 		}
 		else
@@ -557,167 +1084,160 @@ void FTwitchHype::AwardBets(const FString& Winner, int32& MoneyWon, int32& House
 	BetMap.Empty();
 }
 
-void FTwitchHype::ParseABet(const TArray<FString>& ParsedCommand, FUserProfile* Profile, const FString& Username, TMap<FString, FActiveBet>& BetMap)
+void FTwitchHype::ParseABet(const FTwitchChannel& Channel, const FTwitchChatCommand& ParsedCommand, FUserProfile* Profile, IRCStringView Username, TMap<uint64, FActiveBet>& BetMap)
 {
 	if (!bBettingOpen)
 	{
-		FString InvalidBet = FString::Printf(TEXT("PRIVMSG %s :%s betting is not open right now!"), *ChannelName, *Username);
-		client.SendIRC(TCHAR_TO_ANSI(*InvalidBet));
+		ReplyTo(Channel, Username, ETwitchReply::BettingNotOpen, { Username });
 	}
-	else if (ParsedCommand.Num() < 3)
+	else if (BetMap.Find(Profile->userid))
 	{
-		FString InvalidBet = FString::Printf(TEXT("PRIVMSG %s :%s you must bet in the format \"%s <winner> <amount>\" !"), *ParsedCommand[0], *ChannelName, *Username);
-		client.SendIRC(TCHAR_TO_ANSI(*InvalidBet));
-	}
-	else if (BetMap.Find(Username))
-	{
-		FString InvalidBet = FString::Printf(TEXT("PRIVMSG %s :%s you've already placed a bet!"), *ChannelName, *Username);
-		client.SendIRC(TCHAR_TO_ANSI(*InvalidBet));
+		ReplyTo(Channel, Username, ETwitchReply::AlreadyBet, { Username });
 	}
 	else
 	{
-		FActiveBet NewBet;
-		NewBet.winner = ParsedCommand[1];
-		NewBet.amount = FCString::Atoi(*ParsedCommand[2]);
-		NewBet.odds = 2;
+		int32 Amount = ParsedCommand.Int(2);
 
 		// Need support for red and blue bets for teams, only works for duels and DM now
 
-		int32 ActivePlayerIndex = ActivePlayers.Find(NewBet.winner);
-
-		if (NewBet.amount > Profile->credits || NewBet.amount <= 0)
+		if (Amount > Profile->credits || Amount <= 0)
 		{
-			FString InvalidBet = FString::Printf(TEXT("PRIVMSG %s :%s you only have %d credits to wager!"), *ChannelName, *Username, Profile->credits);
-			client.SendIRC(TCHAR_TO_ANSI(*InvalidBet));
+			ReplyTo(Channel, Username, ETwitchReply::BetTooMuch, { Username, Profile->credits });
 		}
-		else if (NewBet.amount > MaxBet)
+		else if (Amount > MaxBet)
 		{
-			FString InvalidBet = FString::Printf(TEXT("PRIVMSG %s :%s %d is over the max bet value of %d!"), *ChannelName, *Username, NewBet.amount, MaxBet);
-			client.SendIRC(TCHAR_TO_ANSI(*InvalidBet));
-		}
-		else if (ActivePlayerIndex == INDEX_NONE)
-		{
-			FString InvalidBet = FString::Printf(TEXT("PRIVMSG %s :%s I'm sorry, but %s is not an active player in the match!"), *ChannelName, *Username, *NewBet.winner);
-			client.SendIRC(TCHAR_TO_ANSI(*InvalidBet));
+			ReplyTo(Channel, Username, ETwitchReply::BetOverMax, { Username, Amount, MaxBet });
 		}
 		else
 		{
-			BetMap.Add(Username, NewBet);
+			// Checked after the amount, so most rejected bets never convert the name
+			FActiveBet NewBet;
+			NewBet.winner = ParsedCommand[1];
+			NewBet.amount = Amount;
+			NewBet.odds = 2;
+
+			if (ActivePlayers.Find(NewBet.winner) == INDEX_NONE)
+			{
+				ReplyTo(Channel, Username, ETwitchReply::NotActivePlayer, { Username, ParsedCommand.Token(1) });
+				return;
+			}
+
+			BetMap.Add(Profile->userid, NewBet);
 
-			Profile->credits -= NewBet.amount;
+			ChangeCredits(*Profile, -NewBet.amount);
 
 			if (bPrintBetConfirmations)
 			{
-				FString PlacedBet = FString::Printf(TEXT("PRIVMSG %s :%s you've placed %d on %s using %s"), *ChannelName, *Username, NewBet.amount, *NewBet.winner, *ParsedCommand[0]);
-				client.SendIRC(TCHAR_TO_ANSI(*PlacedBet));
+				ReplyTo(Channel, Username, ETwitchReply::BetPlaced, { Username, NewBet.amount, NewBet.winner, ParsedCommand.Token(0) }, IRC_PRIORITY_CONFIRMATION);
 			}
 		}
 	}
 
 }
 
-void FTwitchHype::PrintTop10()
+void FTwitchHype::PrintTop10(FTwitchChannel& Channel)
 {
-	if (LastTop10Time > 0 && FPlatformTime::Seconds() - LastTop10Time < Top10CooldownTime)
+	if (Channel.LastTop10Time > 0 && FPlatformTime::Seconds() - Channel.LastTop10Time < Top10CooldownTime)
 	{
 		return;
 	}
 
-	// Ultra laziness, let the db do the sorting
-	FlushToDB();
-
-	FString QueryCommand = TEXT("SELECT name, credits FROM Users ORDER BY credits DESC LIMIT 10");
-	sqlite3_stmt *sqlStatement;
-	if (sqlite3_prepare_v2(db, TCHAR_TO_ANSI(*QueryCommand), -1, &sqlStatement, NULL) == SQLITE_OK)
+	// Every profile is in memory, and the database can be a few seconds behind it
+	const FUserProfile* Top[10];
+	int32 NumTop = 0;
+	for (const auto& Pair : InMemoryProfiles)
 	{
-		int32 Place = 1;
-		while (sqlite3_step(sqlStatement) == SQLITE_ROW)
+		const FUserProfile& Profile = Pair.Value;
+		if (NumTop == (int32)ARRAY_COUNT(Top) && Profile.credits <= Top[NumTop - 1]->credits)
+		{
+			continue;
+		}
+
+		// Insertion sort, with a full list the last one drops off
+		int32 Slot = FMath::Min(NumTop, (int32)ARRAY_COUNT(Top) - 1);
+		while (Slot > 0 && Top[Slot - 1]->credits < Profile.credits)
 		{
-			FString Name = FString(ANSI_TO_TCHAR((const char*)sqlite3_column_text(sqlStatement, 0)));
-			int32 Credits = sqlite3_column_int(sqlStatement, 1);
-			
-			FString Top10Text = FString::Printf(TEXT("PRIVMSG %s :%d. %s - %d"), *ChannelName, Place, *Name, Credits);
-			client.SendIRC(TCHAR_TO_ANSI(*Top10Text));
-			Place++;
+			Top[Slot] = Top[Slot - 1];
+			Slot--;
 		}
+		Top[Slot] = &Profile;
+		NumTop = FMath::Min(NumTop + 1, (int32)ARRAY_COUNT(Top));
+	}
+
+	for (int32 Place = 0; Place < NumTop; Place++)
+	{
+		Reply(Channel, ETwitchReply::Top10, { Place + 1, Top[Place]->name, Top[Place]->credits });
 	}
-	sqlite3_finalize(sqlStatement);
-	LastTop10Time = FPlatformTime::Seconds();
+	Channel.LastTop10Time = FPlatformTime::Seconds();
 }
 
-void FTwitchHype::GiveExtraMoney(FUserProfile* Profile, const FString& Username)
+void FTwitchHype::GiveExtraMoney(const FTwitchChannel& Channel, FUserProfile* Profile, IRCStringView Username)
 {
-	if (Profile->credits < InitialCredits && !HasActiveBets(Username))
+	if (Profile->credits < InitialCredits && !HasActiveBets(Profile->userid))
 	{
 		Profile->credits = InitialCredits;
 		Profile->bankrupts++;
+		MarkDirty(*Profile);
 
-		FString Bankrupt = FString::Printf(TEXT("PRIVMSG %s :%s you've been restored to %d credits, you've gone bankrupt %d times"), *ChannelName, *Username, InitialCredits, Profile->bankrupts);
-		client.SendIRC(TCHAR_TO_ANSI(*Bankrupt));
+		ReplyTo(Channel, Username, ETwitchReply::Bankrupt, { Username, InitialCredits, Profile->bankrupts });
 	}
 }
 
-bool FTwitchHype::HasActiveBets(const FString& Username)
+bool FTwitchHype::HasActiveBets(uint64 UserId)
 {
-	if (ActiveBets.Find(Username))
+	for (const FTwitchChannel& Channel : Channels)
 	{
-		return true;
-	}
+		if (Channel.ActiveBets.Find(UserId))
+		{
+			return true;
+		}
 
-	if (ActiveFirstBloodBets.Find(Username))
-	{
-		return true;
-	}
+		if (Channel.ActiveFirstBloodBets.Find(UserId))
+		{
+			return true;
+		}
 
-	if (ActiveFirstSuicideBets.Find(Username))
-	{
-		return true;
+		if (Channel.ActiveFirstSuicideBets.Find(UserId))
+		{
+			return true;
+		}
 	}
 
 	return false;
 }
 
-void FTwitchHype::UndoBets(FUserProfile* Profile, const FString& Username)
+void FTwitchHype::UndoBets(FTwitchChannel& Channel, FUserProfile* Profile, IRCStringView Username)
 {
 	FActiveBet* ActiveBet = nullptr;
+	uint64 UserId = Profile->userid;
 	
-	ActiveBet = ActiveBets.Find(Username);
+	ActiveBet = Channel.ActiveBets.Find(UserId);
 	if (ActiveBet)
 	{
-		Profile->credits += ActiveBet->amount;
-		ActiveBets.Remove(Username);
+		ChangeCredits(*Profile, ActiveBet->amount);
+		Channel.ActiveBets.Remove(UserId);
 	}
 
-	ActiveBet = ActiveFirstBloodBets.Find(Username);
+	ActiveBet = Channel.ActiveFirstBloodBets.Find(UserId);
 	if (ActiveBet)
 	{
-		Profile->credits += ActiveBet->amount;
-		ActiveFirstBloodBets.Remove(Username);
+		ChangeCredits(*Profile, ActiveBet->amount);
+		Channel.ActiveFirstBloodBets.Remove(UserId);
 	}
 
-	ActiveBet = ActiveFirstSuicideBets.Find(Username);
+	ActiveBet = Channel.ActiveFirstSuicideBets.Find(UserId);
 	if (ActiveBet)
 	{
-		Profile->credits += ActiveBet->amount;
-		ActiveFirstSuicideBets.Remove(Username);
+		ChangeCredits(*Profile, ActiveBet->amount);
+		Channel.ActiveFirstSuicideBets.Remove(UserId);
 	}
 }
 
-void FTwitchHype::SendChat(const FString& Command, FUserProfile* Profile, const FString& Username)
+void FTwitchHype::SendChat(const FTwitchChannel& Channel, const FTwitchChatCommand& ParsedCommand, FUserProfile* Profile, IRCStringView Username)
 {
-	if (Profile->credits < ChatCost)
-	{
-		FString InsufficientCredits = FString::Printf(TEXT("PRIVMSG %s :%s, it costs %d to chat, you only have %d!"), *ChannelName, *Username, ChatCost, Profile->credits);
-		client.SendIRC(TCHAR_TO_ANSI(*InsufficientCredits));
+	ChangeCredits(*Profile, -ParsedCommand.Cost);
 
-		return;
-	}
-
-	Profile->credits -= ChatCost;
-
-	FString ChatText = Command;
-	ChatText.RemoveFromStart(TEXT("!chat "));
-	FString Message = Username + TEXT(" says: ") + ChatText;
+	FString Message = Utf8ToFString(Username) + TEXT(" says: ") + Utf8ToFString(ParsedCommand.Rest(1));
 	
 	for (auto World : KnownWorlds)
 	{
@@ -732,17 +1252,9 @@ void FTwitchHype::SendChat(const FString& Command, FUserProfile* Profile, const
 	}
 }
 
-void FTwitchHype::SendTaunt(const TArray<FString>& ParsedCommand, FUserProfile* Profile, const FString& Username)
+void FTwitchHype::SendTaunt(const FTwitchChannel& Channel, const FTwitchChatCommand& ParsedCommand, FUserProfile* Profile, IRCStringView Username)
 {
-	if (Profile->credits < TauntCost)
-	{
-		FString InsufficientCredits = FString::Printf(TEXT("PRIVMSG %s :%s, it costs %d to taunt, you only have %d!"), *ChannelName, *Username, TauntCost, Profile->credits);
-		client.SendIRC(TCHAR_TO_ANSI(*InsufficientCredits));
-
-		return;
-	}
-
-	Profile->credits -= TauntCost;
+	ChangeCredits(*Profile, -ParsedCommand.Cost);
 	for (auto World : KnownWorlds)
 	{
 		for (FConstPawnIterator Iterator = World->GetPawnIterator(); Iterator; ++Iterator)
@@ -756,17 +1268,9 @@ void FTwitchHype::SendTaunt(const TArray<FString>& ParsedCommand, FUserProfile*
 	}
 }
 
-void FTwitchHype::SendFeignDeath(const TArray<FString>& ParsedCommand, FUserProfile* Profile, const FString& Username)
+void FTwitchHype::SendFeignDeath(const FTwitchChannel& Channel, const FTwitchChatCommand& ParsedCommand, FUserProfile* Profile, IRCStringView Username)
 {
-	if (Profile->credits < FeignDeathCost)
-	{
-		FString InsufficientCredits = FString::Printf(TEXT("PRIVMSG %s :%s, it costs %d to feign death, you only have %d!"), *ChannelName, *Username, FeignDeathCost, Profile->credits);
-		client.SendIRC(TCHAR_TO_ANSI(*InsufficientCredits));
-
-		return;
-	}
-
-	Profile->credits -= FeignDeathCost;
+	ChangeCredits(*Profile, -ParsedCommand.Cost);
 	for (auto World : KnownWorlds)
 	{
 		for (FConstPawnIterator Iterator = World->GetPawnIterator(); Iterator; ++Iterator)
@@ -780,24 +1284,8 @@ void FTwitchHype::SendFeignDeath(const TArray<FString>& ParsedCommand, FUserProf
 	}
 }
 
-void FTwitchHype::SendArmor(const TArray<FString>& ParsedCommand, FUserProfile* Profile, const FString& Username)
+void FTwitchHype::SendArmor(const FTwitchChannel& Channel, const FTwitchChatCommand& ParsedCommand, FUserProfile* Profile, IRCStringView Username)
 {
-	if (Profile->credits < ArmorCost)
-	{
-		FString InsufficientCredits = FString::Printf(TEXT("PRIVMSG %s :%s, it costs %d to send armor, you only have %d!"), *ChannelName, *Username, ArmorCost, Profile->credits);
-		client.SendIRC(TCHAR_TO_ANSI(*InsufficientCredits));
-
-		return;
-	}
-	
-	if (ParsedCommand.Num() < 2)
-	{
-		FString InvalidCommand = FString::Printf(TEXT("PRIVMSG %s :%s, please use the form !armor <playername>"), *ChannelName, *Username);
-		client.SendIRC(TCHAR_TO_ANSI(*InvalidCommand));
-
-		return;
-	}
-
 	FString ArmorPackageName;
 	UClass* ArmorClass = nullptr;
 	if (FPackageName::SearchForPackageOnDisk(TEXT("Armor_Helmet"), &ArmorPackageName))
@@ -806,6 +1294,9 @@ void FTwitchHype::SendArmor(const TArray<FString>& ParsedCommand, FUserProfile*
 		ArmorClass = LoadClass<AUTInventory>(NULL, *ArmorPackageName, NULL, LOAD_NoWarn, NULL);
 	}
 
+	// Converted once rather than for every pawn it's checked against
+	FString Target = ParsedCommand[1];
+
 	for (auto World : KnownWorlds)
 	{
 		for (FConstPawnIterator Iterator = World->GetPawnIterator(); Iterator; ++Iterator)
@@ -813,10 +1304,10 @@ void FTwitchHype::SendArmor(const TArray<FString>& ParsedCommand, FUserProfile*
 			AUTCharacter* UTChar = Cast<AUTCharacter>(*Iterator);
 			if (UTChar && UTChar->PlayerState)
 			{
-				if (ParsedCommand[1] == UTChar->PlayerState->PlayerName)
+				if (Target == UTChar->PlayerState->PlayerName)
 				{
 					UTChar->AddInventory(UTChar->GetWorld()->SpawnActor<AUTArmor>(ArmorClass, FVector(0.0f), FRotator(0, 0, 0)), true);
-					Profile->credits -= ArmorCost;
+					ChangeCredits(*Profile, -ParsedCommand.Cost);
 				}
 			}
 		}
@@ -824,16 +1315,8 @@ void FTwitchHype::SendArmor(const TArray<FString>& ParsedCommand, FUserProfile*
 
 }
 
-void FTwitchHype::SendRedeemer(const TArray<FString>& ParsedCommand, FUserProfile* Profile, const FString& Username)
+void FTwitchHype::SendRedeemer(const FTwitchChannel& Channel, const FTwitchChatCommand& ParsedCommand, FUserProfile* Profile, IRCStringView Username)
 {
-	if (Profile->credits < RedeemerCost)
-	{
-		FString InsufficientCredits = FString::Printf(TEXT("PRIVMSG %s :%s, it costs %d to send a redeemer, you only have %d!"), *ChannelName, *Username, RedeemerCost, Profile->credits);
-		client.SendIRC(TCHAR_TO_ANSI(*InsufficientCredits));
-
-		return;
-	}
-
 	FString RedeemerPackageName;
 	UClass* RedeemerClass = nullptr;
 	if (FPackageName::SearchForPackageOnDisk(TEXT("BP_Redeemer"), &RedeemerPackageName))
@@ -852,28 +1335,20 @@ void FTwitchHype::SendRedeemer(const TArray<FString>& ParsedCommand, FUserProfil
 				if (RedeemerClass)
 				{
 					UTChar->AddInventory(UTChar->GetWorld()->SpawnActor<AUTInventory>(RedeemerClass, FVector(0.0f), FRotator(0, 0, 0)), true);
-					Profile->credits -= RedeemerCost;
+					ChangeCredits(*Profile, -ParsedCommand.Cost);
 				}				
 			}
 		}
 	}
 }
 
-void FTwitchHype::SendHat(const TArray<FString>& ParsedCommand, FUserProfile* Profile, const FString& Username)
+void FTwitchHype::SendHat(const FTwitchChannel& Channel, const FTwitchChatCommand& ParsedCommand, FUserProfile* Profile, IRCStringView Username)
 {
-	if (Profile->credits < HatCost)
-	{
-		FString InsufficientCredits = FString::Printf(TEXT("PRIVMSG %s :%s, it costs %d to send a hat, you only have %d!"), *ChannelName, *Username, HatCost, Profile->credits);
-		client.SendIRC(TCHAR_TO_ANSI(*InsufficientCredits));
-
-		return;
-	}
-
 	FString HatPackageName;
 	if (FPackageName::SearchForPackageOnDisk(ParsedCommand[1], &HatPackageName))
 	{
 		HatPackageName += TEXT(".") + ParsedCommand[1] + TEXT("_C");
-		Profile->credits -= HatCost;
+		ChangeCredits(*Profile, -ParsedCommand.Cost);
 	}
 	else
 	{
@@ -4,11 +4,68 @@
 #include "Core.h"
 #include "UnrealTournament.h"
 #include "IRCClient.h"
-#include "sqlite3.h"
+#include "TwitchHypeText.h"
+#include "TwitchHypeCommands.h"
+#include "TwitchHypeCooldowns.h"
+#include "TwitchHypePersistence.h"
 #include "TwitchHype.generated.h"
 
 DECLARE_LOG_CATEGORY_EXTERN(LogUTTwitchHype, Log, All);
 
+USTRUCT()
+struct FTwitchCommandCooldown
+{
+	GENERATED_USTRUCT_BODY()
+
+	/** With the '!', as in "!credits" */
+	UPROPERTY()
+	FString Command;
+
+	UPROPERTY()
+	float Seconds;
+};
+
+USTRUCT()
+struct FTwitchStorageProfile
+{
+	GENERATED_USTRUCT_BODY()
+
+	/** Commits append to a write-ahead log instead of going through a rollback journal, and a reader never waits on the writer */
+	UPROPERTY()
+	bool bWriteAheadLog;
+
+	/** As PRAGMA synchronous takes it, 0 OFF, 1 NORMAL, 2 FULL. With the write-ahead log NORMAL only syncs at checkpoints and still can't corrupt the database */
+	UPROPERTY()
+	int32 Synchronous;
+
+	/** Megabytes of the database read through a memory map rather than read calls, 0 turns it off */
+	UPROPERTY()
+	int32 MmapSizeMB;
+
+	/** Kilobytes of database pages kept in memory */
+	UPROPERTY()
+	int32 CacheSizeKB;
+
+	/** Keeps temporary tables, like the ones ORDER BY sorts in, in memory */
+	UPROPERTY()
+	bool bTempStoreMemory;
+
+	/** Write-ahead log pages past which it's checkpointed mid match rather than after it, 0 only checkpoints between matches */
+	UPROPERTY()
+	int32 CheckpointPages;
+
+	/** What plain sqlite3_open gives you */
+	FTwitchStorageProfile()
+		: bWriteAheadLog(false)
+		, Synchronous(2)
+		, MmapSizeMB(0)
+		, CacheSizeKB(2000)
+		, bTempStoreMemory(false)
+		, CheckpointPages(1000)
+	{
+	}
+};
+
 // Abuse this class for config cache use
 UCLASS(Blueprintable, Meta = (ChildCanTick), Config = TwitchHype)
 class ATwitchHype : public AActor
@@ -23,6 +80,18 @@ class ATwitchHype : public AActor
 
 	UPROPERTY(config)
 	FString ChannelName;
+
+	/** More channels to run the bot in over the same connection, each with its own bets */
+	UPROPERTY(config)
+	TArray<FString> AdditionalChannels;
+
+	/** Extra accounts that only send chat, replies are spread over them and BotNickname so each account's rate limit only sees its share */
+	UPROPERTY(config)
+	TArray<FString> WriterNicknames;
+
+	/** OAuth tokens for WriterNicknames, in the same order */
+	UPROPERTY(config)
+	TArray<FString> WriterOAuths;
 	
 	UPROPERTY(config)
 	double TopTenCooldownTime;
@@ -65,6 +134,90 @@ class ATwitchHype : public AActor
 
 	UPROPERTY(config)
 	float BettingCloseDelayTime;
+
+	/** Seconds before a viewer can use the same command again, anything sooner is ignored */
+	UPROPERTY(config)
+	float DefaultCommandCooldown;
+
+	/** Commands that don't use DefaultCommandCooldown, as +CommandCooldowns=(Command="!top10",Seconds=30) lines */
+	UPROPERTY(config)
+	TArray<FTwitchCommandCooldown> CommandCooldowns;
+
+	/** Messages allowed per 30 seconds, 20 for a normal account or 100 if the bot is a moderator */
+	UPROPERTY(config)
+	int32 ChatRateLimit;
+
+	/** How many of those can go out back to back before the rest are spaced out */
+	UPROPERTY(config)
+	int32 ChatRateBurst;
+
+	/** Replies beyond this are dropped, least important first */
+	UPROPERTY(config)
+	int32 ChatQueueMaxDepth;
+
+	/** Messages allowed per 30 seconds in any one channel, 0 uses ChatRateLimit. The account's limit still applies on top */
+	UPROPERTY(config)
+	int32 ChannelChatRateLimit;
+
+	/** Seconds to resolve and connect to the chat server before giving up */
+	UPROPERTY(config)
+	float ConnectTimeout;
+
+	/** Moves socket reads and writes to their own thread, the game thread only parses what's ready */
+	UPROPERTY(config)
+	bool bUseNetworkThread;
+
+	/** Upper bound on chat lines handled per tick, anything over waits for the next one */
+	UPROPERTY(config)
+	int32 MaxLinesPerTick;
+
+	/** Sends chat lines as soon as they're written instead of letting the OS batch them */
+	UPROPERTY(config)
+	bool bTcpNoDelay;
+
+	/** Socket send buffer size in bytes, 0 keeps the OS default */
+	UPROPERTY(config)
+	int32 SendBufferSize;
+
+	/** Seconds before the second attempt at reconnecting, doubling with every failure after it */
+	UPROPERTY(config)
+	float ReconnectDelayMin;
+
+	/** Longest wait between reconnect attempts, also how long a connection has to stay up to reset the backoff */
+	UPROPERTY(config)
+	float ReconnectDelayMax;
+
+	/** Seconds between the bot's own PINGs to the server, 0 only answers the server's */
+	UPROPERTY(config)
+	float KeepaliveInterval;
+
+	/** Seconds without hearing anything from the server before the connection is given up on, 0 waits forever */
+	UPROPERTY(config)
+	float KeepaliveTimeout;
+
+	/** Seconds an account sits out after Twitch says it's sending too fast, its chat goes out on the other accounts meanwhile */
+	UPROPERTY(config)
+	float ThrottleTime;
+
+	/** Chat lines allowed to wait for their turn, 0 handles every line the tick it arrives */
+	UPROPERTY(config)
+	int32 InboundQueueMaxDepth;
+
+	/** Microseconds per tick spent handing queued chat to the bot, whatever's left waits for the next tick */
+	UPROPERTY(config)
+	int32 InboundBudgetMicroseconds;
+
+	/** Seconds between writes of changed profiles to the database, on its own thread */
+	UPROPERTY(config)
+	float PersistInterval;
+
+	/** Changed profiles that get written right away instead of waiting out PersistInterval */
+	UPROPERTY(config)
+	int32 PersistBatchSize;
+
+	/** How the database is opened, as StorageProfile=(bWriteAheadLog=true,Synchronous=1,...) */
+	UPROPERTY(config)
+	FTwitchStorageProfile StorageProfile;
 };
 
 struct FDelayedEvent
@@ -76,10 +229,20 @@ struct FDelayedEvent
 
 struct FUserProfile
 {
+	FUserProfile() : userid(0), credits(0), bankrupts(0), lastusetime(0), dirty(false) {}
+
+	// Twitch user id, or a hash of the name for accounts that haven't chatted since ids were tracked
+	uint64 userid;
+	// UTF-8, as it came from chat and as it's stored
+	std::string name;
+
 	int32 credits;
 	int32 bankrupts;
 
 	double lastusetime;
+
+	// Changed since it was last handed to the persistence worker, and listed in DirtyProfiles
+	bool dirty;
 };
 
 struct FActiveBet
@@ -91,9 +254,62 @@ struct FActiveBet
 	float odds;
 };
 
+// Every reply the bot makes, compiled from ReplyFormats in TwitchHype.cpp when it starts
+namespace ETwitchReply
+{
+	enum Type
+	{
+		Hello,
+		BettingClosed,
+		FirstBlood,
+		FirstSuicide,
+		BettingStats,
+		MatchOver,
+		NoAccount,
+		Usage,
+		InsufficientCredits,
+		AccountCreated,
+		AccountExists,
+		Credits,
+		PlayerJoined,
+		EnteringMap,
+		Aborted,
+		WaitingToStart,
+		BettingNotOpen,
+		AlreadyBet,
+		BetTooMuch,
+		BetOverMax,
+		NotActivePlayer,
+		BetPlaced,
+		Top10,
+		Bankrupt,
+
+		Count
+	};
+}
+
+// Everything that belongs to one channel. Profiles are shared, so a viewer's credits
+// follow them from channel to channel, but bets are only ever settled where they were made.
+struct FTwitchChannel
+{
+	FTwitchChannel() : LastTop10Time(0) {}
+
+	// UTF-8, with the '#'
+	std::string Name;
+	// "PRIVMSG #channel :", every reply starts with it
+	std::string Prefix;
+	double LastTop10Time;
+
+	// Keyed by the bettor's FUserProfile::userid
+	TMap<uint64, FActiveBet> ActiveBets;
+	TMap<uint64, FActiveBet> ActiveFirstBloodBets;
+	TMap<uint64, FActiveBet> ActiveFirstSuicideBets;
+};
+
 struct FTwitchHype : FTickableGameObject, FSelfRegisteringExec
 {
-	FTwitchHype();
+	/** Loads the profiles from the database at DatabasePath and saves them back there, with an empty path they only live in memory */
+	FTwitchHype(const FString& DatabasePath);
 	~FTwitchHype();
 	virtual void Tick(float DeltaTime);
 	virtual bool IsTickable() const { return true; }
@@ -116,14 +332,8 @@ struct FTwitchHype : FTickableGameObject, FSelfRegisteringExec
 	IRCClient client;
 
 	bool bAutoConnect;
-	bool bAuthenticated;
-	double AuthenticatedTime;
-	double JoinedTime;
-	double LastTop10Time;
 	double Top10CooldownTime;
 	int32 MaxBet;
-	bool bJoinedChannel;
-	bool bAnnounced;
 	FString ChannelName;
 	FString BotNickname;
 	FString OAuth;
@@ -131,6 +341,7 @@ struct FTwitchHype : FTickableGameObject, FSelfRegisteringExec
 	float EventDelayTime;
 	float BettingCloseDelayTime;
 	bool bDebug;
+	float DefaultCommandCooldown;
 
 	int32 ChatCost;
 	int32 TauntCost;
@@ -141,8 +352,11 @@ struct FTwitchHype : FTickableGameObject, FSelfRegisteringExec
 
 	bool bPrintBetConfirmations;
 
-	sqlite3 *db;
-	TMap<FString, FUserProfile> InMemoryProfiles;
+	TMap<uint64, FUserProfile> InMemoryProfiles;
+	// Keys of the profiles the next tick hands to the persistence worker, each one once
+	TArray<uint64> DirtyProfiles;
+	// Owns the database, nullptr if it couldn't be opened
+	FTwitchPersistence* Persistence;
 	TArray<FString> ActivePlayers;
 	TArray<FDelayedEvent> DelayedEvents;
 	bool bBettingOpen;
@@ -150,39 +364,72 @@ struct FTwitchHype : FTickableGameObject, FSelfRegisteringExec
 	bool bFirstBlood;
 	bool bFirstSuicide;
 
-	TMap<FString, FActiveBet> ActiveBets;
-	TMap<FString, FActiveBet> ActiveFirstBloodBets;
-	TMap<FString, FActiveBet> ActiveFirstSuicideBets;
+	// ChannelName first, then AdditionalChannels
+	TArray<FTwitchChannel> Channels;
 	
-	void OnPrivMsg(IRCMessage message);
+	void OnPrivMsg(const IRCMessage& message);
+
+	// Chat commands, more can be registered at any time without touching OnPrivMsg
+	FTwitchCommandRegistry Commands;
+	void RegisterCommands();
+
+	// Keyed by the viewer's FUserProfile::userid and the command's FTwitchCommandInfo::Id
+	FTwitchCooldowns Cooldowns;
+	uint64 CommandsOnCooldown;
+
+	FTwitchChannel* FindChannel(IRCStringView Name);
+
+	FTwitchReplyTemplate Replies[ETwitchReply::Count];
+
+	// Says the same thing in every channel
+	void Announce(ETwitchReply::Type Id, FTwitchReplyArgs Args = FTwitchReplyArgs());
+	void Reply(const FTwitchChannel& Channel, ETwitchReply::Type Id, FTwitchReplyArgs Args, IRCSendPriority Priority = IRC_PRIORITY_REPLY);
+	// A reply about one viewer, with writer accounts all of a viewer's replies go out on the same one
+	void ReplyTo(const FTwitchChannel& Channel, IRCStringView Username, ETwitchReply::Type Id, FTwitchReplyArgs Args, IRCSendPriority Priority = IRC_PRIORITY_REPLY);
+	/** Renders into the client's frame arena, the view is good until the next client Tick */
+	IRCStringView ReplyLine(const FTwitchChannel& Channel, ETwitchReply::Type Id, FTwitchReplyArgs Args);
 
 	void PostPlayerInit(UWorld* World, AUTGameMode* GM, AController* C);
 	void NotifyMatchStateChange(UWorld* World, AUTGameMode* GM, FName NewState);
 	void ScoreKill(UWorld* World, AUTGameMode* GM, AController* Killer, AController* Other, TSubclassOf<UDamageType> DamageType);
 
 	void ForgiveBets();
+	void RefundBet(uint64 UserId, int32 Amount);
+	/** Has the persistence worker write every changed profile now rather than at the end of its interval */
 	void FlushToDB();
+	/** Between matches, saves everything and folds the write-ahead log back into the database on the persistence thread */
+	void CheckpointDatabase();
+	void QueueDirtyProfiles();
+	void QueueProfileChange(ETwitchProfileChange::Type Type, const FUserProfile& Profile);
+	void MarkDirty(FUserProfile& Profile);
+	void ChangeCredits(FUserProfile& Profile, int32 Delta);
 
-	void ParseABet(const TArray<FString>& ParsedCommand, FUserProfile* Profile, const FString& Username, TMap<FString, FActiveBet>& BetMap);
+	void ParseABet(const FTwitchChannel& Channel, const FTwitchChatCommand& ParsedCommand, FUserProfile* Profile, IRCStringView Username, TMap<uint64, FActiveBet>& BetMap);
 
-	void AwardBets(const FString& Winner, int32& MoneyWon, int32& HouseTake, TMap<FString, FActiveBet>& BetMap);
+	void AwardBets(const FString& Winner, int32& MoneyWon, int32& HouseTake, TMap<uint64, FActiveBet>& BetMap);
 
-	void UndoBets(FUserProfile* Profile, const FString& Username);
+	void RegisterAccount(const FTwitchChannel& Channel, uint64 UserId, IRCStringView Username);
+	void PrintCredits(const FTwitchChannel& Channel, FUserProfile* Profile, IRCStringView Username);
+
+	void UndoBets(FTwitchChannel& Channel, FUserProfile* Profile, IRCStringView Username);
 	
-	void SendChat(const FString& Command, FUserProfile* Profile, const FString& Username);
+	void SendChat(const FTwitchChannel& Channel, const FTwitchChatCommand& ParsedCommand, FUserProfile* Profile, IRCStringView Username);
 	
-	void SendTaunt(const TArray<FString>& ParsedCommand, FUserProfile* Profile, const FString& Username);
-	void SendFeignDeath(const TArray<FString>& ParsedCommand, FUserProfile* Profile, const FString& Username);
-	void SendArmor(const TArray<FString>& ParsedCommand, FUserProfile* Profile, const FString& Username);
-	void SendRedeemer(const TArray<FString>& ParsedCommand, FUserProfile* Profile, const FString& Username);
-	void SendHat(const TArray<FString>& ParsedCommand, FUserProfile* Profile, const FString& Username);
+	void SendTaunt(const FTwitchChannel& Channel, const FTwitchChatCommand& ParsedCommand, FUserProfile* Profile, IRCStringView Username);
+	void SendFeignDeath(const FTwitchChannel& Channel, const FTwitchChatCommand& ParsedCommand, FUserProfile* Profile, IRCStringView Username);
+	void SendArmor(const FTwitchChannel& Channel, const FTwitchChatCommand& ParsedCommand, FUserProfile* Profile, IRCStringView Username);
+	void SendRedeemer(const FTwitchChannel& Channel, const FTwitchChatCommand& ParsedCommand, FUserProfile* Profile, IRCStringView Username);
+	void SendHat(const FTwitchChannel& Channel, const FTwitchChatCommand& ParsedCommand, FUserProfile* Profile, IRCStringView Username);
+
+	void PrintTop10(FTwitchChannel& Channel);
+	void GiveExtraMoney(const FTwitchChannel& Channel, FUserProfile* Profile, IRCStringView Username);
 
-	void PrintTop10();
-	void GiveExtraMoney(FUserProfile* Profile, const FString& Username);
+	void ConnectToIRC(const FString& Host = TEXT("irc.twitch.tv"), int32 Port = 6667);
 
-	void ConnectToIRC();
+	// In any channel, credits are shared between them
+	bool HasActiveBets(uint64 UserId);
 
-	bool HasActiveBets(const FString& Username);
+	FUserProfile* FindProfile(uint64 UserId, IRCStringView Username);
 };
 
 class FTwitchHypePlugin : public IModuleInterface
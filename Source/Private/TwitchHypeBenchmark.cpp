@@ -0,0 +1,863 @@
+// Copyright 1998-2015 Epic Games, Inc. All Rights Reserved.
+
+#include "TwitchHype.h"
+#include "TwitchHypeBenchmark.h"
+#include "IRCScan.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <fcntl.h>
+
+// Used when no recorded corpus is found, a typical slice of a busy Twitch channel
+static const char* DefaultCorpus =
+	":tmi.twitch.tv 001 utbot :Welcome, GLHF!\r\n"
+	":tmi.twitch.tv 372 utbot :You are in a maze of twisty passages, all alike.\r\n"
+	":utbot!utbot@utbot.tmi.twitch.tv JOIN #petenub\r\n"
+	":utbot.tmi.twitch.tv 353 utbot = #petenub :utbot\r\n"
+	":utbot.tmi.twitch.tv 366 utbot #petenub :End of /NAMES list\r\n"
+	"PING :tmi.twitch.tv\r\n"
+	":someviewer!someviewer@someviewer.tmi.twitch.tv PRIVMSG #petenub :!bet Malcolm 500\r\n"
+	":another_one!another_one@another_one.tmi.twitch.tv PRIVMSG #petenub :!firstbloodbet Taye 250\r\n"
+	":lurker42!lurker42@lurker42.tmi.twitch.tv PRIVMSG #petenub :that flak shot was unreal Kreygasm\r\n"
+	":someviewer!someviewer@someviewer.tmi.twitch.tv PRIVMSG #petenub :!credits\r\n"
+	":xx_sniper_xx!xx_sniper_xx@xx_sniper_xx.tmi.twitch.tv PRIVMSG #petenub :!top10\r\n"
+	":newguy!newguy@newguy.tmi.twitch.tv PRIVMSG #petenub :!register\r\n"
+	":lurker42!lurker42@lurker42.tmi.twitch.tv PRIVMSG #petenub :how do I bet on this? is it !bet <name> <amount> ?\r\n"
+	":another_one!another_one@another_one.tmi.twitch.tv PRIVMSG #petenub :!chat nice shock combo dude\r\n"
+	":jtv MODE #petenub +o petenub\r\n"
+	":tmi.twitch.tv NOTICE * :Login unsuccessful\r\n";
+
+namespace
+{
+	// The parser IRCMessage::Parse replaced, kept here verbatim as the baseline
+	struct FLegacyPrefix
+	{
+		void Parse(std::string data)
+		{
+			if (data == "")
+				return;
+
+			prefix = data.substr(1, data.find(" ") - 1);
+			std::vector<std::string> tokens;
+
+			if (prefix.find("@") != std::string::npos)
+			{
+				tokens = split(prefix, '@');
+				nick = tokens.at(0);
+				host = tokens.at(1);
+			}
+			if (nick != "" && nick.find("!") != std::string::npos)
+			{
+				tokens = split(nick, '!');
+				nick = tokens.at(0);
+				user = tokens.at(1);
+			}
+		}
+
+		std::string prefix;
+		std::string nick;
+		std::string user;
+		std::string host;
+	};
+
+	struct FLegacyMessage
+	{
+		std::string command;
+		FLegacyPrefix prefix;
+		std::vector<std::string> parameters;
+	};
+
+	FLegacyMessage LegacyParse(std::string data)
+	{
+		FLegacyMessage message;
+
+		if (data.substr(0, 1) == ":")
+		{
+			message.prefix.Parse(data);
+			data = data.substr(data.find(" ") + 1);
+		}
+
+		message.command = data.substr(0, data.find(" "));
+		std::transform(message.command.begin(), message.command.end(), message.command.begin(), towupper);
+		if (data.find(" ") != std::string::npos)
+			data = data.substr(data.find(" ") + 1);
+		else
+			data = "";
+
+		if (data != "")
+		{
+			if (data.substr(0, 1) == ":")
+				message.parameters.push_back(data.substr(1));
+			else
+			{
+				size_t pos1 = 0, pos2;
+				while ((pos2 = data.find(" ", pos1)) != std::string::npos)
+				{
+					message.parameters.push_back(data.substr(pos1, pos2 - pos1));
+					pos1 = pos2 + 1;
+					if (data.substr(pos1, 1) == ":")
+					{
+						message.parameters.push_back(data.substr(pos1 + 1));
+						break;
+					}
+				}
+				if (message.parameters.empty())
+					message.parameters.push_back(data);
+			}
+		}
+
+		return message;
+	}
+
+	// Sits in front of the real allocator from module startup on and counts what one thread
+	// asks of it. It's never taken out again, any thread can be inside it at any time.
+	class FCountingMalloc : public FMalloc
+	{
+	public:
+		FCountingMalloc(FMalloc* InInner) : Inner(InInner), CountedThread(0), Allocations(0) {}
+
+		virtual void* Malloc(SIZE_T Count, uint32 Alignment) override
+		{
+			Record();
+			return Inner->Malloc(Count, Alignment);
+		}
+
+		virtual void* Realloc(void* Original, SIZE_T Count, uint32 Alignment) override
+		{
+			// Shrinking to nothing is a free
+			if (Count > 0)
+			{
+				Record();
+			}
+			return Inner->Realloc(Original, Count, Alignment);
+		}
+
+		virtual void Free(void* Original) override { Inner->Free(Original); }
+		virtual bool GetAllocationSize(void* Original, SIZE_T& SizeOut) override { return Inner->GetAllocationSize(Original, SizeOut); }
+		virtual void Trim() override { Inner->Trim(); }
+		virtual bool IsInternallyThreadSafe() const override { return Inner->IsInternallyThreadSafe(); }
+		virtual bool ValidateHeap() override { return Inner->ValidateHeap(); }
+		virtual const TCHAR* GetDescriptiveName() override { return TEXT("TwitchHype allocation counter"); }
+
+		FMalloc* Inner;
+		// Only this thread's allocations count, 0 while nothing is being measured
+		std::atomic<uint32> CountedThread;
+		// Only ever touched by the counted thread
+		uint64 Allocations;
+
+	private:
+		void Record()
+		{
+			if (CountedThread.load(std::memory_order_relaxed) == FPlatformTLS::GetCurrentThreadId())
+			{
+				Allocations++;
+			}
+		}
+	};
+
+	FCountingMalloc* AllocationCounter = nullptr;
+
+	bool WouldBlock()
+	{
+#ifdef _WIN32
+		return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+		return errno == EAGAIN || errno == EWOULDBLOCK;
+#endif
+	}
+
+	void SetNonBlocking(int Socket)
+	{
+#ifdef _WIN32
+		u_long Mode = 1;
+		ioctlsocket(Socket, FIONBIO, &Mode);
+#else
+		fcntl(Socket, F_SETFL, fcntl(Socket, F_GETFL, 0) | O_NONBLOCK);
+#endif
+	}
+
+	// Plays tmi.twitch.tv on a loopback port. Answers registration, capabilities, joins and
+	// pings, feeds chat to every connection that joined a channel and counts the PRIVMSGs
+	// that come back. Nothing it does blocks.
+	class FLoopbackTwitchServer
+	{
+	public:
+		FLoopbackTwitchServer() : RepliesReceived(0), Listener(INVALID_SOCKET), Port(0), bStarted(false) {}
+		~FLoopbackTwitchServer();
+
+		/** On 127.0.0.1, at whatever port the OS hands out */
+		bool Listen();
+		int32 GetPort() const { return Port; }
+
+		/** Accepts new connections, answers what they sent and writes what's queued for them */
+		void Serve();
+		/** Queues a raw line, without its CR LF, for every connection that joined a channel */
+		void SendChat(IRCStringView Line);
+
+		uint64 RepliesReceived;
+
+	private:
+		struct FConnection
+		{
+			int Socket;
+			std::string Nick;
+			bool bJoined;
+			std::string Input;
+			std::string Output;
+		};
+
+		void HandleLine(FConnection& Connection, IRCStringView Line);
+
+		int Listener;
+		int32 Port;
+		bool bStarted;
+		std::vector<FConnection> Connections;
+	};
+
+	FLoopbackTwitchServer::~FLoopbackTwitchServer()
+	{
+		for (const FConnection& Connection : Connections)
+		{
+			if (Connection.Socket != INVALID_SOCKET)
+			{
+				closesocket(Connection.Socket);
+			}
+		}
+
+		if (Listener != INVALID_SOCKET)
+		{
+			closesocket(Listener);
+		}
+
+#ifdef _WIN32
+		if (bStarted)
+		{
+			WSACleanup();
+		}
+#endif
+	}
+
+	bool FLoopbackTwitchServer::Listen()
+	{
+#ifdef _WIN32
+		WSADATA WsaData;
+		if (WSAStartup(MAKEWORD(2, 2), &WsaData))
+		{
+			return false;
+		}
+#endif
+		bStarted = true;
+
+		Listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+		if (Listener == INVALID_SOCKET)
+		{
+			return false;
+		}
+
+		sockaddr_in Address;
+		memset(&Address, 0, sizeof(Address));
+		Address.sin_family = AF_INET;
+		Address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		Address.sin_port = 0;
+
+		socklen_t AddressLength = sizeof(Address);
+		if (bind(Listener, (sockaddr*)&Address, sizeof(Address)) == SOCKET_ERROR
+			|| listen(Listener, 8) == SOCKET_ERROR
+			|| getsockname(Listener, (sockaddr*)&Address, &AddressLength) == SOCKET_ERROR)
+		{
+			return false;
+		}
+
+		SetNonBlocking(Listener);
+		Port = ntohs(Address.sin_port);
+		return true;
+	}
+
+	void FLoopbackTwitchServer::Serve()
+	{
+		// The bot and each of its writers
+		for (int Socket; (Socket = (int)accept(Listener, NULL, NULL)) != INVALID_SOCKET;)
+		{
+			SetNonBlocking(Socket);
+
+			FConnection Connection;
+			Connection.Socket = Socket;
+			Connection.bJoined = false;
+			Connections.push_back(Connection);
+		}
+
+		char Buffer[4096];
+		for (FConnection& Connection : Connections)
+		{
+			if (Connection.Socket == INVALID_SOCKET)
+			{
+				continue;
+			}
+
+			int Bytes;
+			while ((Bytes = recv(Connection.Socket, Buffer, sizeof(Buffer), 0)) > 0)
+			{
+				Connection.Input.append(Buffer, Bytes);
+			}
+
+			if (Bytes == 0 || !WouldBlock())
+			{
+				closesocket(Connection.Socket);
+				Connection.Socket = INVALID_SOCKET;
+				continue;
+			}
+
+			size_t LineStart = 0;
+			for (size_t Newline; (Newline = Connection.Input.find('\n', LineStart)) != std::string::npos; LineStart = Newline + 1)
+			{
+				size_t Length = Newline - LineStart;
+				if (Length > 0 && Connection.Input[Newline - 1] == '\r')
+				{
+					Length--;
+				}
+				HandleLine(Connection, IRCStringView(Connection.Input.data() + LineStart, Length));
+			}
+			Connection.Input.erase(0, LineStart);
+
+			// Whatever the socket won't take now goes out on the next call
+			if (!Connection.Output.empty())
+			{
+				Bytes = send(Connection.Socket, Connection.Output.data(), (int)Connection.Output.size(), 0);
+				if (Bytes > 0)
+				{
+					Connection.Output.erase(0, Bytes);
+				}
+			}
+		}
+	}
+
+	void FLoopbackTwitchServer::SendChat(IRCStringView Line)
+	{
+		for (FConnection& Connection : Connections)
+		{
+			if (Connection.bJoined)
+			{
+				Connection.Output.append(Line.data(), Line.size());
+				Connection.Output += "\r\n";
+			}
+		}
+	}
+
+	void FLoopbackTwitchServer::HandleLine(FConnection& Connection, IRCStringView Line)
+	{
+		IRCMessage Message;
+		if (!Message.Parse(Line) || Message.parameters.size() == 0)
+		{
+			return;
+		}
+
+		std::string Reply;
+		switch (Message.commandId)
+		{
+		case IRC_CMD_NICK:
+			Connection.Nick = Message.parameters.at(0).str();
+			Reply = ":tmi.twitch.tv 001 " + Connection.Nick + " :Welcome, GLHF!";
+			break;
+		case IRC_CMD_CAP:
+			Reply = ":tmi.twitch.tv CAP * ACK :" + Message.parameters.back().str();
+			break;
+		case IRC_CMD_JOIN:
+			Connection.bJoined = true;
+			Reply = ":" + Connection.Nick + "!" + Connection.Nick + "@" + Connection.Nick + ".tmi.twitch.tv JOIN " + Message.parameters.at(0).str();
+			break;
+		case IRC_CMD_PING:
+			Reply = ":tmi.twitch.tv PONG tmi.twitch.tv :" + Message.parameters.back().str();
+			break;
+		case IRC_CMD_PRIVMSG:
+			RepliesReceived++;
+			return;
+		default:
+			return;
+		}
+
+		Connection.Output += Reply;
+		Connection.Output += "\r\n";
+	}
+
+	bool AllReady(IRCClient& Client)
+	{
+		for (size_t i = 0; i < Client.Writers(); i++)
+		{
+			if (!AllReady(Client.Writer(i)))
+			{
+				return false;
+			}
+		}
+
+		return Client.State() == IRC_STATE_READY;
+	}
+
+	// Twitch's limit would leave nearly every reply waiting in the queue, here they all go out
+	void LiftRateLimits(IRCClient& Client, size_t MaxDepth)
+	{
+		for (size_t i = 0; i < Client.Writers(); i++)
+		{
+			LiftRateLimits(Client.Writer(i), MaxDepth);
+		}
+
+		Client.SendQueue().Configure(1000000, 1.0, 1000000, MaxDepth);
+		Client.ConfigureChannelQueues(1000000, 1.0, 1000000, MaxDepth);
+	}
+
+	// What FTwitchHype::Tick does for chat, with the game thread's allocations counted
+	void TickBot(FTwitchHype& Bot, bool bCount)
+	{
+		if (bCount)
+		{
+			AllocationCounter->CountedThread.store(FPlatformTLS::GetCurrentThreadId(), std::memory_order_relaxed);
+		}
+
+		Bot.client.Tick();
+		Bot.Cooldowns.Advance(FPlatformTime::Seconds());
+		Bot.client.FlushSendQueue();
+
+		AllocationCounter->CountedThread.store(0, std::memory_order_relaxed);
+	}
+}
+
+void FTwitchHypeBenchmark::InstallAllocationCounter()
+{
+	if (AllocationCounter == nullptr && FParse::Param(FCommandLine::Get(), TEXT("TwitchHypeCountAllocs")))
+	{
+		AllocationCounter = new FCountingMalloc(GMalloc);
+		GMalloc = AllocationCounter;
+	}
+}
+
+bool FTwitchHypeBenchmark::LoadCorpus(const FString& CorpusPath, TArray<uint8>& Corpus, TArray<IRCStringView>& Lines)
+{
+	bool bLoaded = FFileHelper::LoadFileToArray(Corpus, *CorpusPath);
+	if (!bLoaded)
+	{
+		int32 Length = strlen(DefaultCorpus);
+		Corpus.SetNumUninitialized(Length);
+		FMemory::Memcpy(Corpus.GetData(), DefaultCorpus, Length);
+	}
+
+	const char* Begin = (const char*)Corpus.GetData();
+	const char* End = Begin + Corpus.Num();
+	while (Begin < End)
+	{
+		const char* Newline = (const char*)memchr(Begin, '\n', End - Begin);
+		const char* LineEnd = Newline ? Newline : End;
+		size_t Length = LineEnd - Begin;
+		if (Length > 0 && Begin[Length - 1] == '\r')
+		{
+			Length--;
+		}
+		if (Length > 0)
+		{
+			Lines.Add(IRCStringView(Begin, Length));
+		}
+		Begin = LineEnd + 1;
+	}
+
+	return bLoaded;
+}
+
+void FTwitchHypeBenchmark::RunParse(const FString& CorpusPath, FOutputDevice& Ar)
+{
+	TArray<uint8> Corpus;
+	TArray<IRCStringView> Lines;
+	bool bRecorded = LoadCorpus(CorpusPath, Corpus, Lines);
+
+	if (Lines.Num() == 0)
+	{
+		Ar.Logf(TEXT("Corpus %s has no lines"), *CorpusPath);
+		return;
+	}
+
+	// Enough passes for the timer to be meaningful on a small corpus
+	const int32 Passes = FMath::Max(1, 200000 / Lines.Num());
+	const int32 TotalLines = Passes * Lines.Num();
+
+	// Summing parameter counts keeps the optimizer from dropping the work
+	size_t LegacyCheck = 0;
+	double LegacyStart = FPlatformTime::Seconds();
+	for (int32 Pass = 0; Pass < Passes; Pass++)
+	{
+		for (const IRCStringView& Line : Lines)
+		{
+			LegacyCheck += LegacyParse(Line.str()).parameters.size();
+		}
+	}
+	double LegacyTime = FPlatformTime::Seconds() - LegacyStart;
+
+	size_t ViewCheck = 0;
+	double ViewStart = FPlatformTime::Seconds();
+	for (int32 Pass = 0; Pass < Passes; Pass++)
+	{
+		for (const IRCStringView& Line : Lines)
+		{
+			IRCMessage Message;
+			Message.Parse(Line);
+			ViewCheck += Message.parameters.size();
+		}
+	}
+	double ViewTime = FPlatformTime::Seconds() - ViewStart;
+
+	Ar.Logf(TEXT("Parsed %d lines (%d unique) from %s"), TotalLines, Lines.Num(), bRecorded ? *CorpusPath : TEXT("built-in corpus"));
+	Ar.Logf(TEXT("  legacy std::string parse: %.1f ns/line (%u params)"), LegacyTime * 1e9 / TotalLines, (uint32)LegacyCheck);
+	Ar.Logf(TEXT("  IRCMessage::Parse:        %.1f ns/line (%u params)"), ViewTime * 1e9 / TotalLines, (uint32)ViewCheck);
+	if (ViewTime > 0)
+	{
+		Ar.Logf(TEXT("  speedup: %.2fx"), LegacyTime / ViewTime);
+	}
+}
+
+void FTwitchHypeBenchmark::RunAllocs(const FString& CorpusPath, FOutputDevice& Ar)
+{
+	if (AllocationCounter == nullptr)
+	{
+		Ar.Logf(TEXT("Allocations are only counted with -TwitchHypeCountAllocs on the command line"));
+		return;
+	}
+
+	TArray<uint8> Corpus;
+	TArray<IRCStringView> AllLines;
+	bool bRecorded = LoadCorpus(CorpusPath, Corpus, AllLines);
+
+	FLoopbackTwitchServer Server;
+	if (!Server.Listen())
+	{
+		Ar.Logf(TEXT("Couldn't open a loopback port for the bot to connect to"));
+		return;
+	}
+
+	// Configured like the real one, but without a database, so the viewers the corpus registers never reach it
+	ATwitchHype* Settings = ATwitchHype::StaticClass()->GetDefaultObject<ATwitchHype>();
+	FTwitchHype* Bot = new FTwitchHype(FString());
+	if (Bot->Channels.Num() == 0)
+	{
+		Ar.Logf(TEXT("No ChannelName configured for the bot to join"));
+		delete Bot;
+		return;
+	}
+
+	// Every command is handled in full every time rather than mostly turned away by its cooldown
+	Bot->DefaultCommandCooldown = 0;
+	Bot->Top10CooldownTime = 0;
+	Bot->bBettingOpen = true;
+	LiftRateLimits(Bot->client, FMath::Max(Settings->ChatQueueMaxDepth, 1));
+
+	// Only chat is per message, the rest of the protocol is a handful of lines a session.
+	// It's all said in the bot's own channel, otherwise OnPrivMsg turns it away.
+	const std::string& Channel = Bot->Channels[0].Name;
+	std::vector<std::string> Lines;
+	for (const IRCStringView& Line : AllLines)
+	{
+		IRCMessage Message;
+		if (Message.Parse(Line) && Message.commandId == IRC_CMD_PRIVMSG && Message.parameters.size() == 2)
+		{
+			IRCStringView Target = Message.parameters.at(0);
+			size_t TargetStart = Target.data() - Line.data();
+			Lines.push_back(Line.substr(0, TargetStart).str() + Channel + Line.substr(TargetStart + Target.size()).str());
+		}
+	}
+
+	if (Lines.size() == 0)
+	{
+		Ar.Logf(TEXT("Corpus %s has no chat lines"), *CorpusPath);
+		delete Bot;
+		return;
+	}
+
+	Bot->ConnectToIRC(TEXT("127.0.0.1"), Server.GetPort());
+	double Deadline = FPlatformTime::Seconds() + 10.0;
+	while (!AllReady(Bot->client) && FPlatformTime::Seconds() < Deadline)
+	{
+		Server.Serve();
+		TickBot(*Bot, false);
+		FPlatformProcess::Sleep(0.001f);
+	}
+
+	if (!AllReady(Bot->client))
+	{
+		Ar.Logf(TEXT("The bot never finished joining the loopback server, it got as far as %s"), ANSI_TO_TCHAR(Bot->client.StateName()));
+		Bot->client.Disconnect();
+		delete Bot;
+		return;
+	}
+
+	const int32 LinesPerTick = 16;
+	const int32 Passes = FMath::Max(2, 20000 / (int32)Lines.size());
+
+	// Counted from the first line handed to the bot, the server's own work in between isn't
+	uint64 StartAllocations = AllocationCounter->Allocations;
+	uint64 WarmupAllocations = 0;
+	int32 Fed = 0;
+	for (int32 Pass = 0; Pass < Passes; Pass++)
+	{
+		for (const std::string& Line : Lines)
+		{
+			Server.SendChat(IRCStringView(Line.data(), Line.size()));
+			if (++Fed % LinesPerTick == 0)
+			{
+				Server.Serve();
+				TickBot(*Bot, true);
+			}
+		}
+
+		// The first pass registers the viewers and grows every ring, set, map and arena block to size
+		if (Pass == 0)
+		{
+			WarmupAllocations = AllocationCounter->Allocations - StartAllocations;
+		}
+	}
+
+	// Replies to the last few lines
+	for (int32 Tick = 0; Tick < 10; Tick++)
+	{
+		Server.Serve();
+		TickBot(*Bot, true);
+		FPlatformProcess::Sleep(0.001f);
+	}
+	Server.Serve();
+
+	uint64 SteadyAllocations = AllocationCounter->Allocations - StartAllocations - WarmupAllocations;
+	int32 SteadyLines = (Passes - 1) * (int32)Lines.size();
+	const IRCArenaStats& ArenaStats = Bot->client.FrameArenaStats();
+
+	Ar.Logf(TEXT("Fed %d chat lines from %s, %llu replies came back"), Passes * (int32)Lines.size(), bRecorded ? *CorpusPath : TEXT("built-in corpus"), Server.RepliesReceived);
+	Ar.Logf(TEXT("  warm-up pass: %llu allocations over %d lines"), WarmupAllocations, (int32)Lines.size());
+	Ar.Logf(TEXT("  steady state: %llu allocations over %d lines (%.3f per line)"), SteadyAllocations, SteadyLines, (double)SteadyAllocations / SteadyLines);
+	Ar.Logf(TEXT("  frame arena: %llu blocks, %u bytes at peak"), ArenaStats.blocks, (uint32)ArenaStats.peak);
+
+	Bot->client.Disconnect();
+	delete Bot;
+}
+
+void FTwitchHypeBenchmark::TimeScan(const TCHAR* Label, const std::string& Buffer, int32 NumLines, FOutputDevice& Ar)
+{
+	const char* Data = Buffer.data();
+	const size_t Size = Buffer.size();
+	const int32 Passes = FMath::Max(1, (int32)((16 * 1024 * 1024) / Size));
+
+	TArray<IRCScanMasks> Masks;
+	Masks.SetNumUninitialized((int32)((Size + IRC_SCAN_BLOCK - 1) / IRC_SCAN_BLOCK));
+
+	// Folding every result into a checksum keeps the optimizer from dropping the work
+	uint64 Check = 0;
+
+	double Start = FPlatformTime::Seconds();
+	for (int32 Pass = 0; Pass < Passes; Pass++)
+	{
+		for (size_t Offset = 0; Offset < Size; Offset += IRC_SCAN_BLOCK)
+		{
+			IRCScanMasks Block;
+			IRCScanBlockScalar(Data + Offset, FMath::Min<size_t>(Size - Offset, IRC_SCAN_BLOCK), Block);
+			Check += Block.newline ^ Block.space;
+		}
+	}
+	double ScalarTime = FPlatformTime::Seconds() - Start;
+
+	Start = FPlatformTime::Seconds();
+	for (int32 Pass = 0; Pass < Passes; Pass++)
+	{
+		IRCScanBuffer(Data, Size, Masks.GetData());
+		Check += Masks[Pass % Masks.Num()].space;
+	}
+	double VectorTime = FPlatformTime::Seconds() - Start;
+
+	// Splitting the way IRCSocket::NextLine used to, then the way it does now
+	Start = FPlatformTime::Seconds();
+	for (int32 Pass = 0; Pass < Passes; Pass++)
+	{
+		for (const char* Pos = Data; const char* Newline = (const char*)memchr(Pos, '\n', Data + Size - Pos); Pos = Newline + 1)
+		{
+			Check += Newline - Pos;
+		}
+	}
+	double MemchrTime = FPlatformTime::Seconds() - Start;
+
+	Start = FPlatformTime::Seconds();
+	for (int32 Pass = 0; Pass < Passes; Pass++)
+	{
+		IRCScanBuffer(Data, Size, Masks.GetData());
+		size_t LineStart = 0;
+		for (int32 Block = 0; Block < Masks.Num(); Block++)
+		{
+			for (uint64 Newlines = Masks[Block].newline; Newlines; Newlines &= Newlines - 1)
+			{
+				size_t LineEnd = Block * IRC_SCAN_BLOCK + IRCLowestBit(Newlines);
+				Check += LineEnd - LineStart;
+				LineStart = LineEnd + 1;
+			}
+		}
+	}
+	double MaskTime = FPlatformTime::Seconds() - Start;
+
+	// One pass of masks for splitting and tokenizing alike, the way IRCClient::ReceiveData does it
+	Start = FPlatformTime::Seconds();
+	for (int32 Pass = 0; Pass < Passes; Pass++)
+	{
+		IRCScanBuffer(Data, Size, Masks.GetData());
+		IRCScanCursor Scan(Data, Size, Masks.GetData(), 0);
+		for (size_t LineStart = 0, LineEnd; (LineEnd = Scan.NextNewline(LineStart)) < Size; LineStart = LineEnd + 1)
+		{
+			IRCStringView Line(Data + LineStart, LineEnd - LineStart - 1);
+			IRCScanCursor LineScan(Line.data(), Line.size(), Masks.GetData(), LineStart);
+			IRCMessage Message;
+			Message.Parse(Line, LineScan);
+			Check += Message.parameters.size();
+		}
+	}
+	double ParseTime = FPlatformTime::Seconds() - Start;
+
+	const double Bytes = (double)Size * Passes;
+	const double Lines = (double)NumLines * Passes;
+	Ar.Logf(TEXT("%-16s %5.0f bytes/line  scan %5.2f GB/s scalar, %5.2f GB/s %s  split %5.1f ns/line memchr, %5.1f ns/line masks  parse %6.1f ns/line (%llx)"),
+		Label, (double)Size / NumLines,
+		Bytes / ScalarTime / 1e9, Bytes / VectorTime / 1e9, IRC_SCAN_SSE2 ? TEXT("SSE2") : TEXT("scalar"),
+		MemchrTime * 1e9 / Lines, MaskTime * 1e9 / Lines, ParseTime * 1e9 / Lines, Check & 0xFFFF);
+}
+
+void FTwitchHypeBenchmark::RunScan(const FString& CorpusPath, FOutputDevice& Ar)
+{
+	// Plain chat from a viewer, and the same with the tags Twitch adds once twitch.tv/tags is on
+	static const char* Untagged = ":someviewer!someviewer@someviewer.tmi.twitch.tv PRIVMSG #petenub :";
+	static const char* Tagged = "@badge-info=subscriber/14;badges=subscriber/12,premium/1;color=#1E90FF;display-name=SomeViewer;emotes=;"
+		"flags=;id=b34ccfc7-4977-403a-8a94-33c6bac34fb8;mod=0;room-id=12345678;subscriber=1;tmi-sent-ts=1507246572675;turbo=0;"
+		"user-id=87654321;user-type= :someviewer!someviewer@someviewer.tmi.twitch.tv PRIVMSG #petenub :";
+	static const char* Words[] = { "!bet", "Malcolm", "500", "that", "flak", "shot", "was", "unreal", "Kreygasm", "gg" };
+
+	const int32 LineLengths[] = { 96, 192, 384, 512 };
+	const int32 NumLines = 1024;
+
+	for (int32 Length : LineLengths)
+	{
+		std::string Buffer;
+		for (int32 Line = 0; Line < NumLines; Line++)
+		{
+			size_t LineStart = Buffer.size();
+			Buffer += Length >= 384 ? Tagged : Untagged;
+			for (int32 Word = Line; (int32)(Buffer.size() - LineStart) < Length - 2; Word++)
+			{
+				Buffer += Words[Word % ARRAY_COUNT(Words)];
+				Buffer += ' ';
+			}
+			Buffer += "\r\n";
+		}
+
+		TimeScan(*FString::Printf(TEXT("~%d bytes"), Length), Buffer, NumLines, Ar);
+	}
+
+	TArray<uint8> Corpus;
+	TArray<IRCStringView> Lines;
+	bool bRecorded = LoadCorpus(CorpusPath, Corpus, Lines);
+	if (Lines.Num() > 0)
+	{
+		std::string Buffer;
+		for (const IRCStringView& Line : Lines)
+		{
+			Buffer.append(Line.data(), Line.size());
+			Buffer += "\r\n";
+		}
+
+		TimeScan(bRecorded ? TEXT("corpus") : TEXT("built-in corpus"), Buffer, Lines.Num(), Ar);
+	}
+}
+
+void FTwitchHypeBenchmark::TimeStorage(const TCHAR* Label, const FTwitchStorageProfile& Profile, int32 NumProfiles, int32 BatchSize, FOutputDevice& Ar)
+{
+	// A fresh file every time, the journal mode sticks to it
+	FString Path = FPaths::GameSavedDir() / TEXT("TwitchHypeBench.db");
+	IFileManager::Get().Delete(*Path, false, false, true);
+	IFileManager::Get().Delete(*(Path + TEXT("-wal")), false, false, true);
+	IFileManager::Get().Delete(*(Path + TEXT("-shm")), false, false, true);
+
+	sqlite3* Db = FTwitchPersistence::Open(Path, Profile);
+	if (Db == nullptr)
+	{
+		Ar.Logf(TEXT("%-16s couldn't open %s"), Label, *Path);
+		return;
+	}
+
+	// Never started, the commits run right here the way the worker would run them
+	FTwitchPersistence* Persistence = new FTwitchPersistence(Db, Profile, 1.0f, BatchSize);
+
+	FTwitchProfileChange Change;
+	Change.bNameKey = false;
+	Change.Bankrupts = 0;
+	Change.QueuedTime = FPlatformTime::Seconds();
+
+	Change.Type = ETwitchProfileChange::Insert;
+	for (int32 Viewer = 0; Viewer < NumProfiles; Viewer++)
+	{
+		Change.UserId = Viewer + 1;
+		Change.Credits = 1000;
+		Change.NameLength = FCStringAnsi::Sprintf(Change.Name, "viewer%d", Viewer);
+		Persistence->Enqueue(Change);
+		if (Persistence->Pending() == TWITCH_PERSIST_RING_SIZE)
+		{
+			Persistence->CommitBatch();
+		}
+	}
+	Persistence->CommitBatch();
+
+	// Only the flushes below count towards the COMMIT's time, not loading the viewers
+	const FTwitchStatementCache& Statements = Persistence->StatementCache();
+	uint64 LoadCommits = Statements.Runs(ETwitchStatement::Commit);
+	double LoadCommitTime = Statements.AverageTime(ETwitchStatement::Commit) * LoadCommits;
+
+	// Batches of credit changes like a busy round of betting leaves behind
+	const int32 Flushes = 50;
+	FRandomStream Random(2015);
+	double FlushTotal = 0;
+	double FlushMax = 0;
+	Change.Type = ETwitchProfileChange::Update;
+	for (int32 Flush = 0; Flush < Flushes; Flush++)
+	{
+		for (int32 Row = 0; Row < BatchSize; Row++)
+		{
+			int32 Viewer = Random.RandRange(0, NumProfiles - 1);
+			Change.UserId = Viewer + 1;
+			Change.Credits = Random.RandRange(0, 100000);
+			Change.NameLength = FCStringAnsi::Sprintf(Change.Name, "viewer%d", Viewer);
+			Persistence->Enqueue(Change);
+		}
+
+		double Start = FPlatformTime::Seconds();
+		Persistence->CommitBatch();
+		double Time = FPlatformTime::Seconds() - Start;
+		FlushTotal += Time;
+		FlushMax = FMath::Max(FlushMax, Time);
+	}
+
+	int32 WalPages = Persistence->WalPages.load();
+	double Start = FPlatformTime::Seconds();
+	Persistence->CheckpointWal();
+	double CheckpointTime = FPlatformTime::Seconds() - Start;
+
+	// The flush less the statements in it is mostly the COMMIT's sync
+	uint64 FlushCommits = Statements.Runs(ETwitchStatement::Commit) - LoadCommits;
+	double CommitTime = Statements.AverageTime(ETwitchStatement::Commit) * Statements.Runs(ETwitchStatement::Commit) - LoadCommitTime;
+	Ar.Logf(TEXT("%-16s flush %d rows avg %7.2fms max %7.2fms (%5.1f us/row, commit %6.3fms)  checkpoint %7.2fms of %d pages"),
+		Label, BatchSize, FlushTotal * 1000.0 / Flushes, FlushMax * 1000.0, Statements.AverageTime(ETwitchStatement::UpdateById) * 1000000.0,
+		FlushCommits > 0 ? CommitTime * 1000.0 / FlushCommits : 0.0, Profile.bWriteAheadLog ? CheckpointTime * 1000.0 : 0.0, WalPages);
+
+	// Closes the database
+	delete Persistence;
+	IFileManager::Get().Delete(*Path, false, false, true);
+}
+
+void FTwitchHypeBenchmark::RunStorage(const FTwitchStorageProfile& Configured, int32 NumProfiles, int32 BatchSize, FOutputDevice& Ar)
+{
+	NumProfiles = FMath::Max(NumProfiles, 1);
+	BatchSize = FMath::Clamp(BatchSize, 1, TWITCH_PERSIST_RING_SIZE);
+
+	FTwitchStorageProfile Defaults;
+	FTwitchStorageProfile WalOnly;
+	WalOnly.bWriteAheadLog = true;
+
+	Ar.Logf(TEXT("%d viewers, the commit is whatever the worker would write in one go"), NumProfiles);
+	TimeStorage(TEXT("sqlite defaults"), Defaults, NumProfiles, BatchSize, Ar);
+	TimeStorage(TEXT("WAL, full sync"), WalOnly, NumProfiles, BatchSize, Ar);
+	TimeStorage(TEXT("configured"), Configured, NumProfiles, BatchSize, Ar);
+}
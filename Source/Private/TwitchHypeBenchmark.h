@@ -0,0 +1,31 @@
+// Copyright 1998-2015 Epic Games, Inc. All Rights Reserved.
+#pragma once
+
+// Microbenchmarks for the chat hot paths, run from the console with TWITCHHYPEBENCH
+struct FTwitchHypeBenchmark
+{
+	/** Times the legacy std::string parser against IRCMessage::Parse over a corpus of raw chat lines */
+	static void RunParse(const FString& CorpusPath, FOutputDevice& Ar);
+
+	/** Puts the allocation counter RunAllocs reads in front of GMalloc for good, only with -TwitchHypeCountAllocs on the command line. Call before the plugin starts any threads */
+	static void InstallAllocationCounter();
+
+	/** Counts heap allocations on the game thread while a bot of its own, with no database, answers the corpus's chat from a loopback server and sends the replies back to it */
+	static void RunAllocs(const FString& CorpusPath, FOutputDevice& Ar);
+
+	/** Times delimiter scanning byte at a time against SSE2, and splitting and parsing lines with it, at typical Twitch line lengths and over the corpus */
+	static void RunScan(const FString& CorpusPath, FOutputDevice& Ar);
+
+	/** Times persistence worker commits and WAL checkpoints on a scratch database of NumProfiles viewers, with SQLite's defaults and with the configured storage profile */
+	static void RunStorage(const FTwitchStorageProfile& Configured, int32 NumProfiles, int32 BatchSize, FOutputDevice& Ar);
+
+private:
+	/** Splits the corpus file into lines, falls back to a built-in sample if it can't be read */
+	static bool LoadCorpus(const FString& CorpusPath, TArray<uint8>& Corpus, TArray<IRCStringView>& Lines);
+
+	/** One row of RunScan, Buffer is whole lines each ending in CRLF */
+	static void TimeScan(const TCHAR* Label, const std::string& Buffer, int32 NumLines, FOutputDevice& Ar);
+
+	/** One row of RunStorage */
+	static void TimeStorage(const TCHAR* Label, const FTwitchStorageProfile& Profile, int32 NumProfiles, int32 BatchSize, FOutputDevice& Ar);
+};
@@ -0,0 +1,128 @@
+// Copyright 1998-2015 Epic Games, Inc. All Rights Reserved.
+
+#include "TwitchHype.h"
+#include "TwitchHypeCommands.h"
+
+static bool IsCommandSpace(char C)
+{
+	return C == ' ' || C == '\t';
+}
+
+void FTwitchChatCommand::Tokenize(IRCStringView InText, int32 MaxArgs)
+{
+	Text = InText;
+	NumTokens = 0;
+
+	int32 MaxTokens = FMath::Min(MaxArgs + 1, TWITCH_MAX_COMMAND_TOKENS);
+	size_t Pos = 0;
+	while (NumTokens < MaxTokens)
+	{
+		while (Pos < Text.size() && IsCommandSpace(Text[Pos]))
+		{
+			Pos++;
+		}
+		if (Pos == Text.size())
+		{
+			break;
+		}
+
+		size_t Start = Pos;
+		while (Pos < Text.size() && !IsCommandSpace(Text[Pos]))
+		{
+			Pos++;
+		}
+		Tokens[NumTokens++] = Text.substr(Start, Pos - Start);
+	}
+}
+
+int32 FTwitchChatCommand::Int(int32 Index) const
+{
+	IRCStringView Digits = Token(Index);
+	size_t Pos = 0;
+	bool bNegative = false;
+	if (Pos < Digits.size() && (Digits[Pos] == '-' || Digits[Pos] == '+'))
+	{
+		bNegative = Digits[Pos] == '-';
+		Pos++;
+	}
+
+	// Anything past what fits is nonsense anyway, stop before it wraps
+	int64 Value = 0;
+	for (; Pos < Digits.size() && Digits[Pos] >= '0' && Digits[Pos] <= '9' && Value <= MAX_int32; Pos++)
+	{
+		Value = Value * 10 + (Digits[Pos] - '0');
+	}
+	Value = FMath::Min<int64>(Value, MAX_int32);
+
+	return (int32)(bNegative ? -Value : Value);
+}
+
+IRCStringView FTwitchChatCommand::Rest(int32 Index) const
+{
+	size_t Start;
+	if (Index < NumTokens)
+	{
+		Start = Tokens[Index].data() - Text.data();
+	}
+	else
+	{
+		// Past what was split off, pick up after the last token
+		Start = NumTokens > 0 ? Tokens[NumTokens - 1].data() + Tokens[NumTokens - 1].size() - Text.data() : 0;
+		while (Start < Text.size() && IsCommandSpace(Text[Start]))
+		{
+			Start++;
+		}
+	}
+
+	return Text.substr(Start);
+}
+
+uint32 FTwitchCommandRegistry::HashToken(IRCStringView Token)
+{
+	// FNV-1a over the lowercased token, commands have always been case-insensitive
+	uint32 Hash = 2166136261u;
+	for (size_t i = 0; i < Token.size(); i++)
+	{
+		char C = Token[i];
+		Hash ^= (uint8)(C >= 'A' && C <= 'Z' ? C - 'A' + 'a' : C);
+		Hash *= 16777619u;
+	}
+	return Hash;
+}
+
+bool FTwitchCommandRegistry::Register(const FTwitchCommandInfo& Info)
+{
+	uint32 Hash = HashToken(Info.Name);
+	if (const FTwitchCommandInfo* Existing = Commands.Find(Hash))
+	{
+		UE_LOG(LogUTTwitchHype, Warning, TEXT("Can't register %s, %s already has its hash"), UTF8_TO_TCHAR(Info.Name.c_str()), UTF8_TO_TCHAR(Existing->Name.c_str()));
+		return false;
+	}
+
+	Commands.Add(Hash, Info).Id = Hash;
+	return true;
+}
+
+const FTwitchCommandInfo* FTwitchCommandRegistry::Find(IRCStringView Token) const
+{
+	const FTwitchCommandInfo* Info = Commands.Find(HashToken(Token));
+	// Checked in case it's a different token with the same hash
+	if (Info == nullptr || !Token.equals_nocase(Info->Name))
+	{
+		return nullptr;
+	}
+
+	return Info;
+}
+
+bool FTwitchCommandRegistry::SetCooldown(IRCStringView Name, float Seconds)
+{
+	FTwitchCommandInfo* Info = Commands.Find(HashToken(Name));
+	if (Info == nullptr || !Name.equals_nocase(Info->Name))
+	{
+		return false;
+	}
+
+	Info->Cooldown = Seconds;
+	return true;
+}
@@ -0,0 +1,90 @@
+// Copyright 1998-2015 Epic Games, Inc. All Rights Reserved.
+#pragma once
+
+struct FTwitchHype;
+struct FTwitchChannel;
+struct FUserProfile;
+
+// The command token and as many arguments as the command reads
+#define TWITCH_MAX_COMMAND_TOKENS 8
+
+// A chat command split into views of the message, nothing past the last argument the
+// command takes is ever looked at
+struct FTwitchChatCommand
+{
+	FTwitchChatCommand() : UserId(0), Cost(0), NumTokens(0) {}
+
+	/** Splits off the command token and up to MaxArgs arguments after it, on whitespace */
+	void Tokenize(IRCStringView InText, int32 MaxArgs);
+
+	/** The command token counts, so this is 1 more than the number of arguments */
+	int32 Num() const { return NumTokens; }
+	IRCStringView Token(int32 Index) const { return Index < NumTokens ? Tokens[Index] : IRCStringView(); }
+	/** For the engine, player names and package names, otherwise stick to Token */
+	FString operator[](int32 Index) const { return Utf8ToFString(Token(Index)); }
+
+	/** The Index'th token as a number, 0 if it doesn't start with one */
+	int32 Int(int32 Index) const;
+
+	/** Everything from the Index'th token to the end of the message, spaces and all */
+	IRCStringView Rest(int32 Index) const;
+
+	uint64 UserId;
+	IRCStringView Text;
+
+	/** What the registry has this command costing, the handler takes it once the command goes through */
+	int32 Cost;
+
+private:
+	IRCStringView Tokens[TWITCH_MAX_COMMAND_TOKENS];
+	int32 NumTokens;
+};
+
+// Profile is null for commands that don't need an account
+typedef void (*FTwitchCommandHandler)(FTwitchHype& TwitchHype, FTwitchChannel& Channel, const FTwitchChatCommand& ParsedCommand, FUserProfile* Profile, IRCStringView Username);
+
+struct FTwitchCommandInfo
+{
+	std::string Name;
+	FTwitchCommandHandler Handler;
+
+	/** Credits the viewer needs before the handler is run, 0 for free commands */
+	int32 Cost;
+	/** What the cost pays for, as in "it costs 2000 to taunt" */
+	std::string Action;
+
+	int32 MinArgs;
+	int32 MaxArgs;
+	/** Sent back when there are fewer than MinArgs arguments */
+	std::string Usage;
+
+	bool bNeedsProfile;
+
+	/** Seconds before the same viewer can use it again, below 0 uses the default */
+	float Cooldown;
+
+	/** Set by Register, the hash of Name */
+	uint32 Id;
+};
+
+// Chat commands keyed by a case-insensitive hash of their token, so finding one is
+// a single lookup however many there are
+class FTwitchCommandRegistry
+{
+public:
+	/** Name includes the '!'. Returns false if the name, or another name with the same hash, is already taken */
+	bool Register(const FTwitchCommandInfo& Info);
+
+	/** The command a message's first token names, or null */
+	const FTwitchCommandInfo* Find(IRCStringView Token) const;
+
+	/** Returns false if no command has that name */
+	bool SetCooldown(IRCStringView Name, float Seconds);
+
+	int32 Num() const { return Commands.Num(); }
+
+	static uint32 HashToken(IRCStringView Token);
+
+private:
+	TMap<uint32, FTwitchCommandInfo> Commands;
+};
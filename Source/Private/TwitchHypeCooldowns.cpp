@@ -0,0 +1,140 @@
+// Copyright 1998-2015 Epic Games, Inc. All Rights Reserved.
+
+#include "TwitchHype.h"
+#include "TwitchHypeCooldowns.h"
+
+FTwitchCooldowns::FTwitchCooldowns(double InResolution)
+	: Resolution(InResolution)
+	, bStarted(false)
+	, CurrentTick(0)
+	, FreeList(INDEX_NONE)
+{
+	for (int32 Level = 0; Level < TWITCH_COOLDOWN_WHEEL_LEVELS; Level++)
+	{
+		for (int32 Slot = 0; Slot < TWITCH_COOLDOWN_WHEEL_SLOTS; Slot++)
+		{
+			Slots[Level][Slot] = INDEX_NONE;
+		}
+	}
+}
+
+double FTwitchCooldowns::Remaining(uint64 UserId, uint32 CommandId, double Now) const
+{
+	const int32* Index = Active.Find(FTwitchCooldownKey(UserId, CommandId));
+	if (Index == nullptr)
+	{
+		return 0;
+	}
+
+	// Run out but not advanced past yet
+	double Left = Entries[*Index].Expires * Resolution - Now;
+	return Left > 0 ? Left : 0;
+}
+
+void FTwitchCooldowns::Start(uint64 UserId, uint32 CommandId, double Seconds, double Now)
+{
+	// Anything that ran out by now goes first, so Remaining and Start agree on what's running
+	Advance(Now);
+
+	FTwitchCooldownKey Key(UserId, CommandId);
+	if (Seconds <= 0 || Active.Contains(Key))
+	{
+		return;
+	}
+
+	int32 Index = FreeList;
+	if (Index != INDEX_NONE)
+	{
+		FreeList = Entries[Index].Next;
+	}
+	else
+	{
+		Index = Entries.Add(FEntry());
+	}
+
+	FEntry& Entry = Entries[Index];
+	Entry.Key = Key;
+	Entry.Expires = CurrentTick + FMath::Max<uint64>(1, (uint64)FMath::CeilToInt(Seconds / Resolution));
+	Insert(Index);
+
+	Active.Add(Key, Index);
+}
+
+void FTwitchCooldowns::Advance(double Now)
+{
+	uint64 Target = ToTick(Now);
+	if (!bStarted || Active.Num() == 0)
+	{
+		// Nothing to expire on the way, skip straight there
+		bStarted = true;
+		CurrentTick = FMath::Max(CurrentTick, Target);
+		return;
+	}
+
+	while (CurrentTick < Target)
+	{
+		CurrentTick++;
+
+		int32 Slot = (int32)(CurrentTick & (TWITCH_COOLDOWN_WHEEL_SLOTS - 1));
+		if (Slot == 0)
+		{
+			// The inner level came round, bring down what's due during its next turn
+			Cascade(1);
+		}
+
+		int32 Index = Slots[0][Slot];
+		Slots[0][Slot] = INDEX_NONE;
+		while (Index != INDEX_NONE)
+		{
+			int32 Next = Entries[Index].Next;
+			Expire(Index);
+			Index = Next;
+		}
+	}
+}
+
+void FTwitchCooldowns::Insert(int32 Index)
+{
+	FEntry& Entry = Entries[Index];
+	uint64 Delta = Entry.Expires > CurrentTick ? Entry.Expires - CurrentTick : 0;
+
+	int32 Level = 0;
+	while (Level < TWITCH_COOLDOWN_WHEEL_LEVELS - 1 && Delta >= (1ULL << (TWITCH_COOLDOWN_WHEEL_BITS * (Level + 1))))
+	{
+		Level++;
+	}
+
+	// Past the end of the wheel, park it in the furthest slot and it cascades back in when that comes round
+	uint64 SlotTick = CurrentTick + FMath::Min<uint64>(Delta, (1ULL << (TWITCH_COOLDOWN_WHEEL_BITS * TWITCH_COOLDOWN_WHEEL_LEVELS)) - 1);
+	int32 Slot = (int32)((SlotTick >> (TWITCH_COOLDOWN_WHEEL_BITS * Level)) & (TWITCH_COOLDOWN_WHEEL_SLOTS - 1));
+
+	Entry.Next = Slots[Level][Slot];
+	Slots[Level][Slot] = Index;
+}
+
+void FTwitchCooldowns::Cascade(int32 Level)
+{
+	int32 Slot = (int32)((CurrentTick >> (TWITCH_COOLDOWN_WHEEL_BITS * Level)) & (TWITCH_COOLDOWN_WHEEL_SLOTS - 1));
+
+	int32 Index = Slots[Level][Slot];
+	Slots[Level][Slot] = INDEX_NONE;
+	while (Index != INDEX_NONE)
+	{
+		int32 Next = Entries[Index].Next;
+		Insert(Index);
+		Index = Next;
+	}
+
+	if (Slot == 0 && Level + 1 < TWITCH_COOLDOWN_WHEEL_LEVELS)
+	{
+		Cascade(Level + 1);
+	}
+}
+
+void FTwitchCooldowns::Expire(int32 Index)
+{
+	Active.Remove(Entries[Index].Key);
+
+	Entries[Index].Next = FreeList;
+	FreeList = Index;
+}
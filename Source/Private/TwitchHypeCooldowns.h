@@ -0,0 +1,74 @@
+// Copyright 1998-2015 Epic Games, Inc. All Rights Reserved.
+#pragma once
+
+// Each level of the wheel has 1 << TWITCH_COOLDOWN_WHEEL_BITS slots, and every slot of a
+// level spans a whole turn of the level below it
+#define TWITCH_COOLDOWN_WHEEL_BITS 6
+#define TWITCH_COOLDOWN_WHEEL_SLOTS (1 << TWITCH_COOLDOWN_WHEEL_BITS)
+#define TWITCH_COOLDOWN_WHEEL_LEVELS 3
+
+struct FTwitchCooldownKey
+{
+	FTwitchCooldownKey() : UserId(0), CommandId(0) {}
+	FTwitchCooldownKey(uint64 InUserId, uint32 InCommandId) : UserId(InUserId), CommandId(InCommandId) {}
+
+	uint64 UserId;
+	uint32 CommandId;
+
+	bool operator==(const FTwitchCooldownKey& Other) const
+	{
+		return UserId == Other.UserId && CommandId == Other.CommandId;
+	}
+
+	friend uint32 GetTypeHash(const FTwitchCooldownKey& Key)
+	{
+		return HashCombine(GetTypeHash(Key.UserId), Key.CommandId);
+	}
+};
+
+// Per viewer, per command cooldowns. Looking one up is a single map lookup, and expiring them
+// walks only the wheel slots time has passed through, so neither depends on how many viewers
+// are cooling down. Cooldowns longer than the outer level's span just cascade down later.
+class FTwitchCooldowns
+{
+public:
+	/** Resolution is the length of one slot of the innermost level in seconds, cooldowns are rounded up to it */
+	FTwitchCooldowns(double InResolution = 0.25);
+
+	/** Seconds until the viewer can use the command again, 0 if they can now */
+	double Remaining(uint64 UserId, uint32 CommandId, double Now) const;
+
+	/** Starts the command's cooldown for the viewer, does nothing if there's one running already */
+	void Start(uint64 UserId, uint32 CommandId, double Seconds, double Now);
+
+	/** Drops every cooldown that has run out by Now */
+	void Advance(double Now);
+
+	int32 Num() const { return Active.Num(); }
+
+private:
+	struct FEntry
+	{
+		FTwitchCooldownKey Key;
+		uint64 Expires;
+		// Next entry in the same slot, or in the free list, INDEX_NONE ends it
+		int32 Next;
+	};
+
+	uint64 ToTick(double Now) const { return (uint64)(Now / Resolution); }
+
+	void Insert(int32 Index);
+	void Cascade(int32 Level);
+	void Expire(int32 Index);
+
+	double Resolution;
+	bool bStarted;
+	uint64 CurrentTick;
+
+	TArray<FEntry> Entries;
+	int32 FreeList;
+	int32 Slots[TWITCH_COOLDOWN_WHEEL_LEVELS][TWITCH_COOLDOWN_WHEEL_SLOTS];
+
+	// Index into Entries of every running cooldown
+	TMap<FTwitchCooldownKey, int32> Active;
+};
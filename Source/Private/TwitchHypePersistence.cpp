@@ -0,0 +1,463 @@
+// Copyright 1998-2015 Epic Games, Inc. All Rights Reserved.
+
+#include "TwitchHype.h"
+#include "TwitchHypePersistence.h"
+
+static_assert((TWITCH_PERSIST_RING_SIZE & (TWITCH_PERSIST_RING_SIZE - 1)) == 0, "The persistence ring size has to be a power of two");
+
+struct FTwitchStatementText
+{
+	const TCHAR* Name;
+	const char* Sql;
+};
+
+// Indexed by ETwitchStatement. Writes all number their parameters the same way, ?1 credits, ?2 bankrupts, ?3 name, ?4 userid.
+// Names get reused once someone renames away from theirs, so a rename replaces whatever stale row still holds the new one
+static const FTwitchStatementText StatementTexts[ETwitchStatement::Count] =
+{
+	{ TEXT("update by id"), "UPDATE Users SET credits=?1,bankrupts=?2 WHERE userid=?4" },
+	{ TEXT("update by name"), "UPDATE Users SET credits=?1,bankrupts=?2 WHERE name=?3" },
+	{ TEXT("insert with id"), "INSERT INTO Users (name, credits, bankrupts, userid) VALUES (?3, ?1, ?2, ?4)" },
+	{ TEXT("insert by name"), "INSERT INTO Users (name, credits, bankrupts) VALUES (?3, ?1, ?2)" },
+	{ TEXT("rename"), "UPDATE OR REPLACE Users SET name=?3 WHERE userid=?4" },
+	{ TEXT("claim id"), "UPDATE Users SET userid=?4 WHERE name=?3" },
+	{ TEXT("load profiles"), "SELECT name, credits, bankrupts, userid FROM Users" },
+	{ TEXT("begin"), "BEGIN" },
+	{ TEXT("commit"), "COMMIT" },
+	{ TEXT("rollback"), "ROLLBACK" },
+};
+
+FTwitchStatementCache::FTwitchStatementCache()
+{
+	FMemory::Memzero(Statements, sizeof(Statements));
+	for (int32 Id = 0; Id < ETwitchStatement::Count; Id++)
+	{
+		RunCounts[Id].store(0);
+		TotalMicroseconds[Id].store(0);
+		MaxMicroseconds[Id].store(0);
+	}
+}
+
+FTwitchStatementCache::~FTwitchStatementCache()
+{
+	Finalize();
+}
+
+bool FTwitchStatementCache::Prepare(sqlite3* Db)
+{
+	bool bPrepared = true;
+	for (int32 Id = 0; Id < ETwitchStatement::Count; Id++)
+	{
+		if (Statements[Id] == nullptr && sqlite3_prepare_v2(Db, StatementTexts[Id].Sql, -1, &Statements[Id], nullptr) != SQLITE_OK)
+		{
+			UE_LOG(LogUTTwitchHype, Warning, TEXT("Can't prepare %s: %s"), ANSI_TO_TCHAR(StatementTexts[Id].Sql), UTF8_TO_TCHAR(sqlite3_errmsg(Db)));
+			sqlite3_finalize(Statements[Id]);
+			Statements[Id] = nullptr;
+			bPrepared = false;
+		}
+	}
+	return bPrepared;
+}
+
+void FTwitchStatementCache::Finalize()
+{
+	for (sqlite3_stmt*& Statement : Statements)
+	{
+		sqlite3_finalize(Statement);
+		Statement = nullptr;
+	}
+}
+
+void FTwitchStatementCache::Finish(ETwitchStatement::Type Id, double StartTime)
+{
+	sqlite3_reset(Statements[Id]);
+
+	// Only the thread running the statement writes these
+	uint64 Microseconds = (uint64)((FPlatformTime::Seconds() - StartTime) * 1000000.0);
+	RunCounts[Id].fetch_add(1, std::memory_order_relaxed);
+	TotalMicroseconds[Id].fetch_add(Microseconds, std::memory_order_relaxed);
+	if (Microseconds > MaxMicroseconds[Id].load(std::memory_order_relaxed))
+	{
+		MaxMicroseconds[Id].store(Microseconds, std::memory_order_relaxed);
+	}
+}
+
+bool FTwitchStatementCache::Execute(ETwitchStatement::Type Id)
+{
+	if (Statements[Id] == nullptr)
+	{
+		return false;
+	}
+
+	double Start = FPlatformTime::Seconds();
+	bool bDone = sqlite3_step(Statements[Id]) == SQLITE_DONE;
+	Finish(Id, Start);
+	return bDone;
+}
+
+const TCHAR* FTwitchStatementCache::Name(ETwitchStatement::Type Id)
+{
+	return StatementTexts[Id].Name;
+}
+
+double FTwitchStatementCache::AverageTime(ETwitchStatement::Type Id) const
+{
+	uint64 Count = Runs(Id);
+	return Count > 0 ? TotalMicroseconds[Id].load(std::memory_order_relaxed) / 1000000.0 / Count : 0.0;
+}
+
+sqlite3* FTwitchPersistence::Open(const FString& Path, const FTwitchStorageProfile& Profile)
+{
+	sqlite3* Db = nullptr;
+	if (sqlite3_open(TCHAR_TO_UTF8(*Path), &Db) != SQLITE_OK)
+	{
+		UE_LOG(LogUTTwitchHype, Warning, TEXT("Could not open database %s"), *Path);
+		sqlite3_close(Db);
+		return nullptr;
+	}
+
+	// journal_mode is kept in the file, switching back from WAL works as long as nothing else has it open.
+	// A negative cache_size is in kilobytes rather than pages
+	char* Pragmas = sqlite3_mprintf("PRAGMA journal_mode=%s; PRAGMA synchronous=%d; PRAGMA mmap_size=%lld; PRAGMA cache_size=%d; PRAGMA temp_store=%d;",
+		Profile.bWriteAheadLog ? "WAL" : "DELETE",
+		FMath::Clamp(Profile.Synchronous, 0, 2),
+		(sqlite3_int64)FMath::Max(Profile.MmapSizeMB, 0) * 1024 * 1024,
+		-FMath::Max(Profile.CacheSizeKB, 1),
+		Profile.bTempStoreMemory ? 2 : 0);
+	char* Error = nullptr;
+	if (sqlite3_exec(Db, Pragmas, nullptr, nullptr, &Error) != SQLITE_OK)
+	{
+		UE_LOG(LogUTTwitchHype, Warning, TEXT("Storage profile not fully applied: %s"), UTF8_TO_TCHAR(Error));
+	}
+	sqlite3_free(Error);
+	sqlite3_free(Pragmas);
+
+	// http://www.sqlite.org/lang_createtable.html#rowid claims this is an alias for row id
+	sqlite3_exec(Db, "CREATE TABLE IF NOT EXISTS Users (name varchar(50) NOT NULL PRIMARY KEY, credits int, bankrupts int, jointime timestamp NOT NULL DEFAULT CURRENT_TIMESTAMP, userid integer)", nullptr, nullptr, nullptr);
+
+	// Databases from before user ids were tracked, fails harmlessly once the column is there
+	sqlite3_exec(Db, "ALTER TABLE Users ADD COLUMN userid integer", nullptr, nullptr, nullptr);
+
+	// Rows are written back by id, without this every one of them is a scan of the whole table
+	sqlite3_exec(Db, "CREATE INDEX IF NOT EXISTS UsersByUserId ON Users (userid)", nullptr, nullptr, nullptr);
+
+	return Db;
+}
+
+int FTwitchPersistence::OnWalCommit(void* Context, sqlite3* InDb, const char* Database, int Pages)
+{
+	// Registering this turns off SQLite's own checkpoint after a commit, the worker decides when instead
+	((FTwitchPersistence*)Context)->WalPages.store(Pages, std::memory_order_relaxed);
+	return SQLITE_OK;
+}
+
+FTwitchPersistence::FTwitchPersistence(sqlite3* InDb, const FTwitchStorageProfile& Profile, float InInterval, int32 InBatchSize)
+	: Db(InDb)
+	, Interval(FMath::Max(InInterval, 0.01f))
+	, BatchSize(FMath::Clamp(InBatchSize, 1, TWITCH_PERSIST_RING_SIZE))
+	, bWriteAheadLog(Profile.bWriteAheadLog)
+	, CheckpointPages(FMath::Max(Profile.CheckpointPages, 0))
+	, Head(0)
+	, Tail(0)
+	, Thread(nullptr)
+	, WakeEvent(FPlatformProcess::CreateSynchEvent())
+	, bStopping(false)
+	, bFlushRequested(false)
+	, bCheckpointRequested(false)
+	, Rows(0)
+	, Transactions(0)
+	, FailedCommits(0)
+	, FailedRows(0)
+	, LastLag(0)
+	, MaxLag(0)
+	, LastCommitDuration(0)
+	, Checkpoints(0)
+	, WalPages(0)
+	, LastCheckpointDuration(0)
+{
+	Statements.Prepare(Db);
+
+	if (bWriteAheadLog)
+	{
+		sqlite3_wal_hook(Db, &FTwitchPersistence::OnWalCommit, this);
+	}
+}
+
+FTwitchPersistence::~FTwitchPersistence()
+{
+	Shutdown();
+	delete WakeEvent;
+}
+
+bool FTwitchPersistence::Start()
+{
+	Thread = FRunnableThread::Create(this, TEXT("TwitchHypePersistence"), 0, TPri_BelowNormal);
+	return Thread != nullptr;
+}
+
+void FTwitchPersistence::Shutdown()
+{
+	if (Thread)
+	{
+		Stop();
+		Thread->WaitForCompletion();
+		delete Thread;
+		Thread = nullptr;
+	}
+
+	if (Db == nullptr)
+	{
+		return;
+	}
+
+	// The worker is gone, so this thread is the consumer now. Whatever it didn't get to,
+	// and the backlog behind it, goes out before the database is closed
+	bool bCommitted = CommitBatch();
+	while (bCommitted && Backlog.Num() > 0)
+	{
+		Tick();
+		bCommitted = CommitBatch();
+	}
+	if (!bCommitted)
+	{
+		UE_LOG(LogUTTwitchHype, Warning, TEXT("Lost %d profile changes that couldn't be saved"), Pending());
+	}
+
+	Statements.Finalize();
+
+	sqlite3_close(Db);
+	Db = nullptr;
+}
+
+void FTwitchPersistence::Stop()
+{
+	bStopping.store(true, std::memory_order_release);
+	Wake();
+}
+
+void FTwitchPersistence::Wake()
+{
+	WakeEvent->Trigger();
+}
+
+bool FTwitchPersistence::Push(const FTwitchProfileChange& Change)
+{
+	size_t CurrentTail = Tail.load(std::memory_order_relaxed);
+	size_t Queued = CurrentTail - Head.load(std::memory_order_acquire);
+	if (Queued == TWITCH_PERSIST_RING_SIZE)
+	{
+		return false;
+	}
+
+	Ring[CurrentTail & (TWITCH_PERSIST_RING_SIZE - 1)] = Change;
+	Tail.store(CurrentTail + 1, std::memory_order_release);
+
+	// Only when the batch fills up, the worker looks at the count again after every commit anyway
+	if (Queued + 1 == BatchSize)
+	{
+		Wake();
+	}
+	return true;
+}
+
+void FTwitchPersistence::Enqueue(const FTwitchProfileChange& Change)
+{
+	// Anything already held back has to go first, changes to one row only make sense in order
+	if (Backlog.Num() > 0 || !Push(Change))
+	{
+		Backlog.Add(Change);
+	}
+}
+
+void FTwitchPersistence::Tick()
+{
+	int32 Moved = 0;
+	while (Moved < Backlog.Num() && Push(Backlog[Moved]))
+	{
+		Moved++;
+	}
+
+	if (Moved > 0)
+	{
+		Backlog.RemoveAt(0, Moved, false);
+	}
+
+	// The ring is full, no point waiting out the interval
+	if (Backlog.Num() > 0)
+	{
+		Wake();
+	}
+}
+
+void FTwitchPersistence::Flush()
+{
+	bFlushRequested.store(true, std::memory_order_release);
+	Wake();
+}
+
+void FTwitchPersistence::Checkpoint()
+{
+	bCheckpointRequested.store(true, std::memory_order_release);
+	Wake();
+}
+
+int32 FTwitchPersistence::Pending() const
+{
+	return (int32)(Tail.load(std::memory_order_acquire) - Head.load(std::memory_order_acquire)) + Backlog.Num();
+}
+
+FTwitchPersistenceStats FTwitchPersistence::Stats() const
+{
+	FTwitchPersistenceStats Result;
+	Result.Rows = Rows.load(std::memory_order_relaxed);
+	Result.Transactions = Transactions.load(std::memory_order_relaxed);
+	Result.FailedCommits = FailedCommits.load(std::memory_order_relaxed);
+	Result.FailedRows = FailedRows.load(std::memory_order_relaxed);
+	Result.LastLag = LastLag.load(std::memory_order_relaxed);
+	Result.MaxLag = MaxLag.load(std::memory_order_relaxed);
+	Result.LastCommitDuration = LastCommitDuration.load(std::memory_order_relaxed);
+	Result.Checkpoints = Checkpoints.load(std::memory_order_relaxed);
+	Result.WalPages = WalPages.load(std::memory_order_relaxed);
+	Result.LastCheckpointDuration = LastCheckpointDuration.load(std::memory_order_relaxed);
+	return Result;
+}
+
+uint32 FTwitchPersistence::Run()
+{
+	double LastCommit = FPlatformTime::Seconds();
+	while (!bStopping.load(std::memory_order_acquire))
+	{
+		double Now = FPlatformTime::Seconds();
+		size_t Queued = Tail.load(std::memory_order_acquire) - Head.load(std::memory_order_relaxed);
+		bool bDue = Now - LastCommit >= Interval || Queued >= BatchSize || bFlushRequested.load(std::memory_order_acquire) || bCheckpointRequested.load(std::memory_order_acquire);
+		if (!bDue)
+		{
+			WakeEvent->Wait(FMath::Max(1, FMath::CeilToInt((LastCommit + Interval - Now) * 1000.0)));
+			continue;
+		}
+
+		bFlushRequested.store(false, std::memory_order_release);
+		bool bCheckpoint = bCheckpointRequested.exchange(false, std::memory_order_acq_rel);
+		CommitBatch();
+		LastCommit = FPlatformTime::Seconds();
+
+		// The log only grows until it's checkpointed, a long enough match can't wait for the end
+		if (bCheckpoint || (CheckpointPages > 0 && WalPages.load(std::memory_order_relaxed) >= CheckpointPages))
+		{
+			CheckpointWal();
+		}
+	}
+
+	// Shutdown commits whatever is left once the thread is gone
+	return 0;
+}
+
+ETwitchStatement::Type FTwitchPersistence::StatementFor(const FTwitchProfileChange& Change)
+{
+	switch (Change.Type)
+	{
+	case ETwitchProfileChange::Insert:
+		return Change.bNameKey ? ETwitchStatement::InsertByName : ETwitchStatement::InsertWithId;
+	case ETwitchProfileChange::Rename:
+		return ETwitchStatement::Rename;
+	case ETwitchProfileChange::ClaimId:
+		return ETwitchStatement::ClaimId;
+	default:
+		return Change.bNameKey ? ETwitchStatement::UpdateByName : ETwitchStatement::UpdateById;
+	}
+}
+
+void FTwitchPersistence::CheckpointWal()
+{
+	if (!bWriteAheadLog)
+	{
+		return;
+	}
+
+	// TRUNCATE also empties the log file, nothing else has the database open for it to wait on
+	double Start = FPlatformTime::Seconds();
+	if (sqlite3_wal_checkpoint_v2(Db, nullptr, SQLITE_CHECKPOINT_TRUNCATE, nullptr, nullptr) != SQLITE_OK)
+	{
+		UE_LOG(LogUTTwitchHype, Warning, TEXT("Couldn't checkpoint the database: %s"), UTF8_TO_TCHAR(sqlite3_errmsg(Db)));
+		return;
+	}
+
+	WalPages.store(0, std::memory_order_relaxed);
+	Checkpoints.fetch_add(1, std::memory_order_relaxed);
+	LastCheckpointDuration.store(FPlatformTime::Seconds() - Start, std::memory_order_relaxed);
+}
+
+bool FTwitchPersistence::Apply(const FTwitchProfileChange& Change)
+{
+	ETwitchStatement::Type Id = StatementFor(Change);
+	sqlite3_stmt* Prepared = Statements.Get(Id);
+	if (Prepared == nullptr)
+	{
+		return false;
+	}
+
+	double Start = FPlatformTime::Seconds();
+
+	// Bound rather than printed in, so there's nothing in a name to escape. The by-name
+	// statements stop short of the userid parameter
+	int32 Parameters = sqlite3_bind_parameter_count(Prepared);
+	sqlite3_bind_int(Prepared, 1, Change.Credits);
+	sqlite3_bind_int(Prepared, 2, Change.Bankrupts);
+	sqlite3_bind_text(Prepared, 3, Change.Name, Change.NameLength, SQLITE_STATIC);
+	if (Parameters >= 4)
+	{
+		sqlite3_bind_int64(Prepared, 4, (sqlite3_int64)Change.UserId);
+	}
+
+	bool bDone = sqlite3_step(Prepared) == SQLITE_DONE;
+	Statements.Finish(Id, Start);
+	return bDone;
+}
+
+bool FTwitchPersistence::CommitBatch()
+{
+	size_t First = Head.load(std::memory_order_relaxed);
+	size_t Last = Tail.load(std::memory_order_acquire);
+	if (First == Last)
+	{
+		return true;
+	}
+
+	double Start = FPlatformTime::Seconds();
+	Statements.Execute(ETwitchStatement::Begin);
+
+	uint64 Failed = 0;
+	for (size_t Index = First; Index != Last; Index++)
+	{
+		const FTwitchProfileChange& Change = Ring[Index & (TWITCH_PERSIST_RING_SIZE - 1)];
+		if (!Apply(Change))
+		{
+			// One bad row isn't worth losing the rest of the batch over
+			if (Failed++ == 0)
+			{
+				UE_LOG(LogUTTwitchHype, Warning, TEXT("Couldn't save %s: %s"), UTF8_TO_TCHAR(std::string(Change.Name, Change.NameLength).c_str()), UTF8_TO_TCHAR(sqlite3_errmsg(Db)));
+			}
+		}
+	}
+
+	// Nothing leaves the ring until it's committed, a failed commit is simply tried again next time
+	if (!Statements.Execute(ETwitchStatement::Commit))
+	{
+		UE_LOG(LogUTTwitchHype, Warning, TEXT("Couldn't save %d profile changes: %s"), (int32)(Last - First), UTF8_TO_TCHAR(sqlite3_errmsg(Db)));
+		Statements.Execute(ETwitchStatement::Rollback);
+		FailedCommits.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+
+	double Now = FPlatformTime::Seconds();
+	double Lag = Now - Ring[First & (TWITCH_PERSIST_RING_SIZE - 1)].QueuedTime;
+	Head.store(Last, std::memory_order_release);
+
+	Rows.fetch_add(Last - First - Failed, std::memory_order_relaxed);
+	FailedRows.fetch_add(Failed, std::memory_order_relaxed);
+	Transactions.fetch_add(1, std::memory_order_relaxed);
+	LastLag.store(Lag, std::memory_order_relaxed);
+	MaxLag.store(FMath::Max(MaxLag.load(std::memory_order_relaxed), Lag), std::memory_order_relaxed);
+	LastCommitDuration.store(Now - Start, std::memory_order_relaxed);
+	return true;
+}
@@ -0,0 +1,198 @@
+// Copyright 1998-2015 Epic Games, Inc. All Rights Reserved.
+#pragma once
+
+#include <atomic>
+#include "sqlite3.h"
+
+// Changes the game thread can queue before the worker catches up, past this they wait in a backlog
+#define TWITCH_PERSIST_RING_SIZE 4096
+// Twitch login names are at most 25 characters
+#define TWITCH_PERSIST_MAX_NAME 64
+
+struct FTwitchStorageProfile;
+
+namespace ETwitchStatement
+{
+	enum Type
+	{
+		UpdateById,
+		UpdateByName,
+		InsertWithId,
+		InsertByName,
+		Rename,
+		ClaimId,
+		LoadProfiles,
+		Begin,
+		Commit,
+		Rollback,
+		Count
+	};
+}
+
+// Every statement the plugin runs, prepared once when the database is opened and reset
+// between runs, so no query is formatted or parsed more than once. Counts how often and
+// how long each one runs, the counts can be read from any thread.
+class FTwitchStatementCache
+{
+public:
+	FTwitchStatementCache();
+	~FTwitchStatementCache();
+
+	/** False if any of them failed, those stay nullptr */
+	bool Prepare(sqlite3* Db);
+	void Finalize();
+
+	/** Ready to bind and step, nullptr if it didn't prepare */
+	sqlite3_stmt* Get(ETwitchStatement::Type Id) const { return Statements[Id]; }
+	/** Resets the statement for its next run and counts this one, StartTime is FPlatformTime::Seconds() from before it was bound */
+	void Finish(ETwitchStatement::Type Id, double StartTime);
+	/** Runs one that takes no parameters and returns no rows, false if it failed */
+	bool Execute(ETwitchStatement::Type Id);
+
+	static const TCHAR* Name(ETwitchStatement::Type Id);
+	uint64 Runs(ETwitchStatement::Type Id) const { return RunCounts[Id].load(std::memory_order_relaxed); }
+	/** In seconds */
+	double AverageTime(ETwitchStatement::Type Id) const;
+	double MaxTime(ETwitchStatement::Type Id) const { return MaxMicroseconds[Id].load(std::memory_order_relaxed) / 1000000.0; }
+
+private:
+	sqlite3_stmt* Statements[ETwitchStatement::Count];
+
+	std::atomic<uint64> RunCounts[ETwitchStatement::Count];
+	std::atomic<uint64> TotalMicroseconds[ETwitchStatement::Count];
+	std::atomic<uint64> MaxMicroseconds[ETwitchStatement::Count];
+};
+
+namespace ETwitchProfileChange
+{
+	enum Type
+	{
+		// New credits and bankrupts for an existing row
+		Update,
+		Insert,
+		// The viewer changed their name on Twitch, the id stays
+		Rename,
+		// An account registered before ids were tracked gets its id
+		ClaimId,
+		Count
+	};
+}
+
+/** A copy of what changed, so the worker never looks at the game thread's profiles */
+struct FTwitchProfileChange
+{
+	ETwitchProfileChange::Type Type;
+	uint64 UserId;
+	// UserId is a hash of the name, the row is found by name and has no userid
+	bool bNameKey;
+	int32 Credits;
+	int32 Bankrupts;
+	// UTF-8, not terminated
+	char Name[TWITCH_PERSIST_MAX_NAME];
+	int32 NameLength;
+	double QueuedTime;
+};
+
+struct FTwitchPersistenceStats
+{
+	uint64 Rows;
+	uint64 Transactions;
+	uint64 FailedCommits;
+	uint64 FailedRows;
+	// Seconds from the oldest change in a transaction being queued to its commit
+	double LastLag;
+	double MaxLag;
+	// How long the last COMMIT took
+	double LastCommitDuration;
+	uint64 Checkpoints;
+	// Write-ahead log pages not yet checkpointed
+	int32 WalPages;
+	double LastCheckpointDuration;
+};
+
+// Owns the database once the profiles are loaded. The game thread queues change records
+// through a lock-free single producer / single consumer ring, and the worker writes them
+// in one transaction every Interval seconds, or sooner once BatchSize of them are waiting.
+class FTwitchPersistence : public FRunnable
+{
+public:
+	/** Opens the database with the profile's pragmas and makes sure the Users table is there, nullptr if it can't */
+	static sqlite3* Open(const FString& Path, const FTwitchStorageProfile& Profile);
+
+	/** Takes over InDb, which was opened with Profile */
+	FTwitchPersistence(sqlite3* InDb, const FTwitchStorageProfile& Profile, float InInterval, int32 InBatchSize);
+	virtual ~FTwitchPersistence();
+
+	bool Start();
+
+	/** Stops the worker, writes everything still queued and closes the database */
+	void Shutdown();
+
+	// Game thread side
+	/** Never blocks, a full ring holds the change back until Tick finds room for it */
+	void Enqueue(const FTwitchProfileChange& Change);
+	/** Moves changes held back into the ring, call once a tick */
+	void Tick();
+	/** Has the worker commit what's queued now rather than at the end of the interval */
+	void Flush();
+	/** Has the worker commit what's queued and then checkpoint the write-ahead log, call between matches */
+	void Checkpoint();
+	/** Only for the game thread while the worker isn't running, the statistics are good from anywhere */
+	FTwitchStatementCache& StatementCache() { return Statements; }
+	/** Changes not yet committed, the backlog included */
+	int32 Pending() const;
+	int32 Backlogged() const { return Backlog.Num(); }
+	FTwitchPersistenceStats Stats() const;
+
+	// FRunnable
+	virtual uint32 Run() override;
+	virtual void Stop() override;
+
+private:
+	friend struct FTwitchHypeBenchmark;
+
+	static int OnWalCommit(void* Context, sqlite3* InDb, const char* Database, int Pages);
+
+	bool Push(const FTwitchProfileChange& Change);
+	void Wake();
+
+	// Worker side, or the game thread once the worker is gone
+	/** False if the COMMIT failed, the batch stays queued */
+	bool CommitBatch();
+	bool Apply(const FTwitchProfileChange& Change);
+	static ETwitchStatement::Type StatementFor(const FTwitchProfileChange& Change);
+	void CheckpointWal();
+
+	sqlite3* Db;
+	double Interval;
+	size_t BatchSize;
+	bool bWriteAheadLog;
+	int32 CheckpointPages;
+
+	FTwitchProfileChange Ring[TWITCH_PERSIST_RING_SIZE];
+	// Free running counters, only the worker moves Head and only the game thread moves Tail
+	std::atomic<size_t> Head;
+	std::atomic<size_t> Tail;
+
+	// Game thread only, in order behind everything in the ring
+	TArray<FTwitchProfileChange> Backlog;
+
+	FTwitchStatementCache Statements;
+
+	FRunnableThread* Thread;
+	FEvent* WakeEvent;
+	std::atomic<bool> bStopping;
+	std::atomic<bool> bFlushRequested;
+	std::atomic<bool> bCheckpointRequested;
+
+	std::atomic<uint64> Rows;
+	std::atomic<uint64> Transactions;
+	std::atomic<uint64> FailedCommits;
+	std::atomic<uint64> FailedRows;
+	std::atomic<double> LastLag;
+	std::atomic<double> MaxLag;
+	std::atomic<double> LastCommitDuration;
+	std::atomic<uint64> Checkpoints;
+	std::atomic<int32> WalPages;
+	std::atomic<double> LastCheckpointDuration;
+};
@@ -1,6 +1,7 @@
 // Copyright 1998-2015 Epic Games, Inc. All Rights Reserved.
 
 #include "TwitchHype.h"
+#include "TwitchHypeBenchmark.h"
 
 #include "Core.h"
 #include "Engine.h"
@@ -12,8 +13,11 @@ IMPLEMENT_MODULE(FTwitchHypePlugin, TwitchHype)
 
 void FTwitchHypePlugin::StartupModule()
 {
+	// Has to be in place before any of the plugin's threads start allocating
+	FTwitchHypeBenchmark::InstallAllocationCounter();
+
 	// Make an object that ticks
-	TwitchHype = new FTwitchHype();
+	TwitchHype = new FTwitchHype(FPaths::GameSavedDir() / TEXT("TwitchHype.db"));
 
 	FWorldDelegates::FWorldInitializationEvent::FDelegate OnWorldCreatedDelegate = FWorldDelegates::FWorldInitializationEvent::FDelegate::CreateRaw(TwitchHype, &FTwitchHype::OnWorldCreated);
 	FDelegateHandle OnWorldCreatedDelegateHandle = FWorldDelegates::OnPostWorldInitialization.Add(OnWorldCreatedDelegate);
@@ -0,0 +1,147 @@
+// Copyright 1998-2015 Epic Games, Inc. All Rights Reserved.
+
+#include "TwitchHype.h"
+#include "TwitchHypeText.h"
+
+// Longest int32 with its sign
+#define TWITCH_MAX_NUMBER_LENGTH 11
+
+FString Utf8ToFString(IRCStringView Text)
+{
+	if (Text.empty())
+	{
+		return FString();
+	}
+
+	FUTF8ToTCHAR Converted(Text.data(), (int32)Text.size());
+	return FString(Converted.Length(), Converted.Get());
+}
+
+static char* WriteNumber(char* Out, int32 Value)
+{
+	// Written backwards from the last digit, no format string to parse
+	char Digits[TWITCH_MAX_NUMBER_LENGTH];
+	char* End = Digits + TWITCH_MAX_NUMBER_LENGTH;
+	char* Start = End;
+
+	uint32 Magnitude = Value < 0 ? 0u - (uint32)Value : (uint32)Value;
+	do
+	{
+		*--Start = (char)('0' + Magnitude % 10);
+		Magnitude /= 10;
+	} while (Magnitude != 0);
+
+	if (Value < 0)
+	{
+		*--Start = '-';
+	}
+
+	FMemory::Memcpy(Out, Start, End - Start);
+	return Out + (End - Start);
+}
+
+void FTwitchReplyTemplate::Compile(const char* Format)
+{
+	Fixed.clear();
+	Pieces.Empty();
+
+	int32 RunStart = 0;
+	for (const char* C = Format; *C; C++)
+	{
+		// Anything that isn't exactly {digit} is plain text
+		if (C[0] != '{' || C[1] < '0' || C[1] > '9' || C[2] != '}')
+		{
+			Fixed += *C;
+			continue;
+		}
+
+		if ((int32)Fixed.size() > RunStart)
+		{
+			FPiece Run = { RunStart, (int32)Fixed.size() - RunStart, INDEX_NONE };
+			Pieces.Add(Run);
+		}
+
+		FPiece Field = { 0, 0, C[1] - '0' };
+		Pieces.Add(Field);
+
+		RunStart = (int32)Fixed.size();
+		C += 2;
+	}
+
+	if ((int32)Fixed.size() > RunStart)
+	{
+		FPiece Run = { RunStart, (int32)Fixed.size() - RunStart, INDEX_NONE };
+		Pieces.Add(Run);
+	}
+}
+
+size_t FTwitchReplyTemplate::MaxLength(FTwitchReplyArgs Args) const
+{
+	size_t Length = Fixed.size();
+	for (const FPiece& Piece : Pieces)
+	{
+		if (Piece.Arg == INDEX_NONE || Piece.Arg >= (int32)Args.size())
+		{
+			continue;
+		}
+
+		const FTwitchReplyArg& Arg = Args.begin()[Piece.Arg];
+		switch (Arg.Type)
+		{
+		case FTwitchReplyArg::ARG_Text:
+			Length += Arg.Text.size();
+			break;
+		case FTwitchReplyArg::ARG_Number:
+			Length += TWITCH_MAX_NUMBER_LENGTH;
+			break;
+		case FTwitchReplyArg::ARG_EngineText:
+			// A TCHAR is at most 4 bytes of UTF-8, where TCHAR is 4 bytes wide it can hold any character
+			Length += Arg.EngineText->Len() * 4;
+			break;
+		}
+	}
+
+	return Length;
+}
+
+size_t FTwitchReplyTemplate::Render(char* Out, size_t Capacity, FTwitchReplyArgs Args) const
+{
+	char* End = Out;
+	for (const FPiece& Piece : Pieces)
+	{
+		if (Piece.Arg == INDEX_NONE)
+		{
+			FMemory::Memcpy(End, Fixed.data() + Piece.Offset, Piece.Length);
+			End += Piece.Length;
+			continue;
+		}
+
+		if (Piece.Arg >= (int32)Args.size())
+		{
+			continue;
+		}
+
+		const FTwitchReplyArg& Arg = Args.begin()[Piece.Arg];
+		switch (Arg.Type)
+		{
+		case FTwitchReplyArg::ARG_Text:
+			FMemory::Memcpy(End, Arg.Text.data(), Arg.Text.size());
+			End += Arg.Text.size();
+			break;
+		case FTwitchReplyArg::ARG_Number:
+			End = WriteNumber(End, Arg.Number);
+			break;
+		case FTwitchReplyArg::ARG_EngineText:
+			{
+				// Names fit the converter's inline buffer, this doesn't touch the heap
+				FTCHARToUTF8 Converted(**Arg.EngineText);
+				check(End + Converted.Length() <= Out + Capacity);
+				FMemory::Memcpy(End, Converted.Get(), Converted.Length());
+				End += Converted.Length();
+			}
+			break;
+		}
+	}
+
+	return End - Out;
+}
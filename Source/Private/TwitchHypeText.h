@@ -0,0 +1,63 @@
+// Copyright 1998-2015 Epic Games, Inc. All Rights Reserved.
+#pragma once
+
+#include <initializer_list>
+
+// Chat stays UTF-8 from the socket to the reply, FString only where the engine wants one
+
+/** Copies UTF-8 chat into an FString, for player names, ClientSay and package lookups */
+FString Utf8ToFString(IRCStringView Text);
+
+// One value to fill into a reply template. Holds a view or a pointer, never a copy, so it
+// can't outlive the expression it's made in.
+struct FTwitchReplyArg
+{
+	FTwitchReplyArg(IRCStringView InText) : Type(ARG_Text), Text(InText), Number(0), EngineText(nullptr) {}
+	FTwitchReplyArg(const char* InText) : Type(ARG_Text), Text(InText), Number(0), EngineText(nullptr) {}
+	FTwitchReplyArg(const std::string& InText) : Type(ARG_Text), Text(InText), Number(0), EngineText(nullptr) {}
+	FTwitchReplyArg(int32 InNumber) : Type(ARG_Number), Number(InNumber), EngineText(nullptr) {}
+	/** Player and map names, converted to UTF-8 as they're written out */
+	FTwitchReplyArg(const FString& InEngineText) : Type(ARG_EngineText), Number(0), EngineText(&InEngineText) {}
+
+	enum EArgType
+	{
+		ARG_Text,
+		ARG_Number,
+		ARG_EngineText,
+	};
+
+	EArgType Type;
+	IRCStringView Text;
+	int32 Number;
+	const FString* EngineText;
+};
+
+typedef std::initializer_list<FTwitchReplyArg> FTwitchReplyArgs;
+
+// Reply text split once, when the bot starts, into the fixed fragments and the {0} to {9}
+// fields between them. Rendering writes straight into memory sized by MaxLength, usually
+// the client's frame arena, and the send queue copies it from there.
+class FTwitchReplyTemplate
+{
+public:
+	/** Format is fixed text with {0} to {9} where the arguments go */
+	void Compile(const char* Format);
+
+	/** Writes the template with Args filled in to Out and returns the length, fields with no argument are left out. Capacity is what MaxLength asked for */
+	size_t Render(char* Out, size_t Capacity, FTwitchReplyArgs Args) const;
+
+	/** Room Render needs for these Args */
+	size_t MaxLength(FTwitchReplyArgs Args) const;
+
+private:
+	struct FPiece
+	{
+		// A run of Fixed, or the argument to put there when Arg isn't INDEX_NONE
+		int32 Offset;
+		int32 Length;
+		int32 Arg;
+	};
+
+	std::string Fixed;
+	TArray<FPiece> Pieces;
+};